@@ -0,0 +1,278 @@
+/**
+ * @file bench.c
+ *
+ * Implementation of the benchmarks declared in bench.h. Each benchmark works on its own sectors,
+ * well away from the ones the tests use, and reports figures measured with time_us_64.
+ */
+
+#include "bench.h"
+#include "flash_log.h"
+#include "flash_ts.h"
+#include "flash_columnar.h"
+#include "flash_table.h"
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+// Sectors of the user region reserved for benchmarks.
+#define BENCH_OFFSET (64 * FLASH_SECTOR_SIZE)
+#define BENCH_SECTORS 16
+
+void run_all_benchmarks() {
+    const char *slashes = "////////////////////////////////////////////////////////////////";
+
+    // Benchmark the circular sample logger.
+    bench_flash_log();
+    printf("%s\n", slashes);
+
+    // Benchmark the compressed time series against the raw log.
+    bench_flash_ts();
+    printf("%s\n", slashes);
+
+    // Benchmark columnar DeviceConfig blocks against serialized structs.
+    bench_columnar_configs();
+    printf("%s\n", slashes);
+
+    // Benchmark in-place tables against copying and deserializing.
+    bench_flash_table();
+    printf("%s\n", slashes);
+}
+
+/**
+ * Appends two laps of sensor_value samples to a log spanning BENCH_SECTORS sectors, so the
+ * figures include the erase made on every wrap, then reads samples back in a scattered order.
+ * Reports the sustained ingest rate, the worst single append (the one that erases a sector), the
+ * flash operations per sample and the RAM the logger needs.
+ */
+void bench_flash_log() {
+    printf("Benchmarking the circular sample log...\n");
+    static flash_log_t log;
+    flash_log_open(&log, BENCH_OFFSET, BENCH_SECTORS, sizeof(flash_sample_t));
+    flash_log_clear(&log);
+
+    uint32_t samples = 2 * BENCH_SECTORS * log.records_per_sector;
+    uint64_t worst_us = 0;
+    uint64_t start = time_us_64();
+    for (uint32_t i = 0; i < samples; i++) {
+        flash_sample_t sample = { .timestamp_ms = i, .value = 20.0f + (float)(i % 100) * 0.01f };
+        uint64_t before = time_us_64();
+        flash_log_append(&log, &sample);
+        uint64_t took = time_us_64() - before;
+        if (took > worst_us) {
+            worst_us = took;
+        }
+    }
+    uint64_t ingest_us = time_us_64() - start;
+    if (ingest_us == 0) {
+        ingest_us = 1;
+    }
+
+    // Read back with a stride that visits every sector in a scattered order.
+    uint64_t first = flash_log_first(&log);
+    uint64_t span = flash_log_end(&log) - first;
+    uint32_t reads = 1000;
+    uint32_t errors = 0;
+    start = time_us_64();
+    for (uint32_t i = 0; i < reads; i++) {
+        uint64_t index = first + ((uint64_t)i * 7919u) % span;
+        flash_sample_t sample;
+        if (flash_log_read(&log, index, &sample) != FLASH_OK || sample.timestamp_ms != (uint32_t)index) {
+            errors++;
+        }
+    }
+    uint64_t read_us = time_us_64() - start;
+
+    printf("Ingest: %u samples of %u bytes in %llu us (%llu samples/s, %llu bytes/s).\n",
+           (unsigned)samples, (unsigned)sizeof(flash_sample_t), (unsigned long long)ingest_us,
+           (unsigned long long)samples * 1000000u / ingest_us,
+           (unsigned long long)samples * sizeof(flash_sample_t) * 1000000u / ingest_us);
+    printf("Worst append: %llu us. Page programs: %u (one per %u samples). Sector erases: %u.\n",
+           (unsigned long long)worst_us, (unsigned)log.page_programs,
+           (unsigned)(log.page_programs ? samples / log.page_programs : 0), (unsigned)log.sector_erases);
+    printf("Random access: %u reads in %llu us, %u mismatches.\n",
+           (unsigned)reads, (unsigned long long)read_us, (unsigned)errors);
+    printf("RAM: %u bytes of log state; %u samples retained in %u sectors.\n",
+           (unsigned)sizeof(flash_log_t), (unsigned)span, BENCH_SECTORS);
+}
+
+/**
+ * Stores the same two signals, a steady 12-bit ADC reading with occasional one-step changes and
+ * a noisier one using the bottom 5 bits, at 1 kHz with a little timestamp jitter. Reports bytes
+ * per sample, the ratio to 8-byte raw records, page programs per sample and decode speed.
+ */
+void bench_flash_ts() {
+    printf("Benchmarking the compressed time series...\n");
+    static flash_ts_store_t store;
+    const uint32_t samples = 20000;
+
+    for (int signal = 0; signal < 2; signal++) {
+        flash_ts_open(&store, BENCH_OFFSET, BENCH_SECTORS);
+        flash_log_clear(&store.log);
+
+        uint32_t noise = 12345;
+        uint64_t start = time_us_64();
+        for (uint32_t i = 0; i < samples; i++) {
+            noise = noise * 1103515245u + 12345u;
+            uint32_t raw = signal == 0 ? 2048 + (noise >> 28 == 0 ? 1 : 0) : 2048 + ((noise >> 16) & 31);
+            uint32_t jitter = (noise >> 8) % 50 == 0 ? 1 : 0;
+            flash_ts_append(&store, i + jitter, (float)raw * (3.3f / 4096.0f));
+        }
+        flash_ts_seal(&store);
+        uint64_t ingest_us = time_us_64() - start;
+
+        uint32_t decoded = 0;
+        start = time_us_64();
+        for (uint64_t b = flash_log_first(&store.log); b < flash_log_end(&store.log); b++) {
+            const uint8_t *block;
+            flash_ts_decoder_t dec;
+            uint32_t ts;
+            float value;
+            if (flash_ts_block(&store, b, &block) != FLASH_OK) {
+                continue;
+            }
+            flash_ts_decoder_init(&dec, block);
+            while (flash_ts_decoder_next(&dec, &ts, &value)) {
+                decoded++;
+            }
+        }
+        uint64_t decode_us = time_us_64() - start;
+
+        uint32_t blocks = (uint32_t)(flash_log_end(&store.log) - flash_log_first(&store.log));
+        uint32_t bytes = blocks * FLASH_TS_BLOCK_SIZE;
+        printf("%s signal: %u samples in %u blocks, %u.%02u bytes/sample, %u.%u x smaller than raw.\n",
+               signal == 0 ? "Steady" : "Noisy", (unsigned)samples, (unsigned)blocks,
+               (unsigned)(bytes / samples), (unsigned)(bytes * 100u / samples % 100),
+               (unsigned)(samples * 8u / bytes), (unsigned)(samples * 80u / bytes % 10));
+        printf("  Ingest %llu us, %u page programs (raw log: %u), decoded %u samples in %llu us.\n",
+               (unsigned long long)ingest_us, (unsigned)store.log.page_programs,
+               (unsigned)(samples * 8u / FLASH_PAGE_SIZE), (unsigned)decoded, (unsigned long long)decode_us);
+    }
+    printf("RAM: %u bytes of series state.\n", (unsigned)sizeof(flash_ts_store_t));
+}
+
+/**
+ * Logs the same DeviceConfig snapshots, eight devices reporting in turn, once as structs written
+ * by serialize_device_config and once as columnar blocks. Reports the flash used by each layout
+ * and the time to sum sensor_value over every snapshot and over one device's snapshots.
+ */
+void bench_columnar_configs() {
+    printf("Benchmarking columnar DeviceConfig blocks...\n");
+    static flash_log_t rows;
+    static flash_columnar_store_t columns;
+    static const char *names[] = { "pump", "fan", "valve", "heater", "inlet", "outlet", "tank", "mixer" };
+    const uint32_t snapshots = 2000;
+    const size_t row_size = DEVICE_CONFIG_SIZE;
+
+    // Ten sectors keep every struct; the columnar blocks need fewer than six.
+    flash_log_open(&rows, BENCH_OFFSET, 10, row_size);
+    flash_log_clear(&rows);
+    flash_columnar_open(&columns, BENCH_OFFSET + 10 * FLASH_SECTOR_SIZE, BENCH_SECTORS - 10);
+    flash_log_clear(&columns.log);
+
+    uint32_t noise = 12345;
+    for (uint32_t i = 0; i < snapshots; i++) {
+        noise = noise * 1103515245u + 12345u;
+        DeviceConfig config = { .id = 100 + i % 8, .sensor_value = 20.0f + (float)((noise >> 16) & 255) * 0.01f };
+        strncpy(config.name, names[i % 8], sizeof(config.name) - 1);
+        uint8_t record[DEVICE_CONFIG_SIZE];
+        serialize_device_config(&config, record);
+        flash_log_append(&rows, record);
+        flash_columnar_append(&columns, &config);
+    }
+    flash_log_flush(&rows);
+    flash_columnar_seal(&columns);
+    flash_log_flush(&columns.log);
+
+    // Row layout: every snapshot is read whole to get at one field.
+    double row_sum = 0, row_fan_sum = 0;
+    uint64_t start = time_us_64();
+    for (uint64_t i = flash_log_first(&rows); i < flash_log_end(&rows); i++) {
+        uint8_t record[DEVICE_CONFIG_SIZE];
+        DeviceConfig config;
+        if (flash_log_read(&rows, i, record) == FLASH_OK) {
+            deserialize_device_config(record, &config);
+            row_sum += config.sensor_value;
+        }
+    }
+    uint64_t row_scan_us = time_us_64() - start;
+    start = time_us_64();
+    for (uint64_t i = flash_log_first(&rows); i < flash_log_end(&rows); i++) {
+        uint8_t record[DEVICE_CONFIG_SIZE];
+        DeviceConfig config;
+        if (flash_log_read(&rows, i, record) == FLASH_OK) {
+            deserialize_device_config(record, &config);
+            if (strncmp(config.name, "fan", sizeof(config.name)) == 0) {
+                row_fan_sum += config.sensor_value;
+            }
+        }
+    }
+    uint64_t row_filter_us = time_us_64() - start;
+
+    // Columnar layout: only the value column, and the name index column when filtering.
+    uint32_t count = 0, fan_count = 0;
+    double column_sum = 0, column_fan_sum = 0;
+    start = time_us_64();
+    flash_columnar_scan_values(&columns, NULL, &count, &column_sum);
+    uint64_t column_scan_us = time_us_64() - start;
+    start = time_us_64();
+    flash_columnar_scan_values(&columns, "fan", &fan_count, &column_fan_sum);
+    uint64_t column_filter_us = time_us_64() - start;
+
+    uint32_t row_bytes = snapshots * row_size;
+    uint32_t blocks = (uint32_t)(flash_log_end(&columns.log) - flash_log_first(&columns.log));
+    uint32_t column_bytes = blocks * FLASH_COLUMNAR_BLOCK_SIZE;
+    printf("Space: %u snapshots take %u bytes as structs, %u bytes in %u columnar blocks (%u.%u x smaller).\n",
+           (unsigned)snapshots, (unsigned)row_bytes, (unsigned)column_bytes, (unsigned)blocks,
+           (unsigned)(row_bytes / column_bytes), (unsigned)(row_bytes * 10u / column_bytes % 10));
+    printf("Scan sensor_value: structs %llu us, columns %llu us (%u snapshots, sums %s).\n",
+           (unsigned long long)row_scan_us, (unsigned long long)column_scan_us, (unsigned)count,
+           count == snapshots && row_sum == column_sum ? "agree" : "DIFFER");
+    printf("Scan sensor_value of \"fan\": structs %llu us, columns %llu us (%u snapshots, sums %s).\n",
+           (unsigned long long)row_filter_us, (unsigned long long)column_filter_us, (unsigned)fan_count,
+           row_fan_sum == column_fan_sum ? "agree" : "DIFFER");
+    printf("RAM: %u bytes of columnar state.\n", (unsigned)sizeof(flash_columnar_store_t));
+}
+
+/**
+ * Stores the same DeviceConfig twice, serialized into one sector and as an in-place table in
+ * another, then reads its sensor_value repeatedly both ways. Reports the time per read.
+ */
+void bench_flash_table() {
+    printf("Benchmarking in-place tables...\n");
+    const uint32_t reads = 10000;
+    const uint32_t serialized_offset = BENCH_OFFSET, table_offset = BENCH_OFFSET + FLASH_SECTOR_SIZE;
+    DeviceConfig config = { .id = 5123, .sensor_value = 21.5f, .name = "Device1" };
+
+    uint8_t record[DEVICE_CONFIG_SIZE];
+    serialize_device_config(&config, record);
+    flash_write_safe(serialized_offset, record, sizeof(record));
+
+    uint8_t buffer[64];
+    flash_table_builder_t builder;
+    size_t payload_len = 0;
+    flash_table_builder_init(&builder, buffer, sizeof(buffer), &config, sizeof(config), 0);
+    flash_table_builder_finish(&builder, &payload_len);
+    flash_write_safe(table_offset, buffer, payload_len);
+
+    float sum = 0;
+    uint64_t start = time_us_64();
+    for (uint32_t i = 0; i < reads; i++) {
+        DeviceConfig copy;
+        flash_read_safe(serialized_offset, record, sizeof(record), NULL);
+        deserialize_device_config(record, &copy);
+        sum += copy.sensor_value;
+    }
+    uint64_t copy_us = time_us_64() - start;
+
+    const flash_table_t *table = NULL;
+    start = time_us_64();
+    flash_table_open(table_offset, &table);
+    const DeviceConfig *stored = FLASH_TABLE_FIXED(table, DeviceConfig);
+    for (uint32_t i = 0; i < reads; i++) {
+        sum += *(volatile const float *)&stored->sensor_value;
+    }
+    uint64_t in_place_us = time_us_64() - start;
+
+    printf("%u reads of sensor_value: copy and deserialize %llu us, in place %llu us (open included); checksum %d.\n",
+           (unsigned)reads, (unsigned long long)copy_us, (unsigned long long)in_place_us, (int)sum);
+}
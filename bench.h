@@ -0,0 +1,27 @@
+/**
+ * @file bench.h
+ *
+ * On-device benchmarks. Unlike the tests in test.h these do not pass or fail; they report
+ * throughput, latency and memory figures over stdio so that changes to the storage paths can be
+ * compared on real hardware.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Runs every benchmark and prints its results.
+void run_all_benchmarks();
+
+// Measures sustained sample ingest and random access of the circular record log.
+void bench_flash_log();
+
+// Measures the compression ratio and ingest cost of the compressed time series.
+void bench_flash_ts();
+
+// Compares the space and scan time of columnar DeviceConfig blocks with serialized structs.
+void bench_columnar_configs();
+
+// Compares reading one config field in place from XIP with copying and deserializing the record.
+void bench_flash_table();
+
+#endif // BENCH_H
@@ -1,9 +1,14 @@
 #include "cli.h"
 #include "flash_ops.h"
+#include "protocol.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "custom_fgets.h"
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "line_reader.h"
+
+#define CLI_LINE_MAX LINE_READER_MAX
 
 void execute_command(char *command) {
     char *token = strtok(command, " ");
@@ -26,14 +31,9 @@ void execute_command(char *command) {
             return;
         }
 
-        // Prepare the structure for writing
-        flash_data data_to_write;
-        memset(&data_to_write, 0, sizeof(data_to_write)); // Ensure the structure is clear
-        // memcpy(data_to_write.data, token, strlen(token)); // Copy the string into the structure's data field
-        data_to_write.data_len = strlen(token); // Set the data length
-
-        // Call the modified write function
-        //flash_write_safe_struct(address, &data_to_write);
+        // Store the quoted text as the sector payload
+        flash_status_t status = flash_write_safe(address, (const uint8_t *)token, strlen(token));
+        printf("\nFLASH_WRITE: %s\n", flash_status_str(status));
     }
     else if (strcmp(token, "FLASH_READ") == 0) {
         token = strtok(NULL, " ");
@@ -43,21 +43,26 @@ void execute_command(char *command) {
         }
         uint32_t address = atoi(token);
 
-        // Prepare a structure to receive the read data
-        flash_data data_read;
-        memset(&data_read, 0, sizeof(data_read)); // Clear the structure
-
-        // Call the modified read function
-        //flash_read_safe_struct(address, &data_read);
-
+        // Fetch the metadata and the payload
+        flash_stat_t stat;
+        uint8_t data[CLI_LINE_MAX];
+        size_t data_len = 0;
+        flash_status_t status = flash_stat(address, &stat);
+        if (status == FLASH_OK) {
+            status = flash_read_safe(address, data, sizeof(data), &data_len);
+        }
+        if (status != FLASH_OK) {
+            printf("\nFLASH_READ: %s\n", flash_status_str(status));
+            return;
+        }
 
         // Displaying the metadata
-        printf("\nMetadata: Write count = %u\n", data_read.write_count);
+        printf("\nMetadata: Write count = %u\n", (unsigned)stat.write_count);
 
         // Print the read data
         printf("\nData: ");
-        for (size_t i = 0; i < data_read.data_len; i++) {
-            // printf("%c", data_read.data[i]);
+        for (size_t i = 0; i < data_len; i++) {
+            printf("%c", data[i]);
         }
         printf("\n");
     }
@@ -69,10 +74,32 @@ void execute_command(char *command) {
         }
         uint32_t address = atoi(token);
 
-        // Call the existing erase function
-        flash_erase_safe(address);
+        // Call the existing erase function and report its outcome
+        flash_status_t status = flash_erase_safe(address);
+        printf("\nFLASH_ERASE: %s\n", flash_status_str(status));
     }
     else {
         printf("\nUnknown command\n");
     }
 }
+
+// Sends protocol frames straight to the USB driver, bypassing stdio's newline translation.
+static void cli_write_usb(const uint8_t *data, size_t len) {
+    stdio_usb.out_chars((const char *)data, (int)len);
+}
+
+void cli_init(void) {
+    proto_init(cli_write_usb);
+    line_reader_init(cli_write_usb, proto_receive);
+}
+
+void cli_poll(void) {
+    // Binary frames are answered or queued from inside the poll; a completed text line is run here.
+    char *line = line_reader_poll();
+    if (line != NULL) {
+        execute_command(line);
+    }
+
+    // Then at most one queued protocol request, so input keeps flowing between flash operations.
+    proto_poll();
+}
@@ -3,4 +3,10 @@
 
 void execute_command(char *command);
 
+// Hooks the console up to USB CDC: text commands and binary protocol frames.
+void cli_init(void);
+
+// Serves whatever input has arrived since the last call; never blocks.
+void cli_poll(void);
+
 #endif // CLI_H
@@ -0,0 +1,75 @@
+/**
+ * @file cobs.c
+ *
+ * Implementation of the COBS encoder and decoder declared in cobs.h. Each encoded block starts
+ * with a code byte giving the distance to the next zero (or 0xFF for a full block of 254 non-zero
+ * bytes with no implied zero), followed by the non-zero bytes of that block.
+ */
+
+#include "cobs.h"
+
+/**
+ * Encodes a frame so it contains no zero bytes.
+ *
+ * @param src The frame to encode.
+ * @param len Length of the frame in bytes.
+ * @param dst Output buffer of at least COBS_MAX_ENCODED(len) bytes; must not overlap src.
+ * @return The number of encoded bytes written to dst.
+ */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t out = 1;        // Next output position; position 0 is reserved for the first code byte.
+    size_t code_pos = 0;   // Where the code byte of the current block goes.
+    uint8_t code = 1;      // Distance from the code byte to the next zero.
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+            continue;
+        }
+
+        dst[out++] = src[i];
+        code++;
+        // A full block ends without an implied zero.
+        if (code == 0xFF) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+
+    dst[code_pos] = code;
+    return out;
+}
+
+/**
+ * Decodes a COBS-encoded frame. Decoding in place is safe because the output never runs ahead
+ * of the input.
+ *
+ * @param src The encoded bytes, without the 0x00 delimiter.
+ * @param len Number of encoded bytes.
+ * @param dst Output buffer of at least len bytes; may be the same buffer as src.
+ * @return The decoded length, or 0 if a zero byte or a truncated block was found.
+ */
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        uint8_t code = src[in++];
+        if (code == 0 || in + code - 1 > len) {
+            return 0;
+        }
+
+        for (uint8_t i = 1; i < code; i++) {
+            dst[out++] = src[in++];
+        }
+
+        // Every block except a full one and the final one stands for a zero in the frame.
+        if (code != 0xFF && in < len) {
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,25 @@
+/**
+ * @file cobs.h
+ *
+ * Consistent Overhead Byte Stuffing. COBS rewrites a frame so that it contains no zero bytes,
+ * which lets a single 0x00 delimit frames on a byte stream such as USB CDC. The overhead is at
+ * most one byte per 254 bytes of payload, so large frames run at essentially line rate.
+ */
+
+#ifndef COBS_H
+#define COBS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Worst-case encoded size of a frame of n bytes (without the trailing delimiter).
+#define COBS_MAX_ENCODED(n) ((n) + (n) / 254 + 1)
+
+// Encodes len bytes from src into dst; returns the number of bytes written.
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+// Decodes len encoded bytes from src into dst (which may equal src); returns the decoded
+// length, or 0 if the input is malformed.
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#endif // COBS_H
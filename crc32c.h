@@ -0,0 +1,22 @@
+/**
+ * @file crc32c.h
+ *
+ * CRC32C (Castagnoli) checksums for flash records. The kernel is table driven and consumes eight
+ * bytes per step (slicing-by-8), which is several times faster than a byte-at-a-time loop on the
+ * Cortex-M0+. The running value is always a finished CRC, so a checksum can be built up over any
+ * number of calls: crc32c_update(crc32c_update(0, a, n), b, m) == crc32c of a followed by b.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Extends a CRC32C over more data; pass 0 as crc to start a new checksum.
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+// Computes the CRC32C of one buffer.
+uint32_t crc32c(const void *data, size_t len);
+
+#endif // CRC32C_H
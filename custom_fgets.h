@@ -1,8 +0,0 @@
-#ifndef CUSTOM_FGETS_H
-#define CUSTOM_FGETS_H
-
-#include <stdio.h>
-
-char* custom_fgets(char* str, int n, FILE* stream);
-
-#endif // CUSTOM_FGETS_H
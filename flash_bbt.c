@@ -0,0 +1,104 @@
+/**
+ * @file flash_bbt.c
+ *
+ * Implementation of the bad-sector table declared in flash_bbt.h. The table sector holds 32-bit
+ * sector offsets in the order they were retired; the first word still in the erased state marks
+ * the end of the list. The list is read once, on first use, into a RAM bitmap so that lookups
+ * made by the allocator never touch flash.
+ */
+
+#include "flash_bbt.h"
+#include "flash_ops_helper.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#define BBT_SECTORS FLASH_USER_SECTORS
+#define BBT_FLASH_OFFSET FLASH_BBT_OFFSET // The table occupies the last sector of flash.
+#define BBT_CAPACITY (FLASH_SECTOR_SIZE / sizeof(uint32_t))
+#define BBT_EMPTY 0xFFFFFFFFu
+
+static uint32_t retired_bits[(BBT_SECTORS + 31) / 32];
+static uint32_t entry_count;
+static bool table_loaded;
+
+/**
+ * Reads the persistent list into the RAM bitmap the first time the table is consulted.
+ */
+static void bbt_load(void) {
+    if (table_loaded) {
+        return;
+    }
+
+    const uint32_t *entries = (const uint32_t *)(XIP_BASE + BBT_FLASH_OFFSET);
+    memset(retired_bits, 0, sizeof(retired_bits));
+    entry_count = 0;
+
+    while (entry_count < BBT_CAPACITY && entries[entry_count] != BBT_EMPTY) {
+        uint32_t index = entries[entry_count] / FLASH_SECTOR_SIZE;
+        // Entries that do not name a managed sector are skipped rather than trusted.
+        if (entries[entry_count] % FLASH_SECTOR_SIZE == 0 && index < BBT_SECTORS) {
+            retired_bits[index / 32] |= 1u << (index % 32);
+        }
+        entry_count++;
+    }
+    table_loaded = true;
+}
+
+/**
+ * Returns true if the sector at the given offset has been retired.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @return true if the sector must not be used.
+ */
+bool flash_bbt_is_retired(uint32_t offset) {
+    uint32_t index = offset / FLASH_SECTOR_SIZE;
+    if (index >= BBT_SECTORS) {
+        return false;
+    }
+    bbt_load();
+    return (retired_bits[index / 32] & (1u << (index % 32))) != 0;
+}
+
+/**
+ * Retires a sector. The sector is excluded in RAM immediately and the offset is appended to the
+ * persistent list with a single word program.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @return FLASH_OK, FLASH_ERR_ALIGNMENT or FLASH_ERR_OUT_OF_BOUNDS for an invalid offset, or
+ *         FLASH_ERR_NO_SPACE if the list is full (the sector is still excluded until reboot).
+ */
+flash_status_t flash_bbt_retire(uint32_t offset) {
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (flash_bbt_is_retired(offset)) {
+        return FLASH_OK;
+    }
+
+    uint32_t index = offset / FLASH_SECTOR_SIZE;
+    retired_bits[index / 32] |= 1u << (index % 32);
+
+    if (entry_count >= BBT_CAPACITY) {
+        FLASH_LOG("Error: Bad-sector table is full; sector %u retired until reboot only.\n", (unsigned)offset);
+        return FLASH_ERR_NO_SPACE;
+    }
+
+    status = flash_program_partial(BBT_FLASH_OFFSET + entry_count * sizeof(uint32_t),
+                                   (const uint8_t *)&offset, sizeof(offset));
+    if (status == FLASH_OK) {
+        entry_count++;
+        FLASH_LOG("Retired flash sector at offset %u.\n", (unsigned)offset);
+    }
+    return status;
+}
+
+/**
+ * Returns the number of sectors retired so far.
+ */
+uint32_t flash_bbt_count(void) {
+    bbt_load();
+    return entry_count;
+}
@@ -0,0 +1,27 @@
+/**
+ * @file flash_bbt.h
+ *
+ * Persistent bad-sector table. Sectors whose contents do not read back as programmed are retired
+ * here, and the allocator in flash_ops.c never hands them out again. The table lives in the last
+ * sector of flash, outside the user region, as an append-only list of sector offsets: retiring a
+ * sector programs a single word, so no erase is ever needed and a power loss can at most lose the
+ * entry being added.
+ */
+
+#ifndef FLASH_BBT_H
+#define FLASH_BBT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_ops.h"
+
+// Returns true if the sector at the given user-region offset has been retired.
+bool flash_bbt_is_retired(uint32_t offset);
+
+// Retires the sector at the given user-region offset and records it persistently.
+flash_status_t flash_bbt_retire(uint32_t offset);
+
+// Returns the number of retired sectors.
+uint32_t flash_bbt_count(void);
+
+#endif // FLASH_BBT_H
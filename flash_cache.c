@@ -0,0 +1,186 @@
+/**
+ * @file flash_cache.c
+ *
+ * Implementation of the in-RAM sector header table declared in flash_cache.h. Entries are
+ * filled lazily by flash_stat and kept coherent by the write and erase paths in flash_ops.c.
+ * Each entry is a compact copy of the fields of flash_stat_t plus a flag recording whether
+ * the entry has been loaded at all.
+ */
+
+#include "flash_cache.h"
+#include "flash_ops_helper.h"
+
+#ifndef FLASH_OPS_NO_HEADER_CACHE
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#define FLASH_CACHE_SECTORS FLASH_USER_SECTORS
+
+// Flag bits stored in each table entry.
+#define ENTRY_LOADED (1u << 0)  // The entry mirrors the sector header.
+#define ENTRY_VALID  (1u << 1)  // The sector holds valid data.
+#define ENTRY_BLANK  (1u << 2)  // The header has never been programmed.
+#define ENTRY_CORRUPT (1u << 3) // The sector holds no intact record header, e.g. log or queue pages.
+
+/**
+ * One cached sector header. data_len always fits in 16 bits because a payload can never
+ * exceed one sector.
+ */
+typedef struct {
+    uint32_t write_count;
+    uint32_t data_crc;
+    uint16_t data_len;
+    uint8_t flags;
+} flash_cache_entry;
+
+static flash_cache_entry cache_table[FLASH_CACHE_SECTORS];
+static bool cache_enabled = true;
+static uint32_t preload_cursor; // Next sector flash_cache_preload_step reads.
+
+/**
+ * Maps a sector offset to its slot in the table.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @param index Receives the table index on success.
+ * @return true if the offset names a managed sector.
+ */
+static bool cache_index(uint32_t offset, uint32_t *index) {
+    if (offset % FLASH_SECTOR_SIZE != 0 || offset / FLASH_SECTOR_SIZE >= FLASH_CACHE_SECTORS) {
+        return false;
+    }
+    *index = offset / FLASH_SECTOR_SIZE;
+    return true;
+}
+
+/**
+ * Looks up the cached header for a sector.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @param stat Receives the cached header on a hit.
+ * @param status Receives FLASH_OK on a hit, or FLASH_ERR_CRC for a sector cached as corrupt.
+ * @return true on a hit, false if the entry is not loaded or the table is disabled.
+ */
+bool flash_cache_lookup(uint32_t offset, flash_stat_t *stat, flash_status_t *status) {
+    uint32_t index;
+    if (!cache_enabled || !cache_index(offset, &index)) {
+        return false;
+    }
+
+    const flash_cache_entry *entry = &cache_table[index];
+    if (!(entry->flags & ENTRY_LOADED)) {
+        return false;
+    }
+
+    stat->valid = (entry->flags & ENTRY_VALID) != 0;
+    stat->blank = (entry->flags & ENTRY_BLANK) != 0;
+    stat->write_count = entry->write_count;
+    stat->data_len = entry->data_len;
+    stat->data_crc = entry->data_crc;
+    *status = (entry->flags & ENTRY_CORRUPT) ? FLASH_ERR_CRC : FLASH_OK;
+    return true;
+}
+
+/**
+ * Records the header of a sector. Called by flash_stat on a miss and by every operation
+ * that reprograms a sector header.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @param stat The header now stored in flash.
+ */
+void flash_cache_store(uint32_t offset, const flash_stat_t *stat) {
+    uint32_t index;
+    if (!cache_enabled || !cache_index(offset, &index)) {
+        return;
+    }
+
+    flash_cache_entry *entry = &cache_table[index];
+    entry->write_count = stat->write_count;
+    entry->data_len = (uint16_t)stat->data_len;
+    entry->data_crc = stat->data_crc;
+    entry->flags = ENTRY_LOADED
+                 | (stat->valid ? ENTRY_VALID : 0)
+                 | (stat->blank ? ENTRY_BLANK : 0);
+}
+
+/**
+ * Records that a sector holds no intact record header, so that flash_stat answers FLASH_ERR_CRC
+ * for it from RAM. Sectors of flash_log, flash_queue and the modules built on them are cached
+ * this way, both when their header fails to parse and when they are erased to be refilled.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @param write_count The sector's write count, as kept by the erase-count log.
+ */
+void flash_cache_store_corrupt(uint32_t offset, uint32_t write_count) {
+    uint32_t index;
+    if (!cache_enabled || !cache_index(offset, &index)) {
+        return;
+    }
+
+    flash_cache_entry *entry = &cache_table[index];
+    entry->write_count = write_count;
+    entry->data_len = 0;
+    entry->data_crc = 0;
+    entry->flags = ENTRY_LOADED | ENTRY_CORRUPT;
+}
+
+/**
+ * Drops every cached entry so the next query re-reads the header from flash.
+ */
+void flash_cache_invalidate(void) {
+    memset(cache_table, 0, sizeof(cache_table));
+    preload_cursor = 0;
+}
+
+/**
+ * Loads the header of every managed sector into the table in one pass. flash_stat fills
+ * the table as a side effect, so this only has to walk the region. Sectors without an intact
+ * record header are cached as such and do not stop the walk.
+ *
+ * @return FLASH_OK, or the first error other than FLASH_ERR_CRC reported by flash_stat.
+ */
+flash_status_t flash_cache_preload(void) {
+    flash_status_t result = FLASH_OK;
+    for (uint32_t index = 0; index < FLASH_CACHE_SECTORS; index++) {
+        flash_stat_t stat;
+        flash_status_t status = flash_stat(index * FLASH_SECTOR_SIZE, &stat);
+        if (status != FLASH_OK && status != FLASH_ERR_CRC && result == FLASH_OK) {
+            result = status;
+        }
+    }
+    return result;
+}
+
+/**
+ * Warms the table a few sectors at a time, for a background loop that should not hold up boot or
+ * the first accesses. Sectors already loaded by earlier queries cost nothing, and sectors without
+ * an intact record header are cached as such.
+ *
+ * @param max_sectors Upper bound on the sectors visited by this call; 0 visits all that remain.
+ * @return true once every sector has been visited since the table was last invalidated.
+ */
+bool flash_cache_preload_step(uint32_t max_sectors) {
+    uint32_t end = FLASH_CACHE_SECTORS;
+    if (max_sectors != 0 && end - preload_cursor > max_sectors) {
+        end = preload_cursor + max_sectors;
+    }
+    for (; preload_cursor < end; preload_cursor++) {
+        flash_stat_t stat;
+        flash_stat(preload_cursor * FLASH_SECTOR_SIZE, &stat);
+    }
+    return preload_cursor == FLASH_CACHE_SECTORS;
+}
+
+/**
+ * Enables or disables the table at runtime. The table is invalidated either way so that
+ * re-enabling it never serves headers that went stale while it was off.
+ *
+ * @param enabled true to use the table, false to always read headers from flash.
+ */
+void flash_cache_set_enabled(bool enabled) {
+    flash_cache_invalidate();
+    cache_enabled = enabled;
+}
+
+#endif // FLASH_OPS_NO_HEADER_CACHE
@@ -0,0 +1,58 @@
+/**
+ * @file flash_cache.h
+ *
+ * In-RAM table of parsed sector headers for the user flash region. flash_stat consults the
+ * table before touching flash and fills it on a miss, while flash_write_safe and flash_erase_safe
+ * update the entry for every sector they program, so the table always matches what is in flash.
+ * Sectors without an intact record header are cached too, as corrupt; flash_log and flash_queue
+ * erase through flash_erase_unmanaged, which keeps their sectors marked that way.
+ * Metadata queries such as wear dashboards or allocation decisions can then run without any
+ * XIP reads once the table is warm.
+ *
+ * The table costs 12 bytes of RAM per managed sector. Building with FLASH_OPS_NO_HEADER_CACHE
+ * removes it entirely; every function below then compiles to a no-op.
+ */
+
+#ifndef FLASH_CACHE_H
+#define FLASH_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_ops.h"
+
+#ifndef FLASH_OPS_NO_HEADER_CACHE
+
+// Looks up the cached header for a sector offset; returns false on a miss or when disabled.
+bool flash_cache_lookup(uint32_t offset, flash_stat_t *stat, flash_status_t *status);
+
+// Records the header of a sector after it was read or programmed.
+void flash_cache_store(uint32_t offset, const flash_stat_t *stat);
+
+// Records that a sector holds no intact record header, such as a log or queue sector.
+void flash_cache_store_corrupt(uint32_t offset, uint32_t write_count);
+
+// Drops every cached entry, e.g. after flash was modified behind the library's back.
+void flash_cache_invalidate(void);
+
+// Reads the header of every managed sector so later queries never touch flash.
+flash_status_t flash_cache_preload(void);
+
+// Reads the headers of up to max_sectors more sectors; returns true once every sector has been read.
+bool flash_cache_preload_step(uint32_t max_sectors);
+
+// Enables or disables the table at runtime; disabling also invalidates it.
+void flash_cache_set_enabled(bool enabled);
+
+#else
+
+static inline bool flash_cache_lookup(uint32_t offset, flash_stat_t *stat, flash_status_t *status) { (void)offset; (void)stat; (void)status; return false; }
+static inline void flash_cache_store(uint32_t offset, const flash_stat_t *stat) { (void)offset; (void)stat; }
+static inline void flash_cache_store_corrupt(uint32_t offset, uint32_t write_count) { (void)offset; (void)write_count; }
+static inline void flash_cache_invalidate(void) {}
+static inline flash_status_t flash_cache_preload(void) { return FLASH_OK; }
+static inline bool flash_cache_preload_step(uint32_t max_sectors) { (void)max_sectors; return true; }
+static inline void flash_cache_set_enabled(bool enabled) { (void)enabled; }
+
+#endif // FLASH_OPS_NO_HEADER_CACHE
+
+#endif // FLASH_CACHE_H
@@ -0,0 +1,318 @@
+/**
+ * @file flash_columnar.c
+ *
+ * Implementation of the columnar DeviceConfig history declared in flash_columnar.h. The encoder
+ * keeps rows column by column in RAM and tracks the exact encoded size, so whether a snapshot
+ * fits is known before it is added and packing never has to back out.
+ */
+
+#include "flash_columnar.h"
+#include <string.h>
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void put_u16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static uint32_t zigzag(uint32_t previous, uint32_t id) {
+    int32_t delta = (int32_t)(id - previous);
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static unsigned varint_size(uint32_t value) {
+    unsigned size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t encoded_size(const flash_columnar_encoder_t *enc) {
+    return FLASH_COLUMNAR_HEADER + enc->id_bytes + enc->count * (sizeof(float) + 1) +
+           enc->name_count * FLASH_COLUMNAR_NAME_SIZE;
+}
+
+// Offsets of the value, name index and dictionary columns; the ids follow the header.
+static void column_offsets(const uint8_t *block, size_t *values, size_t *names, size_t *dictionary) {
+    uint16_t count = get_u16(block);
+    *values = FLASH_COLUMNAR_HEADER + get_u16(block + 3);
+    *names = *values + (size_t)count * sizeof(float);
+    *dictionary = *names + count;
+}
+
+void flash_columnar_encoder_reset(flash_columnar_encoder_t *enc) {
+    enc->count = 0;
+    enc->name_count = 0;
+    enc->id_bytes = 0;
+}
+
+/**
+ * Adds a snapshot to the block being built. The name is compared up to its first NUL and stored
+ * zero-padded, so names differing only in bytes after the terminator share a dictionary entry.
+ *
+ * @param enc The encoder.
+ * @param config The snapshot.
+ * @return true if the snapshot was added, false if the block has no room for it.
+ */
+bool flash_columnar_encoder_append(flash_columnar_encoder_t *enc, const DeviceConfig *config) {
+    if (enc->count == FLASH_COLUMNAR_MAX_ROWS) {
+        return false;
+    }
+
+    uint32_t previous = enc->count ? enc->ids[enc->count - 1] : 0;
+    unsigned id_size = varint_size(zigzag(previous, config->id));
+
+    int name = -1;
+    for (int i = 0; i < enc->name_count; i++) {
+        if (strncmp(enc->names[i], config->name, FLASH_COLUMNAR_NAME_SIZE) == 0) {
+            name = i;
+            break;
+        }
+    }
+    size_t extra = id_size + sizeof(float) + 1 + (name < 0 ? FLASH_COLUMNAR_NAME_SIZE : 0);
+    if (encoded_size(enc) + extra > FLASH_COLUMNAR_BLOCK_SIZE ||
+        (name < 0 && enc->name_count == FLASH_COLUMNAR_MAX_NAMES)) {
+        return false;
+    }
+
+    if (name < 0) {
+        name = enc->name_count++;
+        memset(enc->names[name], 0, FLASH_COLUMNAR_NAME_SIZE);
+        strncpy(enc->names[name], config->name, FLASH_COLUMNAR_NAME_SIZE);
+    }
+    enc->ids[enc->count] = config->id;
+    enc->values[enc->count] = config->sensor_value;
+    enc->name_index[enc->count] = (uint8_t)name;
+    enc->id_bytes += id_size;
+    enc->count++;
+    return true;
+}
+
+/**
+ * Writes the header and the four columns. Bytes after the last column are left at 0xFF so they
+ * program nothing.
+ *
+ * @param enc The encoder.
+ * @param block Destination of FLASH_COLUMNAR_BLOCK_SIZE bytes.
+ * @return The bytes used by the block.
+ */
+size_t flash_columnar_encoder_pack(const flash_columnar_encoder_t *enc, uint8_t block[FLASH_COLUMNAR_BLOCK_SIZE]) {
+    memset(block, 0xFF, FLASH_COLUMNAR_BLOCK_SIZE);
+    put_u16(block, enc->count);
+    block[2] = enc->name_count;
+    put_u16(block + 3, enc->id_bytes);
+
+    uint8_t *p = block + FLASH_COLUMNAR_HEADER;
+    uint32_t previous = 0;
+    for (uint16_t i = 0; i < enc->count; i++) {
+        uint32_t value = zigzag(previous, enc->ids[i]);
+        previous = enc->ids[i];
+        while (value >= 0x80) {
+            *p++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *p++ = (uint8_t)value;
+    }
+
+    memcpy(p, enc->values, enc->count * sizeof(float));
+    p += enc->count * sizeof(float);
+    memcpy(p, enc->name_index, enc->count);
+    p += enc->count;
+    memcpy(p, enc->names, enc->name_count * FLASH_COLUMNAR_NAME_SIZE);
+    return encoded_size(enc);
+}
+
+uint16_t flash_columnar_count(const uint8_t *block) {
+    return get_u16(block);
+}
+
+float flash_columnar_value(const uint8_t *block, uint16_t row) {
+    size_t values, names, dictionary;
+    column_offsets(block, &values, &names, &dictionary);
+    float value;
+    memcpy(&value, block + values + (size_t)row * sizeof(float), sizeof(value));
+    return value;
+}
+
+/**
+ * Decodes the id column. Decoding stops early if the column is malformed, i.e. runs past the
+ * length given in the header.
+ *
+ * @param block A sealed block or a packed encoder block.
+ * @param ids Destination with room for flash_columnar_count(block) ids.
+ * @return The number of ids decoded.
+ */
+uint16_t flash_columnar_ids(const uint8_t *block, uint32_t *ids) {
+    uint16_t count = get_u16(block);
+    const uint8_t *p = block + FLASH_COLUMNAR_HEADER;
+    const uint8_t *end = p + get_u16(block + 3);
+    uint32_t previous = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t value = 0;
+        unsigned shift = 0;
+        do {
+            if (p == end || shift > 28) {
+                return i;
+            }
+            value |= (uint32_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        previous += (value >> 1) ^ (0u - (value & 1));
+        ids[i] = previous;
+    }
+    return count;
+}
+
+int flash_columnar_find_name(const uint8_t *block, const char *name) {
+    size_t values, names, dictionary;
+    column_offsets(block, &values, &names, &dictionary);
+    for (int i = 0; i < block[2]; i++) {
+        if (strncmp((const char *)block + dictionary + i * FLASH_COLUMNAR_NAME_SIZE, name, FLASH_COLUMNAR_NAME_SIZE) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t flash_columnar_name_index(const uint8_t *block, uint16_t row) {
+    size_t values, names, dictionary;
+    column_offsets(block, &values, &names, &dictionary);
+    return block[names + row];
+}
+
+bool flash_columnar_row(const uint8_t *block, uint16_t row, DeviceConfig *config) {
+    uint32_t ids[FLASH_COLUMNAR_MAX_ROWS];
+    uint16_t count = get_u16(block);
+    if (row >= count || count > FLASH_COLUMNAR_MAX_ROWS || flash_columnar_ids(block, ids) != count) {
+        return false;
+    }
+    uint8_t name = flash_columnar_name_index(block, row);
+    if (name >= block[2]) {
+        return false;
+    }
+
+    size_t values, names, dictionary;
+    column_offsets(block, &values, &names, &dictionary);
+    config->id = ids[row];
+    config->sensor_value = flash_columnar_value(block, row);
+    memcpy(config->name, block + dictionary + name * FLASH_COLUMNAR_NAME_SIZE, FLASH_COLUMNAR_NAME_SIZE);
+    return true;
+}
+
+flash_status_t flash_columnar_open(flash_columnar_store_t *store, uint32_t first_offset, uint32_t sectors) {
+    if (store == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    flash_columnar_encoder_reset(&store->encoder);
+    return flash_log_open(&store->log, first_offset, sectors, FLASH_COLUMNAR_BLOCK_SIZE);
+}
+
+flash_status_t flash_columnar_seal(flash_columnar_store_t *store) {
+    if (store == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (store->encoder.count == 0) {
+        return FLASH_OK;
+    }
+    // A block that could not be written stays in the encoder so that sealing can be retried.
+    flash_columnar_encoder_pack(&store->encoder, store->scratch);
+    flash_status_t status = flash_log_append(&store->log, store->scratch);
+    if (status == FLASH_OK) {
+        flash_columnar_encoder_reset(&store->encoder);
+    }
+    return status;
+}
+
+flash_status_t flash_columnar_append(flash_columnar_store_t *store, const DeviceConfig *config) {
+    if (store == NULL || config == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (flash_columnar_encoder_append(&store->encoder, config)) {
+        return FLASH_OK;
+    }
+
+    // The block is full: seal it and start the next one with this snapshot. If sealing fails the
+    // snapshot is not taken, and the caller can append it again.
+    flash_status_t status = flash_columnar_seal(store);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    flash_columnar_encoder_append(&store->encoder, config);
+    return FLASH_OK;
+}
+
+/**
+ * Returns a sealed block. Blocks already programmed are returned in place; only a block whose
+ * last page is still in the log's RAM page is copied, into the store's scratch block.
+ *
+ * @param store An opened history.
+ * @param index Block index between flash_log_first and flash_log_end of store->log.
+ * @param block Receives a pointer to the block.
+ * @return FLASH_OK or the log's error for the index.
+ */
+flash_status_t flash_columnar_block(flash_columnar_store_t *store, uint64_t index, const uint8_t **block) {
+    if (store == NULL || block == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    const uint8_t *in_flash = flash_log_record_ptr(&store->log, index);
+    if (in_flash != NULL) {
+        *block = in_flash;
+        return FLASH_OK;
+    }
+    flash_status_t status = flash_log_read(&store->log, index, store->scratch);
+    if (status == FLASH_OK) {
+        *block = store->scratch;
+    }
+    return status;
+}
+
+/**
+ * Scans the value column of every sealed block and nothing else. With a name, each block's
+ * dictionary is searched once, blocks without that name are skipped and the name index column
+ * picks out the matching rows; the ids are never decoded.
+ *
+ * @param store An opened history.
+ * @param name Name to filter on, or NULL for every snapshot.
+ * @param count Receives the number of snapshots counted.
+ * @param sum Receives the sum of their sensor_value.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, or the error reading a block.
+ */
+flash_status_t flash_columnar_scan_values(flash_columnar_store_t *store, const char *name, uint32_t *count, double *sum) {
+    if (store == NULL || count == NULL || sum == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    *count = 0;
+    *sum = 0;
+
+    for (uint64_t b = flash_log_first(&store->log); b < flash_log_end(&store->log); b++) {
+        const uint8_t *block;
+        flash_status_t status = flash_columnar_block(store, b, &block);
+        if (status != FLASH_OK) {
+            return status;
+        }
+        int wanted = name ? flash_columnar_find_name(block, name) : -1;
+        if (name && wanted < 0) {
+            continue;
+        }
+
+        size_t values, names, dictionary;
+        column_offsets(block, &values, &names, &dictionary);
+        uint16_t rows = get_u16(block);
+        for (uint16_t i = 0; i < rows; i++) {
+            if (name && block[names + i] != wanted) {
+                continue;
+            }
+            float value;
+            memcpy(&value, block + values + (size_t)i * sizeof(float), sizeof(value));
+            *sum += value;
+            (*count)++;
+        }
+    }
+    return FLASH_OK;
+}
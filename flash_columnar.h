@@ -0,0 +1,99 @@
+/**
+ * @file flash_columnar.h
+ *
+ * Columnar history of DeviceConfig snapshots. Instead of storing each snapshot as a serialized
+ * struct, a block keeps every field in its own run:
+ *
+ *     count (2) | names (1) | id bytes (2) | ids | values | name indexes | dictionary
+ *
+ * - ids: the difference to the previous id, zigzag-encoded as a varint, so a device id that
+ *   repeats or counts up costs one byte.
+ * - values: the sensor_value floats back to back, four bytes each.
+ * - name indexes: one byte per snapshot, an index into the block's dictionary.
+ * - dictionary: each distinct name once, in the fixed 10 bytes of DeviceConfig.name.
+ *
+ * The position of every column follows from the five header bytes, so scanning sensor_value
+ * touches only the value column, and filtering by name compares one byte per snapshot after a
+ * single dictionary lookup. Values and name indexes are fixed width and can be read for any row
+ * directly; ids have to be decoded from the start of the block.
+ *
+ * Blocks are built in RAM and appended as records to a flash_log, 16 to a log sector like the
+ * blocks of flash_ts, and are read in place from XIP.
+ */
+
+#ifndef FLASH_COLUMNAR_H
+#define FLASH_COLUMNAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_log.h"
+#include "flash_ops_helper.h"
+
+#define FLASH_COLUMNAR_BLOCK_SIZE ((FLASH_SECTOR_SIZE - FLASH_LOG_SECTOR_HEADER) / FLASH_PAGES_PER_SECTOR)
+#define FLASH_COLUMNAR_HEADER 5
+#define FLASH_COLUMNAR_NAME_SIZE sizeof(((DeviceConfig *)0)->name)
+// A snapshot costs at least 6 bytes: a one-byte id, its value and its name index.
+#define FLASH_COLUMNAR_MAX_ROWS ((FLASH_COLUMNAR_BLOCK_SIZE - FLASH_COLUMNAR_HEADER) / 6)
+#define FLASH_COLUMNAR_MAX_NAMES 24
+
+// Collects the snapshots of one block in RAM, column by column.
+typedef struct {
+    uint32_t ids[FLASH_COLUMNAR_MAX_ROWS];
+    float values[FLASH_COLUMNAR_MAX_ROWS];
+    uint8_t name_index[FLASH_COLUMNAR_MAX_ROWS];
+    char names[FLASH_COLUMNAR_MAX_NAMES][FLASH_COLUMNAR_NAME_SIZE];
+    uint16_t count;
+    uint8_t name_count;
+    uint16_t id_bytes;     // Size of the encoded id column.
+} flash_columnar_encoder_t;
+
+// Sealed blocks in a log plus the block being filled.
+typedef struct {
+    flash_log_t log;
+    flash_columnar_encoder_t encoder;
+    uint8_t scratch[FLASH_COLUMNAR_BLOCK_SIZE]; // Copy of a sealed block whose last page is not yet programmed.
+} flash_columnar_store_t;
+
+// Empties an encoder.
+void flash_columnar_encoder_reset(flash_columnar_encoder_t *enc);
+
+// Adds a snapshot; returns false, leaving the encoder unchanged, when it does not fit.
+bool flash_columnar_encoder_append(flash_columnar_encoder_t *enc, const DeviceConfig *config);
+
+// Lays the collected columns out as a block; returns the bytes used.
+size_t flash_columnar_encoder_pack(const flash_columnar_encoder_t *enc, uint8_t block[FLASH_COLUMNAR_BLOCK_SIZE]);
+
+// Number of snapshots in a block.
+uint16_t flash_columnar_count(const uint8_t *block);
+
+// Reads the sensor_value of one row.
+float flash_columnar_value(const uint8_t *block, uint16_t row);
+
+// Decodes the whole id column into `ids`, which must hold flash_columnar_count entries.
+uint16_t flash_columnar_ids(const uint8_t *block, uint32_t *ids);
+
+// Index of `name` in the block's dictionary, or -1 if no row in the block has that name.
+int flash_columnar_find_name(const uint8_t *block, const char *name);
+
+// Dictionary index of one row's name.
+uint8_t flash_columnar_name_index(const uint8_t *block, uint16_t row);
+
+// Reassembles one snapshot; costs a decode of the ids up to that row.
+bool flash_columnar_row(const uint8_t *block, uint16_t row, DeviceConfig *config);
+
+// Opens a history stored in `sectors` sectors from `first_offset`.
+flash_status_t flash_columnar_open(flash_columnar_store_t *store, uint32_t first_offset, uint32_t sectors);
+
+// Adds a snapshot, sealing the current block into flash when it is full; on an error the snapshot was not added.
+flash_status_t flash_columnar_append(flash_columnar_store_t *store, const DeviceConfig *config);
+
+// Seals the current block even if it is not full; on an error the block is kept for a retry.
+flash_status_t flash_columnar_seal(flash_columnar_store_t *store);
+
+// Returns a sealed block, from XIP when possible; see flash_log_first/end for indexes.
+flash_status_t flash_columnar_block(flash_columnar_store_t *store, uint64_t index, const uint8_t **block);
+
+// Counts and sums the sensor_value of every sealed snapshot, or only those named `name`.
+flash_status_t flash_columnar_scan_values(flash_columnar_store_t *store, const char *name, uint32_t *count, double *sum);
+
+#endif // FLASH_COLUMNAR_H
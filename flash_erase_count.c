@@ -0,0 +1,286 @@
+/**
+ * @file flash_erase_count.c
+ *
+ * Implementation of the erase-count log declared in flash_erase_count.h. Each log slot starts
+ * with a magic word and a generation; entries follow as two 32-bit words, the index and its check
+ * in the first and the count in the second. The first entry still fully erased marks the end of
+ * the log. Both slots are read once, on first use, into a RAM table holding the highest count
+ * seen for every sector, so that flash_stat never scans the log.
+ */
+
+#include "flash_erase_count.h"
+#include "flash_ops_helper.h"
+#include "flash_cache.h"
+#include "crc32c.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+#define COUNT_SECTORS FLASH_USER_SECTORS
+#define COUNT_MAGIC 0x544E4345u // "ECNT"
+#define COUNT_EMPTY 0xFFFFFFFFu
+
+// A compaction may carry one entry per user sector and must still leave a sector's worth free.
+SCHEMA_STATIC_ASSERT(FLASH_ERASE_COUNT_ENTRIES >= FLASH_USER_SECTORS + FLASH_SECTOR_SIZE / FLASH_ERASE_COUNT_ENTRY - 1,
+                     "erase-count slots are too small for the user region");
+
+static uint32_t counts[COUNT_SECTORS];
+static bool counts_loaded;
+static uint8_t active_slot;     // Log slot entries are appended to.
+static uint32_t generation;     // Generation of the active log slot.
+static uint32_t next_entry;     // Next free entry in the active log slot.
+static bool log_opened;         // log_open has run since the counts were loaded.
+
+// What counts_load found in each slot, for log_open.
+static bool found_valid[2];
+static uint32_t found_generation[2];
+static uint32_t found_used[2];
+
+#define SLOT_SIZE (FLASH_ERASE_COUNT_SLOT_SECTORS * FLASH_SECTOR_SIZE)
+
+static uint32_t slot_flash_offset(uint8_t slot) {
+    return FLASH_ERASE_COUNT_OFFSET + slot * SLOT_SIZE;
+}
+
+static const uint32_t *slot_words(uint8_t slot) {
+    return (const uint32_t *)(XIP_BASE + slot_flash_offset(slot));
+}
+
+static uint32_t entry_check(uint32_t index, uint32_t count) {
+    uint32_t words[2] = { index, count };
+    return crc32c(words, sizeof(words)) & 0xFFFFu;
+}
+
+/**
+ * Merges the entries of one log slot into the RAM table. An entry torn by a power loss fails
+ * its check and is skipped; the erase it announced had not started.
+ *
+ * @param slot Log slot to read; its header must already have been checked.
+ * @return The number of entries in use, torn ones included.
+ */
+static uint32_t scan_slot(uint8_t slot) {
+    const uint32_t *words = slot_words(slot) + FLASH_ERASE_COUNT_HEADER / sizeof(uint32_t);
+    uint32_t used = 0;
+    while (used < FLASH_ERASE_COUNT_ENTRIES && (words[2 * used] != COUNT_EMPTY || words[2 * used + 1] != COUNT_EMPTY)) {
+        uint32_t index = words[2 * used] & 0xFFFFu;
+        uint32_t count = words[2 * used + 1];
+        if (index < COUNT_SECTORS && (words[2 * used] >> 16) == entry_check(index, count) && count > counts[index]) {
+            counts[index] = count;
+        }
+        used++;
+    }
+    return used;
+}
+
+/**
+ * Erases a log slot and gives it a header, leaving it empty.
+ */
+static flash_status_t start_slot(uint8_t slot, uint32_t slot_generation) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(slot_flash_offset(slot), SLOT_SIZE);
+    restore_interrupts(ints);
+
+    uint32_t header[2] = { COUNT_MAGIC, slot_generation };
+    return flash_program_partial(slot_flash_offset(slot), (const uint8_t *)header, sizeof(header));
+}
+
+/**
+ * Appends one entry to the active log slot.
+ *
+ * @return FLASH_OK, FLASH_ERR_NO_SPACE if the slot is full, or the error programming it.
+ */
+static flash_status_t append_entry(uint32_t index, uint32_t count) {
+    if (next_entry >= FLASH_ERASE_COUNT_ENTRIES) {
+        return FLASH_ERR_NO_SPACE;
+    }
+    uint32_t entry[2] = { index | (entry_check(index, count) << 16), count };
+    flash_status_t status = flash_program_partial(slot_flash_offset(active_slot) + FLASH_ERASE_COUNT_HEADER +
+                                                  next_entry * FLASH_ERASE_COUNT_ENTRY,
+                                                  (const uint8_t *)entry, sizeof(entry));
+    if (status == FLASH_OK) {
+        next_entry++;
+    }
+    return status;
+}
+
+/**
+ * Moves every count into a freshly started log slot and then erases the other one. Counts that
+ * a record header already holds are dropped from the log and the rest are carried as entries;
+ * user sectors are only read, never written. Until the final erase the old slot keeps every
+ * count, so the compaction can be interrupted at any point and simply be done again.
+ *
+ * @param slot Log slot to move the counts into.
+ * @param slot_generation Generation to give it.
+ * @return FLASH_OK, or FLASH_ERR_NO_SPACE if some counts did not fit and survive in RAM only.
+ */
+static flash_status_t compact_into(uint8_t slot, uint32_t slot_generation) {
+    flash_status_t status = start_slot(slot, slot_generation);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    active_slot = slot;
+    generation = slot_generation;
+    next_entry = 0;
+
+    flash_status_t result = FLASH_OK;
+    for (uint32_t index = 0; index < COUNT_SECTORS; index++) {
+        if (counts[index] == 0) {
+            continue;
+        }
+        uint32_t offset = index * FLASH_SECTOR_SIZE;
+        flash_stat_t stat;
+        if (flash_read_header(offset, &stat) == FLASH_OK && !stat.blank && stat.write_count >= counts[index]) {
+            continue;
+        }
+        status = append_entry(index, counts[index]);
+        if (status != FLASH_OK && result == FLASH_OK) {
+            FLASH_LOG("Error: Erase counts do not fit one log slot; some are kept until reboot only.\n");
+            result = status;
+        }
+    }
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(slot_flash_offset(slot ^ 1), SLOT_SIZE);
+    restore_interrupts(ints);
+    return result;
+}
+
+/**
+ * Reads both log slots into the RAM table the first time a count is needed. This only reads
+ * flash, so flash_stat can consult the table at any time; whatever the log needs written is
+ * left to log_open.
+ */
+static void counts_load(void) {
+    if (counts_loaded) {
+        return;
+    }
+    counts_loaded = true;
+    log_opened = false;
+    memset(counts, 0, sizeof(counts));
+
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        found_valid[slot] = slot_words(slot)[0] == COUNT_MAGIC;
+        found_generation[slot] = slot_words(slot)[1];
+        found_used[slot] = found_valid[slot] ? scan_slot(slot) : 0;
+    }
+}
+
+/**
+ * Makes the log ready for appending, the first time something is to be recorded. Sectors that do
+ * not hold a log yet, such as the top user sectors of an older layout on its first boot with
+ * this one, are formatted. A compaction that a power loss interrupted shows as two valid slots;
+ * it is redone into the newer one, which at that point holds nothing but carried counts that the
+ * older one still has.
+ *
+ * @return FLASH_OK, or the error formatting or compacting the log.
+ */
+static flash_status_t log_open(void) {
+    counts_load();
+    if (log_opened) {
+        return FLASH_OK;
+    }
+    log_opened = true;
+
+    if (found_valid[0] && found_valid[1]) {
+        uint8_t newer = (int32_t)(found_generation[1] - found_generation[0]) > 0 ? 1 : 0;
+        return compact_into(newer, found_generation[newer]);
+    }
+    if (found_valid[0] || found_valid[1]) {
+        active_slot = found_valid[1] ? 1 : 0;
+        generation = found_generation[active_slot];
+        next_entry = found_used[active_slot];
+        return FLASH_OK;
+    }
+    FLASH_LOG("Formatting the erase-count log.\n");
+    active_slot = 0;
+    generation = 1;
+    next_entry = 0;
+    return start_slot(0, generation);
+}
+
+/**
+ * Opens the erase-count log: reads the counts and formats or repairs the log if needed. Call it
+ * once at boot, before anything erases; otherwise the first erase does it.
+ *
+ * @return FLASH_OK, or the error formatting or compacting the log.
+ */
+flash_status_t flash_erase_count_init(void) {
+    return log_open();
+}
+
+/**
+ * Returns the newest erase count logged for a sector.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @return The count, or 0 if none is logged or the offset names no sector.
+ */
+uint32_t flash_erase_count_get(uint32_t offset) {
+    uint32_t index = offset / FLASH_SECTOR_SIZE;
+    if ((offset & FLASH_SECTOR_MASK) != 0 || index >= COUNT_SECTORS) {
+        return 0;
+    }
+    counts_load();
+    return counts[index];
+}
+
+/**
+ * Logs the count a sector reaches with the erase about to be done. A full log slot is compacted
+ * first, while the sector's previous count is still wherever it was kept.
+ *
+ * @param offset Sector offset relative to the start of the user region.
+ * @param count The sector's count including this erase; counts not above the logged one are ignored.
+ * @return FLASH_OK, an offset error, or the error from compacting the full slot or programming
+ *         the entry, in which case the count is kept in RAM only until reboot.
+ */
+flash_status_t flash_erase_count_record(uint32_t offset, uint32_t count) {
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    log_open();
+
+    uint32_t index = offset / FLASH_SECTOR_SIZE;
+    if (count <= counts[index]) {
+        return FLASH_OK;
+    }
+    if (next_entry >= FLASH_ERASE_COUNT_ENTRIES) {
+        status = compact_into(active_slot ^ 1, generation + 1);
+    }
+    counts[index] = count;
+
+    if (status == FLASH_OK) {
+        status = append_entry(index, count);
+    }
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot log the erase count of sector %u: %s\n", (unsigned)offset, flash_status_str(status));
+    }
+    return status;
+}
+
+/**
+ * Compacts the log into the other log slot now, e.g. from an idle loop so that the compaction
+ * does not fall on a time-critical erase.
+ *
+ * @return FLASH_OK, or the problem reported by the compaction.
+ */
+flash_status_t flash_erase_count_compact(void) {
+    log_open();
+    return compact_into(active_slot ^ 1, generation + 1);
+}
+
+/**
+ * Forgets the RAM table; the next query rebuilds it from flash.
+ */
+void flash_erase_count_reload(void) {
+    counts_loaded = false;
+}
+
+/**
+ * Returns the number of entries in the active log slot.
+ */
+uint32_t flash_erase_count_entries(void) {
+    log_open();
+    return next_entry;
+}
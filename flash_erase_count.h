@@ -0,0 +1,60 @@
+/**
+ * @file flash_erase_count.h
+ *
+ * Persistent erase counters for the user region, kept apart from the sectors they count. Every
+ * erase the library performs on a user sector first appends one 8-byte entry to a log in the
+ * system sectors:
+ *
+ *     sector index (2) | check (2) | erase count (4)
+ *
+ * where the check is the low half of a CRC32C over index and count. Only then is the sector
+ * erased, so erasing needs no read-modify-write of the sector itself, and a power loss at any
+ * point leaves the count at least as high as the number of erases that reached flash.
+ * A sector's write count is the larger of the count in its record header and the newest entry
+ * for it; taking the maximum makes every step here safe to repeat.
+ *
+ * The log has two slots of FLASH_ERASE_COUNT_SLOT_SECTORS sectors each. When the active slot
+ * fills up, the other one is started with the next generation and every count that no record
+ * header holds is carried into it as an entry; a slot has room for one entry per sector of flash
+ * and a sector of new entries on top. User sectors are never written, so an erased sector stays
+ * blank whatever module owns it. The full slot is erased last, so a power loss during compaction
+ * leaves two valid slots, and the compaction is redone from their combined counts.
+ *
+ * Looking a count up only ever reads flash, so flash_stat has no side effects. Everything the log
+ * itself needs written happens in flash_erase_count_init, or at the latest on the first erase. On
+ * the first boot after updating from a layout without the log, that includes formatting it: the
+ * log takes over what used to be the top sectors of the user region, and anything stored there is
+ * erased. Move data out of the last FLASH_SYSTEM_SECTORS - 1 sectors of the old user region before
+ * updating.
+ */
+
+#ifndef FLASH_ERASE_COUNT_H
+#define FLASH_ERASE_COUNT_H
+
+#include <stdint.h>
+#include "flash_ops.h"
+#include "flash_geometry.h"
+
+#define FLASH_ERASE_COUNT_HEADER 8  // magic (4) | generation (4) at the start of a log slot.
+#define FLASH_ERASE_COUNT_ENTRY 8
+#define FLASH_ERASE_COUNT_ENTRIES ((FLASH_ERASE_COUNT_SLOT_SECTORS * FLASH_SECTOR_SIZE - FLASH_ERASE_COUNT_HEADER) / FLASH_ERASE_COUNT_ENTRY)
+
+// Reads the log and formats or repairs it if needed; call once at boot, before anything erases.
+flash_status_t flash_erase_count_init(void);
+
+// Newest erase count logged for the sector at a user-region offset; 0 if none is logged. Only reads flash.
+uint32_t flash_erase_count_get(uint32_t offset);
+
+// Logs that the sector is about to be erased for the `count`-th time; call before erasing it.
+flash_status_t flash_erase_count_record(uint32_t offset, uint32_t count);
+
+// Moves the counts into a fresh log slot now rather than when the current one is full.
+flash_status_t flash_erase_count_compact(void);
+
+// Drops the RAM copy of the counts; the next query reads the log from flash again.
+void flash_erase_count_reload(void);
+
+// Entries in the active log slot, including its carried-over counts.
+uint32_t flash_erase_count_entries(void);
+
+#endif // FLASH_ERASE_COUNT_H
@@ -0,0 +1,74 @@
+/**
+ * @file flash_geometry.h
+ *
+ * The one description of how flash is laid out. Every module derives its offsets, sector counts
+ * and limits from the constants here rather than defining its own, so they cannot drift apart.
+ *
+ *     0                  FLASH_TARGET_OFFSET                         FLASH_SYSTEM_OFFSET            FLASH_SIZE
+ *     | program image    | user region: FLASH_USER_SECTORS sectors   | erase counts | BBT (1)  |
+ *
+ * The system sectors grew when the erase-count log was added, taking over what were the top
+ * sectors of the user region; see flash_erase_count.h for what the first boot does with them.
+ *
+ * All values are integer constant expressions built from the SDK's FLASH_SECTOR_SIZE,
+ * FLASH_PAGE_SIZE and the board's PICO_FLASH_SIZE_BYTES, so masks, counts and bounds fold into
+ * immediates and a build for each flash size gets its own specialised checks. The board's size
+ * comes from its board header, or from the FLASH_SIZE_MB CMake option for boards fitted with a
+ * different part. A layout that cannot work fails the build here rather than misbehaving on the
+ * device.
+ */
+
+#ifndef FLASH_GEOMETRY_H
+#define FLASH_GEOMETRY_H
+
+#include "pico.h"
+#include "hardware/flash.h"
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#error "PICO_FLASH_SIZE_BYTES is not set: select a board or set FLASH_SIZE_MB"
+#endif
+
+#define FLASH_SIZE PICO_FLASH_SIZE_BYTES   // Total flash fitted to the board.
+#define FLASH_TARGET_OFFSET (256 * 1024)   // Offset where user data starts; below it is the program.
+
+// Sectors in each of the two erase-count log slots: room for one 8-byte entry per sector of flash,
+// carried over by a compaction, plus a sector for the entries appended after it.
+#define FLASH_ERASE_COUNT_SLOT_SECTORS_FOR(size) (((size) / FLASH_SECTOR_SIZE * 8) / FLASH_SECTOR_SIZE + 1)
+// Sectors at the top of flash reserved for library metadata: the erase-count log and the BBT.
+#define FLASH_SYSTEM_SECTORS_FOR(size) (2 * FLASH_ERASE_COUNT_SLOT_SECTORS_FOR(size) + 1)
+#define FLASH_ERASE_COUNT_SLOT_SECTORS FLASH_ERASE_COUNT_SLOT_SECTORS_FOR(FLASH_SIZE)
+#define FLASH_SYSTEM_SECTORS FLASH_SYSTEM_SECTORS_FOR(FLASH_SIZE)
+
+#define FLASH_SECTOR_MASK (FLASH_SECTOR_SIZE - 1)
+#define FLASH_PAGE_MASK (FLASH_PAGE_SIZE - 1)
+#define FLASH_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+// The user region, addressed by the offsets the library's API takes.
+#define FLASH_USER_REGION_SIZE (FLASH_SIZE - FLASH_TARGET_OFFSET - FLASH_SYSTEM_SECTORS * FLASH_SECTOR_SIZE)
+#define FLASH_USER_SECTORS (FLASH_USER_REGION_SIZE / FLASH_SECTOR_SIZE)
+#define FLASH_LAST_USER_SECTOR (FLASH_USER_REGION_SIZE - FLASH_SECTOR_SIZE) // Offset of the last user sector.
+
+// Absolute flash offset of the first system sector.
+#define FLASH_SYSTEM_OFFSET (FLASH_SIZE - FLASH_SYSTEM_SECTORS * FLASH_SECTOR_SIZE)
+
+// Where each kind of metadata lives among the system sectors.
+#define FLASH_ERASE_COUNT_OFFSET FLASH_SYSTEM_OFFSET          // Two slots of erase counters.
+#define FLASH_BBT_OFFSET (FLASH_SIZE - FLASH_SECTOR_SIZE)     // The bad-sector table, always the last sector.
+
+#if (FLASH_SECTOR_SIZE & FLASH_SECTOR_MASK) != 0 || (FLASH_PAGE_SIZE & FLASH_PAGE_MASK) != 0
+#error "Flash sector and page sizes must be powers of two"
+#endif
+#if FLASH_SECTOR_SIZE % FLASH_PAGE_SIZE != 0
+#error "A flash sector must hold a whole number of pages"
+#endif
+#if (FLASH_SIZE & (FLASH_SIZE - 1)) != 0 || FLASH_SIZE < 1024 * 1024 || FLASH_SIZE > 16 * 1024 * 1024
+#error "Flash size must be a power of two between 1 MB and the 16 MB XIP window"
+#endif
+#if (FLASH_TARGET_OFFSET & FLASH_SECTOR_MASK) != 0
+#error "The user region must start on a sector boundary"
+#endif
+#if FLASH_SIZE <= FLASH_TARGET_OFFSET + (FLASH_SYSTEM_SECTORS + 1) * FLASH_SECTOR_SIZE
+#error "Flash is too small for the program, the system sectors and at least one user sector"
+#endif
+
+#endif // FLASH_GEOMETRY_H
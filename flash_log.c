@@ -0,0 +1,341 @@
+/**
+ * @file flash_log.c
+ *
+ * Implementation of the circular record log declared in flash_log.h. Records are laid out back to
+ * back behind the sector header and may straddle a page boundary; the RAM page always mirrors the
+ * page that holds the write position, header included while the first page of a sector is open.
+ */
+
+#include "flash_log.h"
+#include "flash_ops_helper.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+#define LOG_MAGIC 0x4C47                  // "GL" in flash byte order.
+
+/**
+ * Returns the absolute flash offset of the sector holding a sector sequence number.
+ */
+static uint32_t sector_flash_offset(const flash_log_t *log, uint32_t seq) {
+    return FLASH_TARGET_OFFSET + log->first_offset + (seq % log->sectors) * FLASH_SECTOR_SIZE;
+}
+
+/**
+ * Returns true if the sector at a position of the ring carries this log's header for `seq`.
+ */
+static bool header_matches(const flash_log_t *log, uint32_t seq) {
+    const uint8_t *header = (const uint8_t *)(XIP_BASE + sector_flash_offset(log, seq));
+    uint32_t stored_seq = (uint32_t)header[4] | ((uint32_t)header[5] << 8) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+    return header[0] == (LOG_MAGIC & 0xFF) && header[1] == (LOG_MAGIC >> 8) &&
+           header[2] == (uint8_t)log->record_size && header[3] == (uint8_t)(log->record_size >> 8) &&
+           stored_seq == seq;
+}
+
+/**
+ * Returns the byte offset within the current sector where the next record goes.
+ */
+static uint32_t write_position(const flash_log_t *log) {
+    return FLASH_LOG_SECTOR_HEADER + log->sector_records * log->record_size;
+}
+
+/**
+ * Programs the RAM page into the page of the current sector that starts at `page_start`.
+ */
+static void program_page(flash_log_t *log, uint32_t page_start) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(sector_flash_offset(log, log->sector_seq) + page_start, log->page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    log->page_programs++;
+}
+
+/**
+ * Erases the sector for the current sequence number and opens its first page with the header.
+ *
+ * @return FLASH_OK, or the erase error; the sector is then left unopened.
+ */
+static flash_status_t start_sector(flash_log_t *log) {
+    flash_status_t status = flash_erase_unmanaged(sector_flash_offset(log, log->sector_seq) - FLASH_TARGET_OFFSET);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot start log sector %u: %s\n", (unsigned)log->sector_seq, flash_status_str(status));
+        return status;
+    }
+    log->sector_erases++;
+
+    memset(log->page, 0xFF, sizeof(log->page));
+    log->page[0] = LOG_MAGIC & 0xFF;
+    log->page[1] = LOG_MAGIC >> 8;
+    log->page[2] = (uint8_t)log->record_size;
+    log->page[3] = (uint8_t)(log->record_size >> 8);
+    log->page[4] = (uint8_t)log->sector_seq;
+    log->page[5] = (uint8_t)(log->sector_seq >> 8);
+    log->page[6] = (uint8_t)(log->sector_seq >> 16);
+    log->page[7] = (uint8_t)(log->sector_seq >> 24);
+    log->sector_records = 0;
+    log->sector_ready = true;
+    return FLASH_OK;
+}
+
+/**
+ * Opens a log and resumes after its newest record. One header per sector is read to find the
+ * newest sector, and only that sector is scanned for its last record.
+ *
+ * @param log Log state to fill in.
+ * @param first_offset User-region offset of the first sector; must be sector aligned.
+ * @param sectors Number of consecutive sectors; at least two, so a full sector of history
+ *                survives each wrap.
+ * @param record_size Bytes per record, 1 to FLASH_LOG_MAX_RECORD.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, FLASH_ERR_ZERO_LENGTH or FLASH_ERR_TOO_LARGE for a bad
+ *         record size, FLASH_ERR_NO_SPACE for fewer than two sectors, or a sector check error.
+ */
+flash_status_t flash_log_open(flash_log_t *log, uint32_t first_offset, uint32_t sectors, size_t record_size) {
+    if (log == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (record_size == 0) {
+        return FLASH_ERR_ZERO_LENGTH;
+    }
+    if (record_size > FLASH_LOG_MAX_RECORD) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+    if (sectors < 2) {
+        return FLASH_ERR_NO_SPACE;
+    }
+
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(first_offset, &flash_offset);
+    if (status == FLASH_OK) {
+        status = flash_check_sector(first_offset + (sectors - 1) * FLASH_SECTOR_SIZE, &flash_offset);
+    }
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot open log at offset %u: %s\n", (unsigned)first_offset, flash_status_str(status));
+        return status;
+    }
+
+    log->first_offset = first_offset;
+    log->sectors = sectors;
+    log->record_size = (uint32_t)record_size;
+    log->records_per_sector = (FLASH_SECTOR_SIZE - FLASH_LOG_SECTOR_HEADER) / (uint32_t)record_size;
+    log->page_programs = 0;
+    log->sector_erases = 0;
+    log->sector_seq = 0;
+    log->sector_records = 0;
+    log->sector_ready = false;
+    memset(log->page, 0xFF, sizeof(log->page));
+
+    // The newest sector is the one with the highest sequence number whose header sits where
+    // that sequence number belongs.
+    bool found = false;
+    for (uint32_t i = 0; i < sectors; i++) {
+        const uint8_t *header = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + first_offset + i * FLASH_SECTOR_SIZE);
+        uint32_t seq = (uint32_t)header[4] | ((uint32_t)header[5] << 8) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+        if (seq % sectors == i && header_matches(log, seq) && (!found || seq > log->sector_seq)) {
+            log->sector_seq = seq;
+            found = true;
+        }
+    }
+    if (!found) {
+        return FLASH_OK;
+    }
+
+    // Records are written in order, so the first one still erased marks the end.
+    const uint8_t *sector = (const uint8_t *)(XIP_BASE + sector_flash_offset(log, log->sector_seq));
+    uint32_t records = 0;
+    while (records < log->records_per_sector) {
+        const uint8_t *record = sector + FLASH_LOG_SECTOR_HEADER + records * log->record_size;
+        bool erased = true;
+        for (uint32_t i = 0; i < log->record_size && erased; i++) {
+            erased = record[i] == 0xFF;
+        }
+        if (erased) {
+            break;
+        }
+        records++;
+    }
+    log->sector_records = records;
+    log->sector_ready = true;
+
+    // Reload the partly filled page so the next program rewrites what is already there.
+    if (records < log->records_per_sector) {
+        uint32_t page_start = write_position(log) & ~(uint32_t)FLASH_PAGE_MASK;
+        memcpy(log->page, sector + page_start, FLASH_PAGE_SIZE);
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Appends one record. The record is copied into the RAM page; a page is programmed when it fills
+ * up and when the sector's last record has been added, and the next sector of the ring is erased
+ * when the first record goes into it. If that erase fails the record is not added, and the next
+ * append tries the same sector again.
+ *
+ * @param log An opened log.
+ * @param record Pointer to record_size bytes.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, or the error erasing the next sector.
+ */
+flash_status_t flash_log_append(flash_log_t *log, const void *record) {
+    if (log == NULL || record == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+
+    if (log->sector_ready && log->sector_records == log->records_per_sector) {
+        log->sector_seq++;
+        log->sector_ready = false;
+    }
+    if (!log->sector_ready) {
+        flash_status_t status = start_sector(log);
+        if (status != FLASH_OK) {
+            return status;
+        }
+    }
+
+    const uint8_t *src = record;
+    uint32_t pos = write_position(log);
+    uint32_t remaining = log->record_size;
+    while (remaining > 0) {
+        uint32_t in_page = pos % FLASH_PAGE_SIZE;
+        uint32_t n = FLASH_PAGE_SIZE - in_page;
+        if (n > remaining) {
+            n = remaining;
+        }
+        memcpy(log->page + in_page, src, n);
+        src += n;
+        pos += n;
+        remaining -= n;
+
+        if (pos % FLASH_PAGE_SIZE == 0) {
+            program_page(log, pos - FLASH_PAGE_SIZE);
+            memset(log->page, 0xFF, sizeof(log->page));
+        }
+    }
+    log->sector_records++;
+
+    // The tail of the sector cannot hold another record, so its last page goes out now.
+    if (log->sector_records == log->records_per_sector && pos % FLASH_PAGE_SIZE != 0) {
+        program_page(log, pos & ~(uint32_t)FLASH_PAGE_MASK);
+        memset(log->page, 0xFF, sizeof(log->page));
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Programs the partly filled page. Its erased bytes stay erased, so the same page can be
+ * programmed again once more records have been added.
+ *
+ * @param log An opened log.
+ * @return FLASH_OK or FLASH_ERR_NULL_DATA.
+ */
+flash_status_t flash_log_flush(flash_log_t *log) {
+    if (log == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    uint32_t pos = write_position(log);
+    if (log->sector_ready && log->sector_records < log->records_per_sector && pos % FLASH_PAGE_SIZE != 0) {
+        program_page(log, pos & ~(uint32_t)FLASH_PAGE_MASK);
+    }
+    return FLASH_OK;
+}
+
+uint64_t flash_log_first(const flash_log_t *log) {
+    uint32_t oldest = log->sector_seq >= log->sectors - 1 ? log->sector_seq - (log->sectors - 1) : 0;
+    return (uint64_t)oldest * log->records_per_sector;
+}
+
+uint64_t flash_log_end(const flash_log_t *log) {
+    return (uint64_t)log->sector_seq * log->records_per_sector + log->sector_records;
+}
+
+/**
+ * Finds where a record lives: its sector sequence number, its byte position in that sector, and
+ * the position from which the sector's bytes are still only in the RAM page (FLASH_SECTOR_SIZE
+ * if none are).
+ */
+static void locate_record(const flash_log_t *log, uint64_t index, uint32_t *seq, uint32_t *pos, uint32_t *ram_from) {
+    *seq = (uint32_t)(index / log->records_per_sector);
+    *pos = FLASH_LOG_SECTOR_HEADER + (uint32_t)(index % log->records_per_sector) * log->record_size;
+    *ram_from = FLASH_SECTOR_SIZE;
+    if (*seq == log->sector_seq && log->sector_records < log->records_per_sector) {
+        *ram_from = write_position(log) & ~(uint32_t)FLASH_PAGE_MASK;
+    }
+}
+
+/**
+ * Copies a record by index. Records in the open page come from RAM, everything else straight
+ * from XIP; a sector that no longer carries the expected header is reported rather than read.
+ *
+ * @param log An opened log.
+ * @param index Record index, between flash_log_first and flash_log_end.
+ * @param record Destination for record_size bytes.
+ * @return FLASH_OK, FLASH_ERR_OUT_OF_BOUNDS for an index outside the log, or
+ *         FLASH_ERR_INVALID_DATA if the sector holding it was lost.
+ */
+flash_status_t flash_log_read(const flash_log_t *log, uint64_t index, void *record) {
+    if (log == NULL || record == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (index < flash_log_first(log) || index >= flash_log_end(log)) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+
+    uint32_t seq, pos, ram_from;
+    locate_record(log, index, &seq, &pos, &ram_from);
+
+    // When the open page is the first one, the header is in RAM too and needs no check.
+    if (ram_from > 0 && !header_matches(log, seq)) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    const uint8_t *sector = (const uint8_t *)(XIP_BASE + sector_flash_offset(log, seq));
+    uint8_t *dst = record;
+    for (uint32_t i = 0; i < log->record_size; i++, pos++) {
+        dst[i] = pos >= ram_from ? log->page[pos - ram_from] : sector[pos];
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Returns a pointer to a record in memory-mapped flash, so that it can be parsed without a copy.
+ *
+ * @param log An opened log.
+ * @param index Record index, between flash_log_first and flash_log_end.
+ * @return The record's XIP address, or NULL if it is outside the log, lost, or not entirely
+ *         programmed yet; flash_log_read still works for the latter.
+ */
+const uint8_t *flash_log_record_ptr(const flash_log_t *log, uint64_t index) {
+    if (log == NULL || index < flash_log_first(log) || index >= flash_log_end(log)) {
+        return NULL;
+    }
+
+    uint32_t seq, pos, ram_from;
+    locate_record(log, index, &seq, &pos, &ram_from);
+    if (pos + log->record_size > ram_from || !header_matches(log, seq)) {
+        return NULL;
+    }
+    return (const uint8_t *)(XIP_BASE + sector_flash_offset(log, seq) + pos);
+}
+
+/**
+ * Erases every sector of the log and starts again from index 0.
+ *
+ * @param log An opened log.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, or the first error erasing a sector; the log is
+ *         restarted either way.
+ */
+flash_status_t flash_log_clear(flash_log_t *log) {
+    if (log == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    flash_status_t result = FLASH_OK;
+    for (uint32_t i = 0; i < log->sectors; i++) {
+        flash_status_t status = flash_erase_unmanaged(log->first_offset + i * FLASH_SECTOR_SIZE);
+        if (status != FLASH_OK && result == FLASH_OK) {
+            result = status;
+        }
+    }
+    log->sector_seq = 0;
+    log->sector_records = 0;
+    log->sector_ready = false;
+    memset(log->page, 0xFF, sizeof(log->page));
+    return result;
+}
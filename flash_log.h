@@ -0,0 +1,76 @@
+/**
+ * @file flash_log.h
+ *
+ * Circular log of fixed-size records, such as sensor_value samples taken at a fixed rate. Records
+ * are collected in a RAM copy of the page being filled and flash is only ever programmed a full
+ * page at a time (or on an explicit flush). When the newest sector fills up, the log moves on to
+ * the next one in the ring, erasing it and with it the oldest records; nothing else is erased.
+ *
+ * Each sector starts with a small header holding a magic, the record size and the sector's
+ * sequence number. Sector sequence s always lives in sector s % sectors of the log and holds
+ * records s * records_per_sector onward, so a record index maps to its flash address with a
+ * division and no lookup table, and the newest sector is found at boot by reading one header per
+ * sector.
+ *
+ * Records still in the RAM page are lost on power failure unless flash_log_flush was called.
+ * Erasing a sector takes tens of milliseconds with interrupts disabled, once per sector of
+ * records; producers sampling faster than that must buffer across it. A record whose bytes are
+ * all 0xFF cannot be told from free space when the log is reopened.
+ */
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "flash_ops.h"
+#include "flash_geometry.h"
+
+#define FLASH_LOG_SECTOR_HEADER 8
+#define FLASH_LOG_MAX_RECORD 256
+
+// One timestamped sensor_value sample, the record the logger was built around.
+typedef struct {
+    uint32_t timestamp_ms;
+    float value;
+} flash_sample_t;
+
+typedef struct {
+    uint32_t first_offset;       // User-region offset of the first sector.
+    uint32_t sectors;            // Sectors in the ring.
+    uint32_t record_size;        // Bytes per record.
+    uint32_t records_per_sector; // Records that fit behind the sector header.
+    uint32_t sector_seq;         // Sequence number of the sector being filled.
+    uint32_t sector_records;     // Records already in that sector.
+    bool sector_ready;           // Whether that sector has been erased for this sequence.
+    uint32_t page_programs;      // Pages programmed since opening, including flushes.
+    uint32_t sector_erases;      // Sectors erased since opening.
+    uint8_t page[FLASH_PAGE_SIZE]; // RAM copy of the page being filled.
+} flash_log_t;
+
+// Opens the log in `sectors` sectors from `first_offset`, resuming after the newest record.
+flash_status_t flash_log_open(flash_log_t *log, uint32_t first_offset, uint32_t sectors, size_t record_size);
+
+// Appends one record; programs flash only when a page fills up.
+flash_status_t flash_log_append(flash_log_t *log, const void *record);
+
+// Programs the partly filled page so every appended record survives a power loss.
+flash_status_t flash_log_flush(flash_log_t *log);
+
+// Copies the record with the given index; fails if it was overwritten or not written yet.
+flash_status_t flash_log_read(const flash_log_t *log, uint64_t index, void *record);
+
+// Returns the record's address in XIP flash, or NULL if it is not entirely programmed yet.
+const uint8_t *flash_log_record_ptr(const flash_log_t *log, uint64_t index);
+
+// Index of the oldest record still in the log.
+uint64_t flash_log_first(const flash_log_t *log);
+
+// Index the next appended record will get; the log holds [first, end).
+uint64_t flash_log_end(const flash_log_t *log);
+
+// Erases the log and starts again from index 0.
+flash_status_t flash_log_clear(flash_log_t *log);
+
+#endif // FLASH_LOG_H
@@ -19,7 +19,10 @@
 
 #include "flash_ops.h"
 #include "flash_ops_helper.h"
-#include <stdio.h>
+#include "flash_cache.h"
+#include "flash_bbt.h"
+#include "flash_erase_count.h"
+#include "crc32c.h"
 #include <string.h>
  
 #include "pico/stdlib.h"
@@ -28,87 +31,354 @@
 #include <stdlib.h>
  #include <stdbool.h>  // Include this header for bool type
 
-#define FLASH_TARGET_OFFSET (256 * 1024) // Offset where user data starts  
-#define FLASH_SIZE PICO_FLASH_SIZE_BYTES // Total flash size available
-#define METADATA_SIZE sizeof(flash_data)  
 
-/**
- * Write data safely to the flash memory at a specified offset, ensuring that all parameters and alignment rules
- * are strictly adhered to in order to prevent data corruption and adhere to device specifications.
- * 
- * @param offset The offset from the base where data starts to be written in the flash memory.
- * @param data Pointer to the data buffer to be written to flash.
- * @param data_len The length of the data to be written in bytes.
- */
-void flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len) {
-    // Calculate the actual flash memory address by adding the target offset to the base address.
-    uint32_t flash_offset = FLASH_TARGET_OFFSET + offset;
-    // Print the computed flash memory address for debugging purposes.
-    printf("flash_offset: %d\n", flash_offset);
+// Number of different sectors flash_write_alloc tries before giving up on a verify failure.
+#define FLASH_WRITE_RETRIES 3
 
-    // Check if data is NULL or if the length is zero, which are invalid inputs.
-    if (data == NULL || data_len == 0) {
-        printf("Error: No data provided or data length is zero.\n");
-        return;  // Exit the function to prevent further operations with invalid data.
-    }
+// Whether flash_write_safe reads every programmed sector back; flash_write_alloc always does.
+static bool verify_enabled = false;
 
-    // Ensure the flash offset is a multiple of the flash sector size to avoid cross-sector write issues.
-    if (flash_offset % FLASH_SECTOR_SIZE != 0) {
-        printf("Error: Invalid offset for write. Please use a multiple of %d (sector size).\n", FLASH_SECTOR_SIZE);
-        return;  // Early return if the offset is not aligned.
+/**
+ * Returns a short, constant description of a status code. The strings live in flash and are
+ * available even when the library is built without stdio, so applications can report them
+ * through whatever channel they use.
+ *
+ * @param status The status code to describe.
+ * @return A null-terminated description; never NULL.
+ */
+const char *flash_status_str(flash_status_t status) {
+    switch (status) {
+        case FLASH_OK:                   return "ok";
+        case FLASH_ERR_NULL_DATA:        return "no data provided";
+        case FLASH_ERR_ZERO_LENGTH:      return "data length is zero";
+        case FLASH_ERR_ALIGNMENT:        return "offset is not sector aligned";
+        case FLASH_ERR_TOO_LARGE:        return "data exceeds sector capacity";
+        case FLASH_ERR_OUT_OF_BOUNDS:    return "beyond flash memory limits";
+        case FLASH_ERR_NO_MEMORY:        return "out of memory";
+        case FLASH_ERR_INVALID_DATA:     return "no valid data in sector";
+        case FLASH_ERR_BUFFER_TOO_SMALL: return "buffer too small";
+        case FLASH_ERR_VERIFY:           return "verify failed, sector retired";
+        case FLASH_ERR_RETIRED:          return "sector is retired";
+        case FLASH_ERR_NO_SPACE:         return "no free sector";
+        case FLASH_ERR_CRC:              return "checksum mismatch";
     }
+    return "unknown error";
+}
 
-    // Check if the data size exceeds the sector capacity after accounting for metadata.
-    if (data_len > (FLASH_SECTOR_SIZE - METADATA_SIZE)) {
-        printf("Error: Data size exceeds the maximum allowed limit per sector (%u bytes allowed).\n", FLASH_SECTOR_SIZE - METADATA_SIZE);
-        return;  // Return if the data size is too large for one sector.
-    }
+/**
+ * Enables or disables read-after-write verification for flash_write_safe. When enabled, every
+ * programmed sector is compared word by word against the data that was sent to the flash, and a
+ * sector that does not match is retired in the bad-sector table.
+ *
+ * @param enable true to verify every write.
+ */
+void flash_set_verify(bool enable) {
+    verify_enabled = enable;
+}
 
-    // Prevent writing beyond the physical memory limits of the flash.
-    if (flash_offset + METADATA_SIZE > FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Attempt to write beyond flash memory limits.\n");
-        return;  // Return if the write operation would exceed the flash memory boundaries.
-    }
+/**
+ * Works out the write count a sector reaches with its next erase and logs it in the erase-count
+ * table, which must happen before the erase so that no interruption can lose the count. A header
+ * that fails its checksum no longer holds a count, so the logged one is used instead.
+ *
+ * @param offset Validated sector offset relative to the start of the user region.
+ * @return The sector's write count including the coming erase.
+ */
+static uint32_t log_next_erase(uint32_t offset) {
+    // A checksum mismatch is expected here, e.g. for a sector about to be overwritten, so it is not reported.
+    flash_stat_t stat;
+    uint32_t count = flash_stat(offset, &stat) == FLASH_OK ? stat.write_count : flash_erase_count_get(offset);
+    count++;
+    flash_erase_count_record(offset, count);
+    return count;
+}
 
-    // Retrieve the current write count for the specified offset, then increment it by one.
-    uint32_t initial_count = get_flash_write_count(offset);
-    initial_count++;
+/**
+ * Erases one sector and programs a serialized header and payload into it. Shared by
+ * flash_write_safe and flash_write_alloc once their arguments have been validated.
+ *
+ * @param offset Validated sector offset relative to the start of the user region.
+ * @param flash_offset The corresponding absolute flash offset.
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data, already checked against the sector capacity.
+ * @param verify Whether to read the sector back and retire it on a mismatch.
+ * @return FLASH_OK, FLASH_ERR_NO_MEMORY or FLASH_ERR_VERIFY.
+ */
+static flash_status_t program_sector(uint32_t offset, uint32_t flash_offset, const uint8_t *data, size_t data_len, bool verify) {
+    // The write count this write brings the sector to, logged before anything is erased.
+    uint32_t initial_count = log_next_erase(offset);
 
     // Prepare the flash data structure with new write count and data information.
     flash_data flashData = {
         .valid = true,         // Mark the data as valid.
         .write_count = initial_count, // Updated write count.
         .data_len = data_len,  // Set the length of the data.
-        .data_ptr = data       // Point to the data to be written.
+        .data_ptr = (uint8_t *)data  // Point to the data to be written; serialization only reads it.
     };
 
-    // Calculate the total size required for storing the data and metadata.
-    size_t total_size = sizeof(flash_data) + flashData.data_len;
+    // Calculate the total size required for storing the data and metadata, rounded up to whole
+    // pages because flash_range_program only accepts multiples of FLASH_PAGE_SIZE.
+    size_t total_size = METADATA_SIZE + flashData.data_len;
+    total_size = (total_size + FLASH_PAGE_MASK) & ~(size_t)FLASH_PAGE_MASK;
 
     // Allocate memory for the buffer that will hold both the metadata and the actual data.
     uint8_t *flash_data_buffer = malloc(total_size);
     if (!flash_data_buffer) {
-        printf("Failed to allocate memory for flash data buffer.\n");
-        return;  // Return if memory allocation fails.
+        FLASH_LOG("Failed to allocate memory for flash data buffer.\n");
+        return FLASH_ERR_NO_MEMORY;  // Return if memory allocation fails.
     }
 
-    // Serialize the flashData structure into the allocated buffer.
+    // Padding is left in the erased state so it does not program any bits.
+    memset(flash_data_buffer, 0xFF, total_size);
+
+    // Serialize the flashData structure into the allocated buffer. The sector is programmed as
+    // WRITING and only committed to VALID once everything else is in flash.
     serialize_flash_data(&flashData, flash_data_buffer, total_size);
+    flash_data_buffer[0] = FLASH_STATE_WRITING;
 
     // Disable interrupts to ensure the flash write operation is not interrupted, maintaining atomicity.
     uint32_t ints = save_and_disable_interrupts();
 
     // Erase the flash sector before writing new data to ensure it's clean for programming.
-    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
 
     // Program the flash memory with new data and metadata.
-    flash_range_program(offset, flash_data_buffer, total_size);
+    flash_range_program(flash_offset, flash_data_buffer, total_size);
 
     // Restore interrupts to their original state once the flash operation is complete.
     restore_interrupts(ints);
 
+    // Commit: WRITING to VALID only clears a bit, so this is a one-byte program of the first page.
+    flash_data_buffer[0] = FLASH_STATE_VALID;
+    flash_program_partial(flash_offset, flash_data_buffer, 1);
+
+    // Read the sector back through XIP. Both buffers are word aligned and a whole number of pages,
+    // so the comparison runs entirely on 32-bit words.
+    bool matches = !verify || flash_words_equal(flash_data_buffer, (const void *)(XIP_BASE + flash_offset), total_size);
+
     // Free the allocated buffer after the write operation is done.
     free(flash_data_buffer);
+
+    if (!matches) {
+        // The header in flash is unknown now, so drop every cached header rather than guess.
+        flash_cache_invalidate();
+        flash_bbt_retire(offset);
+        FLASH_LOG("Error: Verify failed at offset %u.\n", (unsigned)offset);
+        return FLASH_ERR_VERIFY;
+    }
+
+    // Keep the cached header in step with what was just programmed.
+    flash_stat_t stat = {
+        .valid = true,
+        .blank = false,
+        .write_count = initial_count,
+        .data_len = (uint32_t)data_len,
+        .data_crc = crc32c(data, data_len)
+    };
+    flash_cache_store(offset, &stat);
+    return FLASH_OK;
+}
+
+/**
+ * Checks the arguments shared by both write entry points.
+ *
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data to be written in bytes.
+ * @return FLASH_OK if the data can be stored in one sector.
+ */
+static flash_status_t check_write_data(const uint8_t *data, size_t data_len) {
+    // Check if data is NULL or if the length is zero, which are invalid inputs.
+    if (data == NULL) {
+        FLASH_LOG("Error: No data provided for write.\n");
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (data_len == 0) {
+        FLASH_LOG("Error: Data length for write is zero.\n");
+        return FLASH_ERR_ZERO_LENGTH;
+    }
+
+    // Check if the data size exceeds the sector capacity after accounting for metadata.
+    if (data_len > (FLASH_SECTOR_SIZE - METADATA_SIZE)) {
+        FLASH_LOG("Error: Data size exceeds the maximum allowed limit per sector (%u bytes allowed).\n", (unsigned)(FLASH_SECTOR_SIZE - METADATA_SIZE));
+        return FLASH_ERR_TOO_LARGE;  // Return if the data size is too large for one sector.
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Validates the arguments of a single-sector write and programs the sector.
+ */
+static flash_status_t write_sector(uint32_t offset, const uint8_t *data, size_t data_len, bool verify) {
+    flash_status_t status = check_write_data(data, data_len);
+    if (status != FLASH_OK) {
+        return status;
+    }
+
+    // Ensure the offset is sector aligned and the sector lies within the physical memory limits.
+    uint32_t flash_offset;
+    status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot write at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
+    }
+
+    // Sectors that failed verification before are not written again.
+    if (flash_bbt_is_retired(offset)) {
+        FLASH_LOG("Error: Cannot write at offset %u: %s\n", (unsigned)offset, flash_status_str(FLASH_ERR_RETIRED));
+        return FLASH_ERR_RETIRED;
+    }
+
+    return program_sector(offset, flash_offset, data, data_len, verify);
+}
+
+/**
+ * Write data safely to the flash memory at a specified offset, ensuring that all parameters and alignment rules
+ * are strictly adhered to in order to prevent data corruption and adhere to device specifications.
+ * 
+ * @param offset The offset from the base where data starts to be written in the flash memory.
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data to be written in bytes.
+ * @return FLASH_OK once the sector has been programmed, otherwise the reason nothing was written.
+ *         With verification enabled, FLASH_ERR_VERIFY means the sector was programmed but read
+ *         back differently and has been retired.
+ */
+flash_status_t flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len) {
+    return write_sector(offset, data, data_len, verify_enabled);
+}
+
+/**
+ * Writes data like flash_write_safe, but always reads the sector back whatever flash_set_verify
+ * says. For callers that pick the sector themselves and retry elsewhere on a mismatch, as
+ * flash_write_alloc does internally.
+ *
+ * @param offset The sector offset relative to the start of the user region.
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data to be written in bytes.
+ * @return As flash_write_safe with verification enabled; FLASH_ERR_VERIFY means the sector has
+ *         been retired and the data must go elsewhere.
+ */
+flash_status_t flash_write_verified(uint32_t offset, const uint8_t *data, size_t data_len) {
+    return write_sector(offset, data, data_len, true);
+}
+
+/**
+ * Picks a sector for new data: the free sector (blank, or with an intact header and no valid
+ * data) with the lowest write count, skipping sectors listed in the bad-sector table and sectors
+ * whose header fails its checksum. Headers come from flash_stat, so the
+ * search runs from RAM once the header table is warm.
+ *
+ * @param offset Receives the sector offset relative to the start of the user region.
+ * @return FLASH_OK, or FLASH_ERR_NO_SPACE if every usable sector holds valid data.
+ */
+flash_status_t flash_alloc_sector(uint32_t *offset) {
+    return flash_alloc_sector_in(0, FLASH_USER_SECTORS, offset);
+}
+
+/**
+ * Checks that a run of sectors lies within the user region.
+ */
+static flash_status_t check_sector_run(uint32_t first_offset, uint32_t sectors) {
+    if ((first_offset & FLASH_SECTOR_MASK) != 0) {
+        return FLASH_ERR_ALIGNMENT;
+    }
+    if (sectors == 0 || first_offset / FLASH_SECTOR_SIZE > FLASH_USER_SECTORS - sectors ||
+        sectors > FLASH_USER_SECTORS) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Same as flash_alloc_sector, but only considers the `sectors` sectors from `first_offset`, so
+ * wear is levelled within one partition and data never spills into another.
+ *
+ * @param first_offset User-region offset of the first sector of the run.
+ * @param sectors Number of sectors in the run.
+ * @param offset Receives the sector offset relative to the start of the user region.
+ * @return FLASH_OK, FLASH_ERR_NO_SPACE if every usable sector of the run holds valid data, or
+ *         FLASH_ERR_ALIGNMENT / FLASH_ERR_OUT_OF_BOUNDS for a run outside the user region.
+ */
+flash_status_t flash_alloc_sector_in(uint32_t first_offset, uint32_t sectors, uint32_t *offset) {
+    if (offset == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    flash_status_t run_status = check_sector_run(first_offset, sectors);
+    if (run_status != FLASH_OK) {
+        return run_status;
+    }
+
+    bool found = false;
+    uint32_t best_count = 0;
+    for (uint32_t index = 0; index < sectors; index++) {
+        uint32_t candidate = first_offset + index * FLASH_SECTOR_SIZE;
+        // Only blank sectors and record sectors without live data are free. A header that fails
+        // its checksum may well belong to a log, queue or time series, so such a sector is left
+        // alone until something erases it explicitly.
+        flash_stat_t stat;
+        flash_status_t status = flash_stat(candidate, &stat);
+        if (status != FLASH_OK || stat.valid || flash_bbt_is_retired(candidate)) {
+            continue;
+        }
+        if (!found || stat.write_count < best_count) {
+            found = true;
+            best_count = stat.write_count;
+            *offset = candidate;
+        }
+    }
+    return found ? FLASH_OK : FLASH_ERR_NO_SPACE;
+}
+
+/**
+ * Writes data to a sector chosen by flash_alloc_sector and always verifies it. If the data does not
+ * read back correctly the sector is retired and the write is retried in a different sector, up to
+ * FLASH_WRITE_RETRIES times, so a worn part loses capacity instead of silently corrupting data.
+ *
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data to be written in bytes.
+ * @param offset Receives the offset of the sector that now holds the data.
+ * @return FLASH_OK, FLASH_ERR_NO_SPACE, FLASH_ERR_VERIFY after exhausting the retries, or an
+ *         argument error.
+ */
+flash_status_t flash_write_alloc(const uint8_t *data, size_t data_len, uint32_t *offset) {
+    return flash_write_alloc_in(0, FLASH_USER_SECTORS, data, data_len, offset);
+}
+
+/**
+ * Same as flash_write_alloc, but allocates only within the `sectors` sectors from `first_offset`.
+ *
+ * @param first_offset User-region offset of the first sector of the run.
+ * @param sectors Number of sectors in the run.
+ * @param data Pointer to the data buffer to be written to flash.
+ * @param data_len The length of the data to be written in bytes.
+ * @param offset Receives the offset of the sector that now holds the data.
+ * @return As flash_write_alloc.
+ */
+flash_status_t flash_write_alloc_in(uint32_t first_offset, uint32_t sectors, const uint8_t *data, size_t data_len, uint32_t *offset) {
+    if (offset == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    flash_status_t status = check_write_data(data, data_len);
+    if (status != FLASH_OK) {
+        return status;
+    }
+
+    for (int attempt = 0; attempt < FLASH_WRITE_RETRIES; attempt++) {
+        uint32_t candidate;
+        status = flash_alloc_sector_in(first_offset, sectors, &candidate);
+        if (status != FLASH_OK) {
+            return status;
+        }
+
+        // A failed verify retires the candidate, so the next allocation picks a different sector.
+        status = program_sector(candidate, FLASH_TARGET_OFFSET + candidate, data, data_len, true);
+        if (status != FLASH_ERR_VERIFY) {
+            if (status == FLASH_OK) {
+                *offset = candidate;
+            }
+            return status;
+        }
+    }
+    return FLASH_ERR_VERIFY;
 }
 
 
@@ -126,57 +396,62 @@ void flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len) {
  * @param offset The offset from the base where data is read in the flash memory.
  * @param buffer The buffer to store read data.
  * @param buffer_len The length of the buffer to ensure no overflow occurs.
+ * @param bytes_read Optional; receives the number of bytes copied into buffer (0 on error).
+ * @return FLASH_OK if valid data was copied, otherwise the reason the read was refused.
  */
-void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len) {
-    // Calculate the actual memory address in flash by adding the base offset.
-    uint32_t flash_offset = FLASH_TARGET_OFFSET + offset;
-    // Display calculated flash offset for verification and debugging purposes.
-    printf("Calculated flash offset: %d\n", flash_offset);
-
-    // Check if the flash offset is properly aligned with the sector size to avoid misaligned reads.
-    if (flash_offset % FLASH_SECTOR_SIZE != 0) {
-        printf("Error: Invalid offset for read. Please use a multiple of %d (sector size).\n", FLASH_SECTOR_SIZE);
-        return; // Exit function if offset is not aligned.
+flash_status_t flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len, size_t *bytes_read) {
+    if (bytes_read != NULL) {
+        *bytes_read = 0;
     }
-
-    // Ensure the read operation does not extend beyond the flash memory's bounds.
-    if (flash_offset + METADATA_SIZE > FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Attempt to read beyond flash memory limits.\n");
-        return; // Exit function if attempting to read beyond available flash memory.
+    if (buffer == NULL) {
+        return FLASH_ERR_NULL_DATA;
     }
 
-    // Calculate the total size needed to read, including both metadata and the user data.
-    const size_t total_size = sizeof(flash_data) + buffer_len;
+    // Check that the offset is sector aligned and the read does not extend beyond the flash memory's bounds.
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot read at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
+    }
 
-    // Allocate a buffer to hold the flash data including the metadata.
-    uint8_t *flash_data_buffer = malloc(total_size);
-    if (flash_data_buffer == NULL) {
-        printf("Failed to allocate memory for flash data buffer.\n");
-        return; // Exit if memory allocation fails.
+    // Fetch the metadata in one lookup, usually from the in-RAM header table.
+    flash_stat_t stat;
+    status = flash_stat(offset, &stat);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot read at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
     }
 
-    // Copy the data from flash memory starting at the computed offset into the allocated buffer.
-    memcpy(flash_data_buffer, (const void *)(XIP_BASE + offset), total_size);
+    // Check if the data is valid before copying it to the user-provided buffer.
+    if (!stat.valid) {
+        FLASH_LOG("Error: Invalid data at specified flash offset.\n");
+        return FLASH_ERR_INVALID_DATA;
+    }
 
-    // Deserialize the buffer into a flash_data struct to extract metadata and actual data.
-    flash_data data;
-    deserialize_flash_data(flash_data_buffer, &data);
+    // A length that cannot fit in one sector means the metadata itself is corrupt.
+    if (stat.data_len > FLASH_SECTOR_SIZE - METADATA_SIZE) {
+        FLASH_LOG("Error: Corrupt data length at specified flash offset.\n");
+        return FLASH_ERR_INVALID_DATA;
+    }
 
-    // Check if the data is valid before copying it to the user-provided buffer.
-    if (data.valid) {
-        // Ensure that the buffer is large enough to hold the data.
-        if (buffer_len >= data.data_len) {
-            // Copy only the amount of data specified in data_len to prevent buffer overflow.
-            memcpy(buffer, data.data_ptr, data.data_len);
-        } else {
-            printf("Error: Buffer provided is too small for the data length.\n");
-        }
-    } else {
-        printf("Error: Invalid data at specified flash offset.\n");
+    // Ensure that the buffer is large enough to hold the data.
+    if (buffer_len < stat.data_len) {
+        FLASH_LOG("Error: Buffer provided is too small for the data length.\n");
+        return FLASH_ERR_BUFFER_TOO_SMALL;
     }
 
-    // Free the allocated buffer after use.
-    free(flash_data_buffer);
+    // Copy the payload straight from memory-mapped flash; no intermediate buffer is needed.
+    // The checksum then runs over the copy in RAM rather than a second pass over XIP.
+    memcpy(buffer, (const void *)(XIP_BASE + flash_offset + FLASH_HEADER_SIZE), stat.data_len);
+    if (crc32c(buffer, stat.data_len) != stat.data_crc) {
+        FLASH_LOG("Error: Checksum mismatch at specified flash offset.\n");
+        return FLASH_ERR_CRC;
+    }
+    if (bytes_read != NULL) {
+        *bytes_read = stat.data_len;
+    }
+    return FLASH_OK;
 }
 
 
@@ -184,66 +459,245 @@ void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len) {
 
   
  
+/**
+ * Erases a validated sector after logging its new write count.
+ *
+ * @return The sector's write count including this erase.
+ */
+static uint32_t erase_counted(uint32_t offset, uint32_t flash_offset) {
+    // Count the erase first: whatever happens after this point, the sector's wear history is kept.
+    uint32_t count = log_next_erase(offset);
+
+    // Disable interrupts to ensure the erasure process is not interrupted, maintaining the atomicity of the operation.
+    uint32_t ints = save_and_disable_interrupts();
+
+    // Perform the actual erasure of the sector.
+    flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
+
+    // Re-enable interrupts after completing the erasure to restore normal operation.
+    restore_interrupts(ints);
+    return count;
+}
+
 /**
  * Erase a sector of the flash memory at a specified offset. This function ensures
- * that the operation respects flash memory boundaries and alignment requirements,
- * preserving essential metadata while erasing the rest of the sector.
+ * that the operation respects flash memory boundaries and alignment requirements.
+ * The sector's new write count is logged in the erase-count table before the erase,
+ * so the erase itself is a plain sector erase and the sector is left entirely blank.
  *
  * @param offset The offset within the flash memory where the sector begins to be erased.
+ * @return FLASH_OK once the sector has been erased, otherwise the reason nothing was erased.
  */
-void flash_erase_safe(uint32_t offset) {
-    // Calculate the actual address in flash memory where the erasing will start, including the predefined offset.
-    uint32_t flash_offset = FLASH_TARGET_OFFSET + offset;
+flash_status_t flash_erase_safe(uint32_t offset) {
+    // Ensure the offset aligns with the sector size and that the sector lies within the flash memory.
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot erase at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
+    }
 
-    // Ensure the offset aligns with the sector size to prevent partial erasure of sectors.
-    if (flash_offset % FLASH_SECTOR_SIZE != 0) {
-        printf("Error: Invalid offset for erase. Please use a multiple of %d (sector size).\n", FLASH_SECTOR_SIZE);
-        return; // Exit if the offset is misaligned, as erasing misaligned sectors can lead to data corruption.
+    uint32_t initial_count = erase_counted(offset, flash_offset);
+
+    // Keep the cached header in step: blank, with the count now held by the erase-count table.
+    flash_stat_t stat = {
+        .valid = false,
+        .blank = true,
+        .write_count = initial_count,
+        .data_len = 0,
+        .data_crc = 0
+    };
+    flash_cache_store(offset, &stat);
+    return FLASH_OK;
+}
+
+
+
+/**
+ * Erases a sector that a module with its own sector layout, such as flash_log or flash_queue, is
+ * about to refill. The erase is counted like any other, and the header table records the sector
+ * as holding no record header, so the allocator never mistakes it for a free sector while the
+ * module is filling it.
+ *
+ * @param offset The sector offset relative to the start of the user region.
+ * @return FLASH_OK once the sector has been erased, otherwise the reason nothing was erased.
+ */
+flash_status_t flash_erase_unmanaged(uint32_t offset) {
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
     }
+    flash_cache_store_corrupt(offset, erase_counted(offset, flash_offset));
+    return FLASH_OK;
+}
+
 
-    // Check if the erasing would go beyond the limits of the flash memory.
-    if (flash_offset + METADATA_SIZE > FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Attempt to erase beyond flash memory limits.\n");
-        return; // Stop the operation to prevent memory corruption due to out-of-bounds access.
+
+/**
+ * Marks the data in a sector obsolete by clearing its state byte from VALID to OBSOLETE. Nothing
+ * is erased, so this takes one page program instead of a sector erase, and the sector's write
+ * count does not grow. The sector then reads as holding no data and the allocator treats it as
+ * free; it is erased when it is next written. Use flash_erase_safe when the data must be gone
+ * from flash rather than just unreachable.
+ *
+ * @param offset The sector offset relative to the start of the user region.
+ * @return FLASH_OK once the sector holds no valid data (also if it held none already),
+ *         FLASH_ERR_INVALID_DATA for a sector whose header was never programmed, or the error
+ *         inspecting the sector.
+ */
+flash_status_t flash_mark_obsolete(uint32_t offset) {
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    flash_stat_t stat;
+    status = flash_stat(offset, &stat);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (stat.blank) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    if (*(const uint8_t *)(XIP_BASE + flash_offset) == FLASH_STATE_OBSOLETE) {
+        return FLASH_OK;
     }
 
-    // Retrieve the current write count for the sector to be erased and increment it to track erase cycles.
-    uint32_t initial_count = get_flash_write_count(offset);
-    initial_count += 1;
+    uint8_t state = FLASH_STATE_OBSOLETE;
+    flash_program_partial(flash_offset, &state, 1);
 
-    // Disable interrupts to ensure the erasure process is not interrupted, maintaining the atomicity of the operation.
-    uint32_t ints = save_and_disable_interrupts();
+    // The header fields behind the state byte are unchanged; the sector simply holds no data now.
+    stat.valid = false;
+    stat.data_len = 0;
+    stat.data_crc = 0;
+    flash_cache_store(offset, &stat);
+    return FLASH_OK;
+}
+
+/**
+ * Reads the state byte of a sector header straight from flash. Values a partial program could
+ * leave behind are reported as OBSOLETE unless they are exactly WRITING, so every byte maps to
+ * one of the four states.
+ *
+ * @param offset The sector offset relative to the start of the user region.
+ * @param state Receives the state.
+ * @return FLASH_OK, or the error validating the offset.
+ */
+flash_status_t flash_sector_state(uint32_t offset, flash_sector_state_t *state) {
+    if (state == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    uint8_t raw = *(const uint8_t *)(XIP_BASE + flash_offset);
+    switch (raw) {
+        case FLASH_STATE_ERASED:
+        case FLASH_STATE_WRITING:
+        case FLASH_STATE_VALID:
+            *state = (flash_sector_state_t)raw;
+            break;
+        default:
+            *state = FLASH_STATE_OBSOLETE;
+            break;
+    }
+    return FLASH_OK;
+}
 
-    // Compute the exact start of the sector to be erased, ensuring it is rounded down to the nearest sector boundary.
-    uint32_t sector_start = flash_offset & ~(FLASH_SECTOR_SIZE - 1);
 
-    // Verify that the calculated sector start does not exceed the flash memory's boundary.
-    if (sector_start >= FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Sector start address is out of bounds.\n");
-        restore_interrupts(ints);
-        return; // Restore interrupts and abort if the start address is invalid.
+
+/**
+ * Returns the byte a raw sector image expects at a position; bytes beyond the image are erased.
+ */
+static inline uint8_t image_byte(const uint8_t *image, size_t image_len, size_t i) {
+    return i < image_len ? image[i] : 0xFF;
+}
+
+/**
+ * Writes a raw sector image, such as a sector streamed out by a protocol dump, so that the sector
+ * afterwards holds exactly the image followed by erased bytes. Unlike flash_write_safe nothing is
+ * added: the image carries its own record header, write count included.
+ *
+ * NOR flash can only clear bits, so the sector is erased only when some bit of the image would
+ * have to go from 0 back to 1, and only pages that differ are programmed. Restoring an image onto
+ * a sector that already holds it therefore costs no erase cycle at all, and restoring onto a
+ * blank sector skips the erase. The sector is read back afterwards and retired on a mismatch.
+ *
+ * @param offset The sector offset relative to the start of the user region.
+ * @param image The raw sector contents.
+ * @param image_len Length of the image; at most FLASH_SECTOR_SIZE.
+ * @return FLASH_OK once the sector matches the image, otherwise the reason it does not.
+ */
+flash_status_t flash_load_sector(uint32_t offset, const uint8_t *image, size_t image_len) {
+    if (image == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (image_len == 0) {
+        return FLASH_ERR_ZERO_LENGTH;
+    }
+    if (image_len > FLASH_SECTOR_SIZE) {
+        return FLASH_ERR_TOO_LARGE;
     }
 
-    // Back up the existing metadata from the sector before erasing to preserve critical data like write counts.
-    flash_data metadata_backup;
-    memcpy(&metadata_backup, (const void*)(XIP_BASE + sector_start), sizeof(flash_data));
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot load at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
+    }
+    if (flash_bbt_is_retired(offset)) {
+        return FLASH_ERR_RETIRED;
+    }
 
-    // Perform the actual erasure of the sector.
-    flash_range_erase(sector_start, FLASH_SECTOR_SIZE);
+    // An erase is needed only if the image wants a 1 where flash already holds a 0.
+    const uint8_t *current = (const uint8_t *)(XIP_BASE + flash_offset);
+    bool erase = false;
+    for (size_t i = 0; i < FLASH_SECTOR_SIZE && !erase; i++) {
+        uint8_t want = image_byte(image, image_len, i);
+        erase = (current[i] & want) != want;
+    }
 
-    // Set up metadata for restoration after erasing. Mark data as invalid since it has been erased.
-    flash_data metadata_to_restore = {
-        .valid = false,
-        .write_count = initial_count, // Updated write count after erasure.
-        .data_len = 0,
-        .data_ptr = NULL
-    };
+    uint8_t page[FLASH_PAGE_SIZE];
+    bool touched = erase;
+    if (erase) {
+        log_next_erase(offset);
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
+        restore_interrupts(ints);
+    }
 
-    // Restore the metadata at the start of the erased sector to maintain the integrity of flash management data.
-    flash_range_program(sector_start, (const uint8_t *)&metadata_to_restore, sizeof(flash_data));
+    // Program page by page, skipping pages that already read back as wanted.
+    for (size_t page_start = 0; page_start < FLASH_SECTOR_SIZE; page_start += FLASH_PAGE_SIZE) {
+        for (size_t i = 0; i < FLASH_PAGE_SIZE; i++) {
+            page[i] = image_byte(image, image_len, page_start + i);
+        }
+        if (memcmp(page, current + page_start, FLASH_PAGE_SIZE) == 0) {
+            continue;
+        }
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(flash_offset + page_start, page, FLASH_PAGE_SIZE);
+        restore_interrupts(ints);
+        touched = true;
+    }
 
-    // Re-enable interrupts after completing the erasure to restore normal operation.
-    restore_interrupts(ints);
-}
+    if (!touched) {
+        return FLASH_OK;
+    }
 
+    // The header came from the image, so the cached copy of it is stale.
+    flash_cache_invalidate();
 
+    bool matches = memcmp(current, image, image_len) == 0;
+    for (size_t i = image_len; i < FLASH_SECTOR_SIZE && matches; i++) {
+        matches = current[i] == 0xFF;
+    }
+    if (!matches) {
+        flash_bbt_retire(offset);
+        FLASH_LOG("Error: Verify failed while loading offset %u.\n", (unsigned)offset);
+        return FLASH_ERR_VERIFY;
+    }
+    return FLASH_OK;
+}
@@ -14,6 +14,43 @@
 #include <stddef.h>
 #include <stdbool.h>  
 
+/**
+ * Result of every flash operation. Callers branch on these values instead of parsing console
+ * output, so the same checks keep working when the library is built with FLASH_OPS_NO_STDIO.
+ */
+typedef enum {
+    FLASH_OK = 0,               // The operation completed successfully.
+    FLASH_ERR_NULL_DATA,        // A required data or buffer pointer was NULL.
+    FLASH_ERR_ZERO_LENGTH,      // A zero-length write was requested.
+    FLASH_ERR_ALIGNMENT,        // The offset is not a multiple of the flash sector size.
+    FLASH_ERR_TOO_LARGE,        // The data does not fit in one sector after the metadata.
+    FLASH_ERR_OUT_OF_BOUNDS,    // The sector lies beyond the end of the flash memory.
+    FLASH_ERR_NO_MEMORY,        // A temporary buffer could not be allocated.
+    FLASH_ERR_INVALID_DATA,     // The sector does not hold valid data.
+    FLASH_ERR_BUFFER_TOO_SMALL, // The caller's buffer cannot hold the stored data.
+    FLASH_ERR_VERIFY,           // The data did not read back as programmed; the sector was retired.
+    FLASH_ERR_RETIRED,          // The sector is listed in the bad-sector table.
+    FLASH_ERR_NO_SPACE,         // No free sector (or table slot) is available.
+    FLASH_ERR_CRC               // A stored header or payload checksum does not match.
+} flash_status_t;
+
+/**
+ * State byte at the start of every sector header. Each step only clears bits, so moving a sector
+ * on is a one-byte program and never needs an erase:
+ *
+ *     ERASED (0xFF) -> WRITING (0x03) -> VALID (0x01) -> OBSOLETE (0x00)
+ *
+ * Only VALID sectors hold data. Recovery needs no special cases: a write cut short by a power
+ * loss stays WRITING and reads as holding no data, and any value a partial program could leave
+ * other than VALID or ERASED does the same.
+ */
+typedef enum {
+    FLASH_STATE_OBSOLETE = 0x00, // Data deleted or superseded, or none since the sector was erased.
+    FLASH_STATE_VALID = 0x01,    // Data completely programmed.
+    FLASH_STATE_WRITING = 0x03,  // Programming started and never completed.
+    FLASH_STATE_ERASED = 0xFF    // Header not programmed since the last erase.
+} flash_sector_state_t;
+
 /**
  * A structure to encapsulate flash data along with metadata for enhanced reliability and management.
  * This structure is used to track and verify the integrity of stored data.
@@ -22,13 +59,50 @@ typedef struct {
     bool valid;             // Indicates if the data is considered valid.
     uint32_t write_count;   // Tracks the number of times the data has been written to ensure wear leveling.
     size_t data_len;        // Specifies the length of the data in bytes.
+    uint32_t data_crc;      // CRC32C of the payload; computed by serialize_flash_data.
+    uint32_t header_crc;    // CRC32C of the serialized fields above; computed by serialize_flash_data.
     uint8_t *data_ptr;      // Points to the actual data stored in flash.
 } flash_data;
 
+/**
+ * Every metadata field of a sector header, returned together by flash_stat so callers that need
+ * more than one value pay for a single lookup.
+ */
+typedef struct {
+    bool valid;             // The sector holds valid data.
+    bool blank;             // The header has not been programmed since the sector was last erased.
+    uint32_t write_count;   // Number of writes and erases recorded for the sector.
+    uint32_t data_len;      // Length of the stored payload in bytes; 0 if the sector holds no data.
+    uint32_t data_crc;      // CRC32C of the stored payload.
+} flash_stat_t;
+
 // Functions for manipulating flash memory
-void flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len); // Writes data to flash safely.
-void flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len); // Reads data from flash safely.
-void flash_erase_safe(uint32_t offset); // Erases a sector of flash memory safely.
+flash_status_t flash_write_safe(uint32_t offset, const uint8_t *data, size_t data_len); // Writes data to flash safely.
+flash_status_t flash_read_safe(uint32_t offset, uint8_t *buffer, size_t buffer_len, size_t *bytes_read); // Reads data from flash safely.
+flash_status_t flash_erase_safe(uint32_t offset); // Erases a sector of flash memory safely.
+flash_status_t flash_erase_unmanaged(uint32_t offset); // Erases a sector for flash_log, flash_queue and other modules with their own layout.
+flash_status_t flash_stat(uint32_t offset, flash_stat_t *stat); // Retrieves all header fields of a sector at once.
+flash_status_t flash_verify_sector(uint32_t offset); // Checks the header and payload checksums of a sector.
+flash_status_t flash_mark_obsolete(uint32_t offset); // Marks a sector's data obsolete with a one-byte program, without erasing.
+flash_status_t flash_sector_state(uint32_t offset, flash_sector_state_t *state); // Reads the state byte of a sector header.
+
+// Read-after-write verification and sector allocation. A sector is free when it is blank or its
+// intact header holds no valid data; sectors whose header fails its checksum are never picked,
+// which keeps the pages of flash_log, flash_queue and the modules built on them safe. A blank
+// sector such a module has not refilled yet can still be picked, however, so give those modules
+// their own sectors (a LOG or RAW partition) and allocate with the _in variants outside them
+// rather than over the whole user region.
+void flash_set_verify(bool enable); // Enables comparing every programmed sector against the source data.
+flash_status_t flash_alloc_sector(uint32_t *offset); // Picks the least-worn free sector that is not retired.
+flash_status_t flash_write_verified(uint32_t offset, const uint8_t *data, size_t data_len); // flash_write_safe that always verifies, retiring a bad sector.
+flash_status_t flash_write_alloc(const uint8_t *data, size_t data_len, uint32_t *offset); // Writes to an allocated sector, verifying and retrying.
+flash_status_t flash_alloc_sector_in(uint32_t first_offset, uint32_t sectors, uint32_t *offset); // Allocates within a run of sectors, such as one partition.
+flash_status_t flash_write_alloc_in(uint32_t first_offset, uint32_t sectors, const uint8_t *data, size_t data_len, uint32_t *offset); // flash_write_alloc within a run of sectors.
+
+// Raw sector images, as used by bulk backup and restore
+flash_status_t flash_load_sector(uint32_t offset, const uint8_t *image, size_t image_len); // Programs a raw image, erasing only if needed, then verifies it.
+
+const char *flash_status_str(flash_status_t status); // Returns a short, constant description of a status code.
 
  
 #endif // FLASH_OPS_H
@@ -22,16 +22,270 @@
 
 #include "flash_ops.h"
 #include "flash_ops_helper.h"
-#include <stdio.h>
+#include "flash_cache.h"
+#include "flash_erase_count.h"
+#include "crc32c.h"
 #include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
 #include <stdlib.h>
 
-#define FLASH_SIZE PICO_FLASH_SIZE_BYTES 
-#define FLASH_TARGET_OFFSET (256 * 1024) 
-#define METADATA_SIZE sizeof(flash_data)  
+
+/**
+ * Validates a sector offset relative to FLASH_TARGET_OFFSET and converts it to an absolute flash
+ * offset. Every public operation runs its argument through this check so that alignment and bounds
+ * errors are reported with the same status codes everywhere.
+ *
+ * @param offset The offset from the start of the user flash region.
+ * @param flash_offset Receives the absolute flash offset of the sector on success.
+ * @return FLASH_OK, FLASH_ERR_ALIGNMENT or FLASH_ERR_OUT_OF_BOUNDS.
+ */
+flash_status_t flash_check_sector(uint32_t offset, uint32_t *flash_offset) {
+    // The user region starts on a sector boundary (checked in flash_geometry.h), so checking the
+    // relative offset is sufficient. Both checks compare against constants from the geometry, so
+    // each compiles to a mask or a compare with an immediate.
+    if ((offset & FLASH_SECTOR_MASK) != 0) {
+        return FLASH_ERR_ALIGNMENT;
+    }
+
+    // The whole sector must fit before the system sectors at the top of flash. Comparing against
+    // the last sector rather than adding to the offset keeps very large offsets from wrapping.
+    if (offset > FLASH_LAST_USER_SECTOR) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+
+    *flash_offset = FLASH_TARGET_OFFSET + offset;
+    return FLASH_OK;
+}
+
+
+
+/**
+ * Programs bytes at an arbitrary absolute flash offset without erasing first. Each affected page
+ * is programmed with the new bytes in place and 0xFF everywhere else, and programming 0xFF leaves
+ * a bit unchanged, so neighbouring data in the same page is preserved. Because flash can only
+ * clear bits, the target bytes must either be erased or hold a value whose zero bits are a
+ * subset of the new value's; this is what makes append-only records and in-place state flags work.
+ *
+ * @param flash_offset Absolute flash offset of the first byte to program.
+ * @param data Bytes to program.
+ * @param len Number of bytes; may span several pages.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA or FLASH_ERR_OUT_OF_BOUNDS.
+ */
+flash_status_t flash_program_partial(uint32_t flash_offset, const uint8_t *data, size_t len) {
+    if (data == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (flash_offset < FLASH_TARGET_OFFSET || flash_offset > FLASH_SIZE || len > FLASH_SIZE - flash_offset) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    while (len > 0) {
+        uint32_t page_start = flash_offset & ~(uint32_t)FLASH_PAGE_MASK;
+        size_t in_page = flash_offset - page_start;
+        size_t chunk = FLASH_PAGE_SIZE - in_page;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        // Everything outside the new bytes stays in the erased state so it programs nothing.
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page + in_page, data, chunk);
+
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(page_start, page, FLASH_PAGE_SIZE);
+        restore_interrupts(ints);
+
+        flash_offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return FLASH_OK;
+}
+
+
+
+/**
+ * Compares two buffers for equality. When both are word aligned the bulk of the comparison runs
+ * on 32-bit words, a quarter of the loads of a byte loop; the remaining tail and any unaligned
+ * input fall back to memcmp.
+ *
+ * @param a First buffer, typically the data that was programmed.
+ * @param b Second buffer, typically the memory-mapped flash it was programmed to.
+ * @param len Number of bytes to compare.
+ * @return true if the buffers are identical.
+ */
+bool flash_words_equal(const void *a, const void *b, size_t len) {
+    if (((uintptr_t)a | (uintptr_t)b) & (sizeof(uint32_t) - 1)) {
+        return memcmp(a, b, len) == 0;
+    }
+
+    const uint32_t *wa = (const uint32_t *)a;
+    const uint32_t *wb = (const uint32_t *)b;
+    size_t words = len / sizeof(uint32_t);
+    for (size_t i = 0; i < words; i++) {
+        if (wa[i] != wb[i]) {
+            return false;
+        }
+    }
+
+    size_t tail = words * sizeof(uint32_t);
+    return memcmp((const uint8_t *)a + tail, (const uint8_t *)b + tail, len - tail) == 0;
+}
+
+
+
+/**
+ * Checks a serialized header against its stored checksum, which covers the fields behind the
+ * state byte.
+ *
+ * @param raw The serialized header.
+ * @param header_crc The checksum stored in it.
+ * @return true if the header is intact.
+ */
+static bool header_crc_matches(const uint8_t *raw, uint32_t header_crc) {
+    size_t fields = FLASH_HEADER_SIZE - FLASH_HEADER_STATE_SIZE - sizeof(header_crc);
+    return crc32c(raw + FLASH_HEADER_STATE_SIZE, fields) == header_crc;
+}
+
+
+
+/**
+ * Parses the serialized metadata fields at the start of a sector without touching the payload.
+ * The layout mirrors serialize_flash_data, and the whole header is fetched from flash with a single
+ * copy. Fields that still hold the erased pattern are reported as zero so that a sector which has
+ * never been written looks empty rather than corrupt.
+ *
+ * @param flash_offset Absolute flash offset of the sector.
+ * @param stat Receives the parsed header.
+ * @return FLASH_OK, or FLASH_ERR_CRC if a programmed header fails its checksum.
+ */
+static flash_status_t read_flash_header(uint32_t flash_offset, flash_stat_t *stat) {
+    flash_data header;
+    uint8_t raw[FLASH_HEADER_SIZE];
+    memcpy(raw, (const void *)(XIP_BASE + flash_offset), sizeof(raw));
+
+    flash_header_decode(raw, &header);
+
+    // A byte of 0xFF means the header was never programmed after the last full erase.
+    stat->blank = (raw[0] == 0xFF);
+    stat->valid = header.valid;
+    stat->write_count = stat->blank ? 0 : header.write_count;
+    stat->data_len = stat->valid ? (uint32_t)header.data_len : 0;
+    stat->data_crc = stat->valid ? header.data_crc : 0;
+
+    // Every programmed header carries a checksum over the fields in front of it. A sector left in
+    // FLASH_STATE_WRITING by a power loss decodes as not valid, like any state but VALID.
+    if (!stat->blank && !header_crc_matches(raw, header.header_crc)) {
+        stat->valid = false;
+        stat->write_count = 0;
+        stat->data_len = 0;
+        return FLASH_ERR_CRC;
+    }
+    return FLASH_OK;
+}
+
+
+
+/**
+ * Retrieves every metadata field of a sector in one call. The offset is validated once, and the
+ * header is served from the in-RAM table when it is loaded; otherwise it is read from flash a
+ * single time, its write count brought up to date from the erase-count table, and recorded in the
+ * table for later queries.
+ *
+ * @param offset The offset from the start of the user flash region; must be sector aligned.
+ * @param stat Receives the header fields. On FLASH_ERR_CRC it describes a sector without valid
+ *             data and still carries the write count from the erase-count table.
+ * @return FLASH_OK on success, FLASH_ERR_CRC for a sector without an intact record header, or
+ *         the reason the sector could not be inspected.
+ */
+flash_status_t flash_stat(uint32_t offset, flash_stat_t *stat) {
+    if (stat == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+
+    // Ensure that the offset is aligned and the sector lies within the bounds of the flash memory.
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+
+    // Serve the header from RAM when possible; otherwise read it once and remember it. A sector
+    // without an intact header, such as a log or queue sector, is remembered as corrupt.
+    if (flash_cache_lookup(offset, stat, &status)) {
+        return status;
+    }
+    status = read_flash_header(flash_offset, stat);
+    if (status != FLASH_OK && status != FLASH_ERR_CRC) {
+        return status;
+    }
+
+    // An erase leaves no header behind, so the count may be newer in the erase-count table.
+    uint32_t erases = flash_erase_count_get(offset);
+    if (erases > stat->write_count) {
+        stat->write_count = erases;
+    }
+    if (status == FLASH_OK) {
+        flash_cache_store(offset, stat);
+    } else {
+        flash_cache_store_corrupt(offset, stat->write_count);
+    }
+    return status;
+}
+
+
+
+/**
+ * Parses a sector header exactly as it is stored in flash, bypassing both the header cache and
+ * the erase-count table. flash_stat is the right call almost everywhere; this one is for code
+ * that has to know what the header itself holds, such as the erase-count table deciding which
+ * counts are already kept in a header.
+ *
+ * @param offset The offset from the start of the user flash region; must be sector aligned.
+ * @param stat Receives the header fields.
+ * @return FLASH_OK, FLASH_ERR_CRC for a corrupt header, or an offset error.
+ */
+flash_status_t flash_read_header(uint32_t offset, flash_stat_t *stat) {
+    if (stat == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    return read_flash_header(flash_offset, stat);
+}
+
+
+
+/**
+ * Checks that a sector's header and payload match their stored CRC32C checksums. The payload is
+ * checksummed directly from memory-mapped flash with the slicing-by-8 kernel, so verifying every
+ * sector at boot costs a small fraction of a byte-wise pass. Sectors that are blank or hold no
+ * valid data pass as long as their header is intact.
+ *
+ * @param offset The offset from the start of the user flash region; must be sector aligned.
+ * @return FLASH_OK if the sector is intact, FLASH_ERR_CRC if it is corrupt, or an offset error.
+ */
+flash_status_t flash_verify_sector(uint32_t offset) {
+    flash_stat_t stat;
+    flash_status_t status = flash_stat(offset, &stat);
+    if (status != FLASH_OK || !stat.valid) {
+        return status;
+    }
+    if (stat.data_len > FLASH_SECTOR_SIZE - FLASH_HEADER_SIZE) {
+        return FLASH_ERR_CRC;
+    }
+
+    const uint8_t *payload = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset + FLASH_HEADER_SIZE);
+    return crc32c(payload, stat.data_len) == stat.data_crc ? FLASH_OK : FLASH_ERR_CRC;
+}
+
+
 
 /**
  * Retrieves the write count for a specific sector in the flash memory. This function checks
@@ -39,34 +293,24 @@
  * boundaries before accessing the flash data.
  *
  * @param offset The offset from the start of the flash memory for which to retrieve the write count.
- * @return The number of times the flash sector at the given offset has been written. Returns 0
- *         if there is an error due to misalignment or boundary overflow, or if the sector has not
- *         been written yet.
+ * @param write_count Receives the number of times the sector has been written; 0 if it never was.
+ * @return FLASH_OK on success, otherwise the reason the sector could not be inspected.
  */
-uint32_t get_flash_write_count(uint32_t offset) {
-    // Calculate the actual memory address within the flash memory where the write count is stored.
-    uint32_t flash_offset = FLASH_TARGET_OFFSET + offset;
-
-    // Ensure that the offset is aligned with the flash sector size to prevent reading from an incorrect sector.
-    if (flash_offset % FLASH_SECTOR_SIZE != 0) {
-        printf("Error: Invalid offset for getting the Write count. Please use a multiple of %d (sector size).\n", FLASH_SECTOR_SIZE);
-        return 0; // Return 0 as an error indicator due to misalignment.
+flash_status_t get_flash_write_count(uint32_t offset, uint32_t *write_count) {
+    if (write_count == NULL) {
+        return FLASH_ERR_NULL_DATA;
     }
 
-    // Check to ensure that the read operation stays within the bounds of the flash memory to avoid overflow errors.
-    if (flash_offset + METADATA_SIZE > FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Attempt to read for write count beyond flash memory limits.\n");
-        return 0; // Return 0 as an error indicator due to attempting to read beyond the flash memory limits.
+    flash_stat_t stat;
+    flash_status_t status = flash_stat(offset, &stat);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot get the write count at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
     }
 
-    // Define a temporary structure to store the data read from flash memory.
-    flash_data tempFlashData;
-
-    // Read the metadata from the specified offset within the flash memory.
-    memcpy(&tempFlashData, (const void *)(XIP_BASE + flash_offset), METADATA_SIZE);
-
     // Return the retrieved write count. This count helps in understanding the wear level of the flash sector.
-    return tempFlashData.write_count;
+    *write_count = stat.write_count;
+    return FLASH_OK;
 }
 
 
@@ -77,36 +321,24 @@ uint32_t get_flash_write_count(uint32_t offset) {
  * memory boundaries, crucial for accurate data retrieval and system stability.
  *
  * @param offset The offset from the start of the flash memory from which to retrieve the data length.
- * @return The length of the data stored at the given offset, in bytes. Returns 0 if there is an
- *         error due to misalignment, boundary issues, or if the sector has not been initialized.
+ * @param data_len Receives the length of the stored data in bytes; 0 for an erased sector.
+ * @return FLASH_OK on success, otherwise the reason the sector could not be inspected.
  */
-uint32_t get_flash_data_length(uint32_t offset) {
-    // Calculate the actual memory address in flash memory.
-    uint32_t flash_offset = FLASH_TARGET_OFFSET + offset;
-
-    // Ensure the offset is aligned with the flash sector size to avoid reading incomplete or incorrect data.
-    if (flash_offset % FLASH_SECTOR_SIZE != 0) {
-        printf("Error: Invalid offset for getting data length. Please use a multiple of %d (sector size).\n", FLASH_SECTOR_SIZE);
-        return 0; // Return 0 to indicate an error due to misalignment.
+flash_status_t get_flash_data_length(uint32_t offset, uint32_t *data_len) {
+    if (data_len == NULL) {
+        return FLASH_ERR_NULL_DATA;
     }
 
-    // Check that the memory address for reading is within the allowed flash memory bounds.
-    if (flash_offset + METADATA_SIZE > FLASH_TARGET_OFFSET + FLASH_SIZE) {
-        printf("Error: Attempt to read for data length beyond flash memory limits.\n");
-        return 0; // Return 0 to indicate an error due to reading beyond flash memory limits.
+    flash_stat_t stat;
+    flash_status_t status = flash_stat(offset, &stat);
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot get the data length at offset %u: %s\n", (unsigned)offset, flash_status_str(status));
+        return status;
     }
 
-    // Define a temporary structure to hold the flash data read from memory.
-    flash_data tempFlashData;
-
-    // Read the data from the specified flash memory offset.
-    memcpy(&tempFlashData, (const void *)(XIP_BASE + flash_offset), METADATA_SIZE);
-
-    // Output the data length for debugging and verification purposes.
-    printf("FLASH DATA LENGTH: %zu\n", tempFlashData.data_len);
-
     // Return the data length retrieved from the flash memory.
-    return tempFlashData.data_len;
+    *data_len = stat.data_len;
+    return FLASH_OK;
 }
 
 
@@ -119,35 +351,35 @@ uint32_t get_flash_data_length(uint32_t offset) {
  * @param data Pointer to the flash_data structure to be serialized.
  * @param buffer Buffer where serialized data will be stored.
  * @param buffer_size Size of the buffer provided for serialization.
+ * @return FLASH_OK, or FLASH_ERR_BUFFER_TOO_SMALL if the buffer cannot hold the serialized data.
  */
-void serialize_flash_data(const flash_data *data, uint8_t *buffer, size_t buffer_size) {
+flash_status_t serialize_flash_data(const flash_data *data, uint8_t *buffer, size_t buffer_size) {
     // Calculate the total size required for the serialized data including all metadata and actual data.
-    size_t required_size = sizeof(data->valid) + sizeof(data->write_count) + sizeof(data->data_len) + data->data_len;
+    size_t required_size = FLASH_HEADER_SIZE + data->data_len;
 
     // Check if the provided buffer is large enough to hold the serialized data.
     if (buffer_size < required_size) {
-        printf("Buffer size is too small to serialize flash_data. Required: %zu, Given: %zu\n", required_size, buffer_size);
-        return;  // Exit the function if the buffer does not have sufficient space to avoid buffer overflow.
+        FLASH_LOG("Buffer size is too small to serialize flash_data. Required: %zu, Given: %zu\n", required_size, buffer_size);
+        return FLASH_ERR_BUFFER_TOO_SMALL;  // Refuse to serialize rather than overflow the buffer.
     }
 
-    // Serialize the 'valid' field - this indicates whether the data is considered valid.
-    memcpy(buffer, &data->valid, sizeof(data->valid));
-    buffer += sizeof(data->valid);  // Move the buffer pointer forward by the size of the 'valid' field.
-
-    // Serialize the 'write_count' field - this tracks how many times the data has been written.
-    memcpy(buffer, &data->write_count, sizeof(data->write_count));
-    buffer += sizeof(data->write_count);  // Move the buffer pointer forward by the size of the 'write_count' field.
-
-    // Serialize the 'data_len' field - this specifies the length of the data.
-    memcpy(buffer, &data->data_len, sizeof(data->data_len));
-    buffer += sizeof(data->data_len);  // Move the buffer pointer forward by the size of the 'data_len' field.
+    // Checksum the payload, then the header fields in front of the header checksum, so both can be
+    // verified on read. The checksums stored in 'data' are ignored; they always describe what is
+    // written here.
+    flash_data header = *data;
+    header.data_crc = (data->data_ptr != NULL) ? crc32c(data->data_ptr, data->data_len) : crc32c(NULL, 0);
+    header.header_crc = 0;
+    flash_header_encode(&header, buffer);
+    header.header_crc = crc32c(buffer + FLASH_HEADER_STATE_SIZE, FLASH_HEADER_SIZE - FLASH_HEADER_STATE_SIZE - sizeof(header.header_crc));
+    schema_put_u32(buffer + FLASH_HEADER_SIZE - sizeof(header.header_crc), header.header_crc);
+    buffer += FLASH_HEADER_SIZE;
 
     // Serialize the actual data pointed by 'data_ptr', if it exists and has a non-zero length.
+    // A header without payload (as earlier versions of flash_erase_safe wrote) is valid and simply stops here.
     if (data->data_ptr != NULL && data->data_len > 0) {
         memcpy(buffer, data->data_ptr, data->data_len);  // Copy the actual data into the buffer.
-    } else {
-        printf("Data pointer is NULL or data length is zero, nothing to serialize for actual data.\n");
     }
+    return FLASH_OK;
 }
 
 
@@ -160,32 +392,48 @@ void serialize_flash_data(const flash_data *data, uint8_t *buffer, size_t buffer
  *
  * @param buffer Pointer to the buffer containing serialized flash data.
  * @param data Pointer to the flash_data structure where the deserialized data will be stored.
+ *             On success data_ptr is heap allocated and must be released with free().
+ * @return FLASH_OK, FLASH_ERR_CRC if the header or payload fails its checksum,
+ *         FLASH_ERR_INVALID_DATA if the stored length is impossible for one sector,
+ *         or FLASH_ERR_NO_MEMORY if the payload copy could not be allocated.
  */
-void deserialize_flash_data(const uint8_t *buffer, flash_data *data) {
-    // Announce the start of the deserialization process for debugging purposes.
-    printf("Entering deserialize_flash_data\n");
-
-    // Copy the 'valid' field from the buffer to the structure. This field indicates data validity.
-    memcpy(&data->valid, buffer, sizeof(data->valid));
-    buffer += sizeof(data->valid);  // Advance the buffer pointer to the next piece of data.
+flash_status_t deserialize_flash_data(const uint8_t *buffer, flash_data *data) {
+    // Decode the header fields. 'valid' is true only for a stored 1, so an erased header (0xFF)
+    // reads as invalid.
+    flash_header_decode(buffer, data);
+    buffer += FLASH_HEADER_SIZE;  // Move the buffer pointer to the start of the actual data.
+
+    // There is no payload to copy for invalid or erased data.
+    data->data_ptr = NULL;
+    if (!data->valid) {
+        return FLASH_OK;
+    }
 
-    // Copy the 'write_count' field, which tracks the number of times the data has been written.
-    memcpy(&data->write_count, buffer, sizeof(data->write_count));
-    buffer += sizeof(data->write_count);  // Advance the buffer pointer.
+    // The header must match its checksum before any of its fields are trusted.
+    if (!header_crc_matches(buffer - FLASH_HEADER_SIZE, data->header_crc)) {
+        return FLASH_ERR_CRC;
+    }
 
-    // Copy the 'data_len' field, indicating the length of the data.
-    memcpy(&data->data_len, buffer, sizeof(data->data_len));
-    buffer += sizeof(data->data_len);  // Move the buffer pointer to the start of the actual data.
+    // A length that cannot fit in one sector means the metadata itself is corrupt.
+    if (data->data_len > FLASH_SECTOR_SIZE - METADATA_SIZE) {
+        return FLASH_ERR_INVALID_DATA;
+    }
 
     // Allocate memory for the data pointed by 'data_ptr' based on the length provided in 'data_len'.
     data->data_ptr = malloc(data->data_len);
     if (data->data_ptr == NULL) {
-        printf("Failed to allocate memory for data_ptr.\n");
-        return;  // Exit if memory allocation fails, to prevent further errors.
+        FLASH_LOG("Failed to allocate memory for data_ptr.\n");
+        return FLASH_ERR_NO_MEMORY;  // Exit if memory allocation fails, to prevent further errors.
     }
 
-    // Copy the actual data into the newly allocated memory.
+    // Copy the actual data into the newly allocated memory and check it against its checksum.
     memcpy(data->data_ptr, buffer, data->data_len);
+    if (crc32c(data->data_ptr, data->data_len) != data->data_crc) {
+        free(data->data_ptr);
+        data->data_ptr = NULL;
+        return FLASH_ERR_CRC;
+    }
+    return FLASH_OK;
 }
 
 
@@ -202,17 +450,8 @@ void deserialize_flash_data(const uint8_t *buffer, flash_data *data) {
  * @param config Pointer to the DeviceConfig structure where the deserialized data will be stored.
  */
 void deserialize_device_config(const uint8_t *buffer, DeviceConfig *config) {
-    // Copy the device ID from the buffer into the structure. This is typically a unique identifier.
-    memcpy(&config->id, buffer, sizeof(config->id));
-    buffer += sizeof(config->id);  // Move the buffer pointer past the ID field.
-
-    // Copy the sensor value, which may represent a measurement or status from a device sensor.
-    memcpy(&config->sensor_value, buffer, sizeof(config->sensor_value));
-    buffer += sizeof(config->sensor_value);  // Move the buffer pointer past the sensor value field.
-
-    // Copy the device name, which is stored as a fixed-length string.
-    memcpy(config->name, buffer, sizeof(config->name));
-    // The buffer pointer is moved past the name field automatically by the size of the name.
+    // The field list in DEVICE_CONFIG_SCHEMA defines the layout; see schema.h.
+    device_config_decode(buffer, config);
 }
 
 
@@ -220,6 +459,25 @@ void deserialize_device_config(const uint8_t *buffer, DeviceConfig *config) {
  
 
 
+/**
+ * Layouts DeviceConfig has been stored in. When a field is added, DEVICE_CONFIG_SCHEMA describes
+ * the new layout, the previous list and codec are kept under a versioned name, and an entry with
+ * an upgrade function filling in the new field goes in front of the current one.
+ */
+static const flash_record_version_t device_config_versions[] = {
+    { .version = 1, .encoded_size = DEVICE_CONFIG_SIZE, .struct_size = sizeof(DeviceConfig),
+      .decode = device_config_decode_any, .upgrade = NULL },
+};
+
+const flash_record_schema_t device_config_record = {
+    .versions = device_config_versions,
+    .version_count = sizeof(device_config_versions) / sizeof(device_config_versions[0]),
+    .encode = device_config_encode_any,
+};
+
+
+
+
 /**
  * Serializes a DeviceConfig structure into a byte array. This function converts the structured data
  * from a DeviceConfig structure into a linear byte sequence for easy storage or transmission.
@@ -228,17 +486,8 @@ void deserialize_device_config(const uint8_t *buffer, DeviceConfig *config) {
  * @param buffer Pointer to the buffer where the serialized data will be stored.
  */
 void serialize_device_config(const DeviceConfig *config, uint8_t *buffer) {
-    // Copy the device ID into the buffer. This is usually a numeric identifier.
-    memcpy(buffer, &config->id, sizeof(config->id));
-    buffer += sizeof(config->id);  // Advance the buffer pointer to the next write position.
-
-    // Copy the sensor value, which could represent any data measured by the device's sensors.
-    memcpy(buffer, &config->sensor_value, sizeof(config->sensor_value));
-    buffer += sizeof(config->sensor_value);  // Advance the buffer pointer.
-
-    // Copy the device name, a character array, into the buffer.
-    memcpy(buffer, config->name, sizeof(config->name));
-    // No need to move the buffer pointer after this as it's typically the last item in the structure.
+    // The field list in DEVICE_CONFIG_SCHEMA defines the layout, DEVICE_CONFIG_SIZE bytes in all.
+    device_config_encode(config, buffer);
 }
 
 
@@ -275,23 +524,21 @@ uint8_t* prepare_buffer(const char* text, size_t *buffer_size) {
 
  
 /**
- * Verifies that two data buffers are identical by comparing their content byte-by-byte.
+ * Verifies that two data buffers are identical using the word-wide comparison of flash_words_equal.
  * This function is useful for ensuring data integrity, particularly after data transmission
  * or storage operations, where it confirms that data has not been altered or corrupted.
  *
  * @param original Pointer to the buffer containing the original data.
  * @param read_back Pointer to the buffer containing the data to compare against the original.
  * @param size The number of bytes to compare in both data buffers.
+ * @return true if the buffers match.
  */
-void verify_data(const uint8_t* original, const uint8_t* read_back, size_t size) {
-    // Compare the original data buffer to the read-back data buffer.
-    if (memcmp(original, read_back, size) == 0) {
-        // If the content of the buffers is identical, print a success message.
-        // Note: Using `%s` to print `read_back` assumes it is null-terminated and contains text data.
-        // If `read_back` may contain non-text data or may not be null-terminated, this could lead to undefined behavior.
-        printf("Data verified successfully: %s\n", read_back);
-    } else {
-        // If the buffers differ, print a failure message indicating verification failed.
-        printf("Data verification failed!\n");
+bool verify_data(const uint8_t* original, const uint8_t* read_back, size_t size) {
+    // The buffers may hold arbitrary binary data, so only the outcome is reported.
+    if (flash_words_equal(original, read_back, size)) {
+        FLASH_LOG("Data verified successfully (%zu bytes).\n", size);
+        return true;
     }
+    FLASH_LOG("Data verification failed!\n");
+    return false;
 }
@@ -14,6 +14,20 @@
 #include <stddef.h>
 #include <stdbool.h>  // Include this header for bool type
 #include "flash_ops.h"
+#include "flash_geometry.h"
+#include "schema.h"
+#include "flash_record.h"
+
+/**
+ * Diagnostic output used by the flash library. Building with FLASH_OPS_NO_STDIO compiles every
+ * message out, leaving the returned flash_status_t as the only error channel.
+ */
+#ifdef FLASH_OPS_NO_STDIO
+#define FLASH_LOG(...) ((void)0)
+#else
+#include <stdio.h>
+#define FLASH_LOG(...) printf(__VA_ARGS__)
+#endif
 
 // test structure
 typedef struct {
@@ -22,12 +36,56 @@ typedef struct {
     char name[10];
 } DeviceConfig;
 
+// Stored layout of DeviceConfig; see schema.h.
+#define DEVICE_CONFIG_SCHEMA(FIELD, BYTES) \
+    FIELD(id, u32)                          \
+    FIELD(sensor_value, f32)                \
+    BYTES(name, 10)
+
+SCHEMA_CODEC(device_config, DeviceConfig, DEVICE_CONFIG_SCHEMA, DEVICE_CONFIG_SIZE, 18)
+
+// Every stored layout of DeviceConfig, for flash_record_read and flash_record_write.
+extern const flash_record_schema_t device_config_record;
+
 
 
  
+// Stored layout of the metadata that serialize_flash_data places in front of the payload. The
+// first byte is the sector state (see flash_sector_state_t); 'valid' is stored there as
+// FLASH_STATE_VALID or FLASH_STATE_OBSOLETE. The header checksum must stay last: it covers every
+// byte between the state byte and itself, so the state can move on without rewriting it. data_len
+// is stored in 32 bits whatever the width of size_t, which keeps the layout the same on the host
+// and on the device.
+#define FLASH_HEADER_SCHEMA(FIELD, BYTES) \
+    FIELD(valid, bool)                     \
+    FIELD(write_count, u32)                \
+    FIELD(data_len, u32)                   \
+    FIELD(data_crc, u32)                   \
+    FIELD(header_crc, u32)
+
+SCHEMA_CODEC(flash_header, flash_data, FLASH_HEADER_SCHEMA, FLASH_HEADER_SIZE, 17)
+
+// The state byte in front of the checksummed header fields.
+#define FLASH_HEADER_STATE_SIZE 1
+
+// Bytes of every sector set aside for metadata, the serialized header; a payload may use the rest.
+#define METADATA_SIZE FLASH_HEADER_SIZE
+
+// Validates a sector offset and converts it to an absolute flash offset.
+flash_status_t flash_check_sector(uint32_t offset, uint32_t *flash_offset);
+
+// Parses a sector header from flash as stored, without the header cache or the erase-count table.
+flash_status_t flash_read_header(uint32_t offset, flash_stat_t *stat);
+
+// Programs bytes at any absolute flash offset without erasing; bits can only go from 1 to 0.
+flash_status_t flash_program_partial(uint32_t flash_offset, const uint8_t *data, size_t len);
+
+// Compares two buffers a 32-bit word at a time when both are word aligned.
+bool flash_words_equal(const void *a, const void *b, size_t len);
+
 // Utility functions to get additional information from flash memory.
-uint32_t get_flash_write_count(uint32_t offset); // Retrieves the write count for a specified offset.
-uint32_t get_flash_data_length(uint32_t offset); // Retrieves the length of data stored at a specified offset.
+flash_status_t get_flash_write_count(uint32_t offset, uint32_t *write_count); // Retrieves the write count for a specified offset.
+flash_status_t get_flash_data_length(uint32_t offset, uint32_t *data_len); // Retrieves the length of data stored at a specified offset.
 
 
 
@@ -35,8 +93,12 @@ void serialize_device_config(const DeviceConfig *config, uint8_t *buffer);
 void deserialize_device_config(const uint8_t *buffer, DeviceConfig *config);
 
 
-void serialize_flash_data(const flash_data *data, uint8_t *buffer, size_t buffer_size);
-void deserialize_flash_data(const uint8_t *buffer, flash_data *data);
+flash_status_t serialize_flash_data(const flash_data *data, uint8_t *buffer, size_t buffer_size);
+flash_status_t deserialize_flash_data(const uint8_t *buffer, flash_data *data);
+
+
+uint8_t* prepare_buffer(const char* text, size_t *buffer_size);
+bool verify_data(const uint8_t* original, const uint8_t* read_back, size_t size);
 
 
 #endif // FLASH_OPS_H
@@ -0,0 +1,677 @@
+/**
+ * @file flash_partition.c
+ *
+ * Implementation of the partitions declared in flash_partition.h. The table itself is the
+ * application's constant array; only a pointer to it is kept. A KV value is stored as the payload
+ * of a flash_write_safe record, behind its key and a sequence number that increases with every
+ * put to the partition. When a power loss leaves two copies of a key, the higher sequence number
+ * is the newer one and the older copy is marked obsolete by the next mount.
+ */
+
+#include "flash_partition.h"
+#include <stdlib.h>
+#include <string.h>
+#include "flash_ops_helper.h"
+#include "flash_cache.h"
+#include "flash_bbt.h"
+#include "crc32c.h"
+#include "hardware/flash.h"
+
+#define KV_WRITE_RETRIES 3 // As flash_write_alloc: sectors tried before giving up on a verify failure.
+
+#define CHECKPOINT_MAGIC 0x50434B56u // "VKCP"
+#define CHECKPOINT_HEADER 20         // magic | generation | first offset | sectors (2) | keys (2) | next sequence
+#define CHECKPOINT_KEY_SIZE 10       // key (2) | offset (4) | sequence (4)
+#define CHECKPOINT_SECTOR_SIZE 11    // flags (1) | write count (4) | data length (2) | data CRC (4)
+#define CHECKPOINT_MAX_PAYLOAD (CHECKPOINT_HEADER + FLASH_KV_MAX_KEYS * CHECKPOINT_KEY_SIZE + \
+                                FLASH_KV_CHECKPOINT_MAX_SECTORS * CHECKPOINT_SECTOR_SIZE)
+
+// Flags of a sector header in a checkpoint.
+#define SECTOR_VALID (1u << 0)
+#define SECTOR_BLANK (1u << 1)
+#define SECTOR_UNKNOWN (1u << 2) // The header could not be read; it is not seeded into the table.
+
+#define JOURNAL_PUT 1
+#define JOURNAL_DELETE 2
+
+SCHEMA_STATIC_ASSERT(METADATA_SIZE + CHECKPOINT_MAX_PAYLOAD <= FLASH_KV_JOURNAL_START,
+                     "a checkpoint must end before its journal starts");
+
+static const flash_partition_t *partition_table;
+static size_t partition_count;
+
+/**
+ * Checks a partition table and makes it the one flash_partition_find searches. Every partition
+ * must be sector aligned, lie within the user region, not overlap another and have a unique
+ * name; KV, blob and log partitions need at least two sectors.
+ *
+ * @param table The partitions; the array is used in place and must outlive its use.
+ * @param count Number of partitions, at most FLASH_PARTITION_MAX.
+ * @return FLASH_OK, FLASH_ERR_ALIGNMENT or FLASH_ERR_OUT_OF_BOUNDS for a partition outside the
+ *         user region, or FLASH_ERR_INVALID_DATA for an inconsistent table. The installed table is
+ *         left unchanged on error.
+ */
+flash_status_t flash_partition_table_set(const flash_partition_t *table, size_t count) {
+    if (table == NULL && count > 0) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (count > FLASH_PARTITION_MAX) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const flash_partition_t *p = &table[i];
+        if ((p->first_offset & FLASH_SECTOR_MASK) != 0) {
+            return FLASH_ERR_ALIGNMENT;
+        }
+        if (p->sectors == 0 || p->sectors > FLASH_USER_SECTORS ||
+            p->first_offset / FLASH_SECTOR_SIZE > FLASH_USER_SECTORS - p->sectors) {
+            return FLASH_ERR_OUT_OF_BOUNDS;
+        }
+        if (p->name == NULL || (p->policy != FLASH_PARTITION_RAW && p->sectors < 2)) {
+            return FLASH_ERR_INVALID_DATA;
+        }
+        for (size_t j = 0; j < i; j++) {
+            const flash_partition_t *q = &table[j];
+            uint32_t p_end = p->first_offset + p->sectors * FLASH_SECTOR_SIZE;
+            uint32_t q_end = q->first_offset + q->sectors * FLASH_SECTOR_SIZE;
+            if ((p->first_offset < q_end && q->first_offset < p_end) || strcmp(p->name, q->name) == 0) {
+                return FLASH_ERR_INVALID_DATA;
+            }
+        }
+    }
+
+    partition_table = table;
+    partition_count = count;
+    return FLASH_OK;
+}
+
+const flash_partition_t *flash_partition_find(const char *name) {
+    for (size_t i = 0; name != NULL && i < partition_count; i++) {
+        if (strcmp(partition_table[i].name, name) == 0) {
+            return &partition_table[i];
+        }
+    }
+    return NULL;
+}
+
+flash_status_t flash_partition_sector(const flash_partition_t *partition, uint32_t index, uint32_t *offset) {
+    if (partition == NULL || offset == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (index >= partition->sectors) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+    *offset = partition->first_offset + index * FLASH_SECTOR_SIZE;
+    return FLASH_OK;
+}
+
+/**
+ * Picks the least-worn free sector of a RAW partition, for use with flash_write_safe. Partitions
+ * of the other policies allocate their own sectors and are refused.
+ *
+ * @param partition A RAW partition.
+ * @param offset Receives the sector offset relative to the start of the user region.
+ * @return FLASH_OK, FLASH_ERR_NO_SPACE, or FLASH_ERR_INVALID_DATA for a partition of another policy.
+ */
+flash_status_t flash_partition_alloc(const flash_partition_t *partition, uint32_t *offset) {
+    if (partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (partition->policy != FLASH_PARTITION_RAW) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    return flash_alloc_sector_in(partition->first_offset, partition->sectors, offset);
+}
+
+flash_status_t flash_partition_log_open(const flash_partition_t *partition, flash_log_t *log, size_t record_size) {
+    if (partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (partition->policy != FLASH_PARTITION_LOG) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    return flash_log_open(log, partition->first_offset, partition->sectors, record_size);
+}
+
+/**
+ * Position of `key` in the index, or -1.
+ */
+static int kv_find(const flash_kv_t *kv, uint16_t key) {
+    for (uint16_t i = 0; i < kv->count; i++) {
+        if (kv->keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Whether `a` was put after `b`; sequence numbers are compared modulo 2^32.
+ */
+static bool seq_newer(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/**
+ * Builds the index of a KV or blob partition in one go; the same as flash_kv_mount_lazy followed
+ * by a flash_kv_mount_step covering every sector.
+ *
+ * @param kv Receives the index.
+ * @param partition A KV or blob partition.
+ * @return As flash_kv_mount_step, or FLASH_ERR_INVALID_DATA for a partition of another policy.
+ */
+flash_status_t flash_kv_mount(flash_kv_t *kv, const flash_partition_t *partition) {
+    flash_status_t status = flash_kv_mount_lazy(kv, partition);
+    return status == FLASH_OK ? flash_kv_mount_step(kv, 0) : status;
+}
+
+/**
+ * Attaches an empty index to a partition without reading flash, so it costs the same whatever
+ * the partition holds. The index is filled by flash_kv_mount_step, or completed by the first
+ * operation on the partition.
+ *
+ * @param kv Receives the index.
+ * @param partition A KV or blob partition.
+ * @return FLASH_OK, or FLASH_ERR_INVALID_DATA for a partition of another policy.
+ */
+flash_status_t flash_kv_mount_lazy(flash_kv_t *kv, const flash_partition_t *partition) {
+    if (kv == NULL || partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (partition->policy != FLASH_PARTITION_KV && partition->policy != FLASH_PARTITION_BLOB) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    memset(kv, 0, sizeof(*kv));
+    kv->partition = partition;
+    kv->mount_status = FLASH_OK;
+    return FLASH_OK;
+}
+
+/**
+ * Adds the next sectors of the partition to the index, at the cost of one header and six payload
+ * bytes each. Where a power loss between writing a new value and erasing the old one left two
+ * copies of a key, the older copy is marked obsolete as soon as both have been seen. Sectors holding
+ * anything other than a KV record are ignored.
+ *
+ * @param kv An index prepared by flash_kv_mount_lazy.
+ * @param max_sectors Upper bound on the sectors indexed by this call; 0 indexes all that remain.
+ * @return FLASH_OK, or FLASH_ERR_NO_SPACE once the partition turned out to hold more than
+ *         FLASH_KV_MAX_KEYS keys; the index then holds the first FLASH_KV_MAX_KEYS of them.
+ */
+flash_status_t flash_kv_mount_step(flash_kv_t *kv, uint32_t max_sectors) {
+    if (kv == NULL || kv->partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    const flash_partition_t *partition = kv->partition;
+    uint32_t end = partition->sectors;
+    if (max_sectors != 0 && end - kv->scanned > max_sectors) {
+        end = kv->scanned + max_sectors;
+    }
+
+    for (; kv->scanned < end; kv->scanned++) {
+        uint32_t offset = partition->first_offset + kv->scanned * FLASH_SECTOR_SIZE;
+        flash_stat_t stat;
+        if (flash_stat(offset, &stat) != FLASH_OK || !stat.valid || stat.data_len < FLASH_KV_RECORD_HEADER) {
+            continue;
+        }
+        const uint8_t *record = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset + FLASH_HEADER_SIZE);
+        uint16_t key = schema_get_u16(record);
+        uint32_t seq = schema_get_u32(record + 2);
+        if (partition->policy == FLASH_PARTITION_BLOB && key != FLASH_BLOB_KEY) {
+            continue;
+        }
+        if (!kv->seq_known || seq_newer(seq + 1, kv->next_seq)) {
+            kv->next_seq = seq + 1;
+            kv->seq_known = true;
+        }
+
+        int slot = kv_find(kv, key);
+        if (slot < 0) {
+            if (kv->count == FLASH_KV_MAX_KEYS) {
+                kv->mount_status = FLASH_ERR_NO_SPACE;
+                continue;
+            }
+            slot = kv->count++;
+        } else if (seq_newer(seq, kv->seqs[slot])) {
+            flash_mark_obsolete(kv->offsets[slot]);
+        } else {
+            flash_mark_obsolete(offset);
+            continue;
+        }
+        kv->keys[slot] = key;
+        kv->offsets[slot] = offset;
+        kv->seqs[slot] = seq;
+    }
+    return kv->mount_status;
+}
+
+bool flash_kv_mounted(const flash_kv_t *kv) {
+    return kv != NULL && kv->partition != NULL && kv->scanned == kv->partition->sectors;
+}
+
+/**
+ * Completes a lazy mount before the index is used; a key can only be trusted to be absent, or
+ * its newest copy found, once every sector has been seen.
+ */
+static void kv_complete(flash_kv_t *kv) {
+    if (!flash_kv_mounted(kv)) {
+        flash_kv_mount_step(kv, 0);
+    }
+}
+
+/**
+ * Appends an entry to the journal of a checkpointed partition, writing a new checkpoint first
+ * when the journal is full. Partitions without a checkpoint area have no journal.
+ */
+static flash_status_t kv_journal(flash_kv_t *kv, uint8_t op, uint16_t key, uint32_t offset, uint32_t seq) {
+    if (kv->checkpoint == NULL) {
+        return FLASH_OK;
+    }
+    if (kv->journal_next == FLASH_KV_JOURNAL_ENTRIES) {
+        flash_status_t status = flash_kv_checkpoint(kv);
+        if (status != FLASH_OK) {
+            return status;
+        }
+    }
+
+    uint8_t entry[FLASH_KV_JOURNAL_ENTRY];
+    schema_put_u32(entry, seq);
+    schema_put_u32(entry + 4, offset);
+    schema_put_u16(entry + 8, key);
+    entry[10] = op;
+    entry[11] = 0;
+    schema_put_u32(entry + 12, crc32c(entry, 12));
+
+    uint32_t sector = kv->checkpoint->first_offset + kv->checkpoint_slot * FLASH_SECTOR_SIZE;
+    flash_status_t status = flash_program_partial(FLASH_TARGET_OFFSET + sector + FLASH_KV_JOURNAL_START +
+                                                  kv->journal_next * FLASH_KV_JOURNAL_ENTRY, entry, sizeof(entry));
+    if (status == FLASH_OK) {
+        kv->journal_next++;
+    }
+    return status;
+}
+
+/**
+ * Writes a KV record to a free sector of the partition. Without a checkpoint this is
+ * flash_write_alloc_in. With one, the sector is chosen first and journalled before it is
+ * programmed and verified, so that replaying the journal only has to look at the sectors it
+ * names; a journalled sector that failed verification is retired and never holds the value.
+ */
+static flash_status_t kv_store(flash_kv_t *kv, uint16_t key, const uint8_t *record, size_t len, uint32_t *offset) {
+    const flash_partition_t *p = kv->partition;
+    if (kv->checkpoint == NULL) {
+        return flash_write_alloc_in(p->first_offset, p->sectors, record, len, offset);
+    }
+
+    flash_status_t status = FLASH_ERR_VERIFY;
+    for (int attempt = 0; attempt < KV_WRITE_RETRIES && status == FLASH_ERR_VERIFY; attempt++) {
+        status = flash_alloc_sector_in(p->first_offset, p->sectors, offset);
+        if (status == FLASH_OK) {
+            status = kv_journal(kv, JOURNAL_PUT, key, *offset, kv->next_seq);
+        }
+        // A sector that does not read back is retired, so the next attempt journals another one.
+        if (status == FLASH_OK) {
+            status = flash_write_verified(*offset, record, len);
+        }
+    }
+    return status;
+}
+
+/**
+ * Writes a value to the least-worn free sector of the partition, verified, then marks the
+ * sector holding the key's previous value obsolete. A power loss in between leaves both copies,
+ * which flash_kv_mount resolves in favour of the new one.
+ *
+ * @param kv A mounted partition.
+ * @param key The key; a blob partition accepts FLASH_BLOB_KEY only.
+ * @param value The value.
+ * @param len Length of the value, 1 to FLASH_KV_MAX_VALUE bytes.
+ * @return FLASH_OK, FLASH_ERR_NO_SPACE if the partition has no free sector or the index is full,
+ *         or the error from writing the value.
+ */
+flash_status_t flash_kv_put(flash_kv_t *kv, uint16_t key, const void *value, size_t len) {
+    if (kv == NULL || kv->partition == NULL || value == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (len == 0) {
+        return FLASH_ERR_ZERO_LENGTH;
+    }
+    if (len > FLASH_KV_MAX_VALUE) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+    if (kv->partition->policy == FLASH_PARTITION_BLOB && key != FLASH_BLOB_KEY) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+    kv_complete(kv);
+    int slot = kv_find(kv, key);
+    if (slot < 0 && kv->count == FLASH_KV_MAX_KEYS) {
+        return FLASH_ERR_NO_SPACE;
+    }
+
+    uint8_t *record = malloc(FLASH_KV_RECORD_HEADER + len);
+    if (record == NULL) {
+        return FLASH_ERR_NO_MEMORY;
+    }
+    schema_put_u16(record, key);
+    schema_put_u32(record + 2, kv->next_seq);
+    memcpy(record + FLASH_KV_RECORD_HEADER, value, len);
+
+    uint32_t offset;
+    flash_status_t status = kv_store(kv, key, record, FLASH_KV_RECORD_HEADER + len, &offset);
+    free(record);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (slot < 0) {
+        slot = kv->count++;
+        kv->keys[slot] = key;
+    } else {
+        flash_mark_obsolete(kv->offsets[slot]);
+    }
+    kv->offsets[slot] = offset;
+    kv->seqs[slot] = kv->next_seq++;
+    return FLASH_OK;
+}
+
+/**
+ * Copies a value straight from XIP flash after checking the record's payload checksum.
+ *
+ * @param kv A mounted partition.
+ * @param key The key.
+ * @param value Receives the value.
+ * @param len Size of `value`.
+ * @param value_len Optional; receives the length of the value.
+ * @return FLASH_OK, FLASH_ERR_INVALID_DATA if the key has no value, FLASH_ERR_BUFFER_TOO_SMALL,
+ *         or FLASH_ERR_CRC.
+ */
+flash_status_t flash_kv_get(flash_kv_t *kv, uint16_t key, void *value, size_t len, size_t *value_len) {
+    if (kv == NULL || kv->partition == NULL || value == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    kv_complete(kv);
+    int slot = kv_find(kv, key);
+    if (slot < 0) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    flash_stat_t stat;
+    flash_status_t status = flash_stat(kv->offsets[slot], &stat);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (!stat.valid || stat.data_len < FLASH_KV_RECORD_HEADER || stat.data_len > FLASH_SECTOR_SIZE - METADATA_SIZE) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    size_t stored = stat.data_len - FLASH_KV_RECORD_HEADER;
+    if (len < stored) {
+        return FLASH_ERR_BUFFER_TOO_SMALL;
+    }
+
+    const uint8_t *record = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + kv->offsets[slot] + FLASH_HEADER_SIZE);
+    if (crc32c(record, stat.data_len) != stat.data_crc) {
+        return FLASH_ERR_CRC;
+    }
+    memcpy(value, record + FLASH_KV_RECORD_HEADER, stored);
+    if (value_len != NULL) {
+        *value_len = stored;
+    }
+    return FLASH_OK;
+}
+
+flash_status_t flash_kv_delete(flash_kv_t *kv, uint16_t key) {
+    if (kv == NULL || kv->partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    kv_complete(kv);
+    int slot = kv_find(kv, key);
+    if (slot < 0) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    flash_status_t status = kv_journal(kv, JOURNAL_DELETE, key, kv->offsets[slot], kv->next_seq);
+    if (status == FLASH_OK) {
+        status = flash_mark_obsolete(kv->offsets[slot]);
+    }
+    if (status != FLASH_OK) {
+        return status;
+    }
+    kv->count--;
+    kv->keys[slot] = kv->keys[kv->count];
+    kv->offsets[slot] = kv->offsets[kv->count];
+    kv->seqs[slot] = kv->seqs[kv->count];
+    return FLASH_OK;
+}
+
+/**
+ * Writes a checkpoint of the index and of every sector header of the partition to the
+ * checkpoint sector not holding the newest one, then makes it the newest with an empty journal.
+ * Until it is complete the previous checkpoint and its journal stay intact.
+ *
+ * @param kv A partition mounted with flash_kv_mount_checkpoint.
+ * @return FLASH_OK, FLASH_ERR_INVALID_DATA if the partition has no checkpoint area, or the error
+ *         writing the checkpoint.
+ */
+flash_status_t flash_kv_checkpoint(flash_kv_t *kv) {
+    if (kv == NULL || kv->partition == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (kv->checkpoint == NULL) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    kv_complete(kv);
+
+    const flash_partition_t *p = kv->partition;
+    uint8_t *payload = malloc(CHECKPOINT_MAX_PAYLOAD);
+    if (payload == NULL) {
+        return FLASH_ERR_NO_MEMORY;
+    }
+    uint32_t generation = kv->generation + 1;
+    schema_put_u32(payload, CHECKPOINT_MAGIC);
+    schema_put_u32(payload + 4, generation);
+    schema_put_u32(payload + 8, p->first_offset);
+    schema_put_u16(payload + 12, (uint16_t)p->sectors);
+    schema_put_u16(payload + 14, kv->count);
+    schema_put_u32(payload + 16, kv->next_seq);
+    uint8_t *out = payload + CHECKPOINT_HEADER;
+    for (uint16_t i = 0; i < kv->count; i++, out += CHECKPOINT_KEY_SIZE) {
+        schema_put_u16(out, kv->keys[i]);
+        schema_put_u32(out + 2, kv->offsets[i]);
+        schema_put_u32(out + 6, kv->seqs[i]);
+    }
+    for (uint32_t i = 0; i < p->sectors; i++, out += CHECKPOINT_SECTOR_SIZE) {
+        flash_stat_t stat = { 0 };
+        bool known = flash_stat(p->first_offset + i * FLASH_SECTOR_SIZE, &stat) == FLASH_OK;
+        out[0] = !known ? SECTOR_UNKNOWN : (stat.valid ? SECTOR_VALID : 0) | (stat.blank ? SECTOR_BLANK : 0);
+        schema_put_u32(out + 1, stat.write_count);
+        schema_put_u16(out + 5, (uint16_t)stat.data_len);
+        schema_put_u32(out + 7, stat.data_crc);
+    }
+
+    uint8_t slot = kv->generation == 0 ? 0 : 1 - kv->checkpoint_slot;
+    flash_status_t status = flash_write_safe(kv->checkpoint->first_offset + slot * FLASH_SECTOR_SIZE,
+                                             payload, (size_t)(out - payload));
+    free(payload);
+    if (status == FLASH_OK) {
+        kv->generation = generation;
+        kv->checkpoint_slot = slot;
+        kv->journal_next = 0;
+    }
+    return status;
+}
+
+/**
+ * The checkpoint stored in one sector of the area, in place in XIP flash, if it is intact and
+ * describes `partition`.
+ */
+static const uint8_t *checkpoint_load(uint32_t offset, const flash_partition_t *partition) {
+    flash_stat_t stat;
+    if (flash_stat(offset, &stat) != FLASH_OK || !stat.valid || stat.data_len < CHECKPOINT_HEADER ||
+        flash_verify_sector(offset) != FLASH_OK) {
+        return NULL;
+    }
+    const uint8_t *payload = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset + FLASH_HEADER_SIZE);
+    uint16_t keys = schema_get_u16(payload + 14);
+    bool matches = schema_get_u32(payload) == CHECKPOINT_MAGIC && schema_get_u32(payload + 8) == partition->first_offset &&
+                   schema_get_u16(payload + 12) == partition->sectors && keys <= FLASH_KV_MAX_KEYS &&
+                   stat.data_len == CHECKPOINT_HEADER + keys * CHECKPOINT_KEY_SIZE + partition->sectors * CHECKPOINT_SECTOR_SIZE;
+    return matches ? payload : NULL;
+}
+
+/**
+ * Whether a journalled put reached flash: its sector holds an intact KV record with the key and
+ * sequence number the journal names.
+ */
+static bool journal_put_landed(uint32_t offset, uint16_t key, uint32_t seq) {
+    flash_stat_t stat;
+    if (flash_bbt_is_retired(offset) || flash_stat(offset, &stat) != FLASH_OK || !stat.valid ||
+        stat.data_len < FLASH_KV_RECORD_HEADER || flash_verify_sector(offset) != FLASH_OK) {
+        return false;
+    }
+    const uint8_t *record = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset + FLASH_HEADER_SIZE);
+    return schema_get_u16(record) == key && schema_get_u32(record + 2) == seq;
+}
+
+/**
+ * Whether a journal entry is still erased, which marks the end of the journal.
+ */
+static bool journal_entry_erased(const uint8_t *entry) {
+    for (size_t i = 0; i < FLASH_KV_JOURNAL_ENTRY; i++) {
+        if (entry[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Mounts a KV or blob partition from the newer of the two checkpoints in `area` and replays the
+ * journal written behind it. Sectors the journal does not name are taken from the checkpoint and
+ * seeded into the header table without being read. A put the journal names but that never
+ * reached flash is dropped; a put or delete that did not get to retire the old copy is finished.
+ * When neither sector holds a checkpoint of this partition, typically on first boot, the
+ * partition is scanned as by flash_kv_mount and a first checkpoint is written.
+ *
+ * @param kv Receives the index.
+ * @param partition A KV or blob partition of at most FLASH_KV_CHECKPOINT_MAX_SECTORS sectors.
+ * @param area A RAW partition of two sectors, used for nothing else.
+ * @return FLASH_OK, FLASH_ERR_INVALID_DATA for partitions of the wrong policy or size,
+ *         FLASH_ERR_TOO_LARGE for a partition too large to checkpoint, or as flash_kv_mount.
+ */
+flash_status_t flash_kv_mount_checkpoint(flash_kv_t *kv, const flash_partition_t *partition, const flash_partition_t *area) {
+    if (area == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (area->policy != FLASH_PARTITION_RAW || area->sectors != 2) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+    flash_status_t status = flash_kv_mount_lazy(kv, partition);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (partition->sectors > FLASH_KV_CHECKPOINT_MAX_SECTORS) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+    kv->checkpoint = area;
+
+    const uint8_t *newest = NULL;
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        const uint8_t *payload = checkpoint_load(area->first_offset + slot * FLASH_SECTOR_SIZE, partition);
+        if (payload != NULL && (newest == NULL || seq_newer(schema_get_u32(payload + 4), kv->generation))) {
+            newest = payload;
+            kv->generation = schema_get_u32(payload + 4);
+            kv->checkpoint_slot = slot;
+        }
+    }
+    if (newest == NULL) {
+        status = flash_kv_mount_step(kv, 0);
+        flash_status_t written = flash_kv_checkpoint(kv);
+        return status != FLASH_OK ? status : written;
+    }
+
+    kv->count = schema_get_u16(newest + 14);
+    kv->next_seq = schema_get_u32(newest + 16);
+    kv->seq_known = true;
+    kv->scanned = partition->sectors;
+    const uint8_t *in = newest + CHECKPOINT_HEADER;
+    for (uint16_t i = 0; i < kv->count; i++, in += CHECKPOINT_KEY_SIZE) {
+        kv->keys[i] = schema_get_u16(in);
+        kv->offsets[i] = schema_get_u32(in + 2);
+        kv->seqs[i] = schema_get_u32(in + 6);
+    }
+
+    // Every sector the journal names, and every sector a journalled key lived in, may have
+    // changed since the checkpoint; the rest are exactly as the checkpoint recorded them.
+    const uint8_t *journal = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + area->first_offset +
+                                               kv->checkpoint_slot * FLASH_SECTOR_SIZE + FLASH_KV_JOURNAL_START);
+    uint32_t changed[(FLASH_KV_CHECKPOINT_MAX_SECTORS + 31) / 32] = { 0 };
+    uint16_t entries = 0;
+    for (; entries < FLASH_KV_JOURNAL_ENTRIES; entries++) {
+        const uint8_t *entry = journal + entries * FLASH_KV_JOURNAL_ENTRY;
+        if (journal_entry_erased(entry)) {
+            break;
+        }
+        uint32_t index = (schema_get_u32(entry + 4) - partition->first_offset) / FLASH_SECTOR_SIZE;
+        int slot = kv_find(kv, schema_get_u16(entry + 8));
+        if (index < partition->sectors) {
+            changed[index / 32] |= 1u << (index % 32);
+        }
+        if (slot >= 0) {
+            index = (kv->offsets[slot] - partition->first_offset) / FLASH_SECTOR_SIZE;
+            changed[index / 32] |= 1u << (index % 32);
+        }
+    }
+    kv->journal_next = entries;
+
+    in = newest + CHECKPOINT_HEADER + kv->count * CHECKPOINT_KEY_SIZE;
+    for (uint32_t i = 0; i < partition->sectors; i++, in += CHECKPOINT_SECTOR_SIZE) {
+        if ((changed[i / 32] & (1u << (i % 32))) || (in[0] & SECTOR_UNKNOWN)) {
+            continue;
+        }
+        flash_stat_t stat = {
+            .valid = (in[0] & SECTOR_VALID) != 0,
+            .blank = (in[0] & SECTOR_BLANK) != 0,
+            .write_count = schema_get_u32(in + 1),
+            .data_len = schema_get_u16(in + 5),
+            .data_crc = schema_get_u32(in + 7),
+        };
+        flash_cache_store(partition->first_offset + i * FLASH_SECTOR_SIZE, &stat);
+    }
+
+    for (uint16_t e = 0; e < entries; e++) {
+        const uint8_t *entry = journal + e * FLASH_KV_JOURNAL_ENTRY;
+        if (crc32c(entry, 12) != schema_get_u32(entry + 12)) {
+            continue; // Torn by a power loss while it was being appended; its operation never started.
+        }
+        uint32_t seq = schema_get_u32(entry);
+        uint32_t offset = schema_get_u32(entry + 4);
+        uint16_t key = schema_get_u16(entry + 8);
+        int slot = kv_find(kv, key);
+        if (seq_newer(seq + 1, kv->next_seq)) {
+            kv->next_seq = seq + 1;
+        }
+
+        if (entry[10] == JOURNAL_PUT && journal_put_landed(offset, key, seq)) {
+            if (slot < 0) {
+                if (kv->count == FLASH_KV_MAX_KEYS) {
+                    kv->mount_status = FLASH_ERR_NO_SPACE;
+                    continue;
+                }
+                slot = kv->count++;
+                kv->keys[slot] = key;
+            } else if (kv->offsets[slot] != offset && journal_put_landed(kv->offsets[slot], key, kv->seqs[slot])) {
+                flash_mark_obsolete(kv->offsets[slot]);
+            }
+            kv->offsets[slot] = offset;
+            kv->seqs[slot] = seq;
+        } else if (entry[10] == JOURNAL_DELETE && slot >= 0 && kv->offsets[slot] == offset) {
+            if (journal_put_landed(offset, key, kv->seqs[slot])) {
+                flash_mark_obsolete(offset);
+            }
+            kv->count--;
+            kv->keys[slot] = kv->keys[kv->count];
+            kv->offsets[slot] = kv->offsets[kv->count];
+            kv->seqs[slot] = kv->seqs[kv->count];
+        }
+    }
+    return kv->mount_status;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file flash_partition.h
+ *
+ * Named partitions of the user region, each with its own policy. The application describes its
+ * layout once in a table, for example
+ *
+ *     static const flash_partition_t partitions[] = {
+ *         { "config",    0,          4, FLASH_PARTITION_KV },
+ *         { "telemetry", 4 * 4096, 64, FLASH_PARTITION_LOG },
+ *         { "firmware",  68 * 4096, 64, FLASH_PARTITION_BLOB },
+ *     };
+ *
+ * and every module then works inside the sectors of one partition only:
+ *
+ * - RAW: sectors addressed by index and written with the record functions, or handed whole to a
+ *   flash_queue. flash_partition_alloc picks the least-worn free sector of the partition.
+ * - KV: values under 16-bit keys, one sector each. A put writes the new value to the least-worn
+ *   free sector of the partition and then marks the sector holding the old one obsolete, so a
+ *   value is never without a valid copy and the garbage a put leaves is collected by the put
+ *   itself. The obsolete sector is only erased when the allocator hands it out again.
+ * - LOG: a flash_log ring spanning the partition.
+ * - BLOB: a KV partition holding the single key FLASH_BLOB_KEY, for an image replaced as a whole.
+ *
+ * Allocation, garbage collection and wear levelling all stay within the partition, so a
+ * telemetry log erasing a sector a minute wears out its own sectors and never the ones holding
+ * configuration; flash_wear_init_range watches one partition's wear. Mounting a KV or blob
+ * partition scans that partition's headers and nothing else, so boot time grows with the
+ * partitions an application opens rather than with the size of flash.
+ *
+ * For devices that must answer soon after power-on, flash_kv_mount_lazy mounts without reading
+ * flash at all. The partition's index is then built by flash_kv_mount_step, a bounded number of
+ * sectors per call from a background loop, or completed in one go by the first put, get or
+ * delete on that partition, whichever comes first. A first read therefore waits only for the
+ * partition it reads from, however many other partitions are still being indexed.
+ *
+ * Mounting can also skip the scan altogether. flash_kv_mount_checkpoint keeps a checkpoint of a
+ * partition's index and of every sector header in it (which sectors are free and how worn each
+ * one is) in a two-sector RAW partition, the newest and the previous one in alternate sectors.
+ * Every put and delete after a checkpoint appends a 16-byte journal entry behind it before it
+ * touches the data sectors:
+ *
+ *     sequence (4) | sector offset (4) | key (2) | operation (1) | reserved (1) | CRC32C (4)
+ *
+ * Mounting loads the newer valid checkpoint, seeds the header table from it so allocation needs
+ * no header reads, and replays the journal, checking only the sectors the journal names. Mount
+ * time therefore depends on the journal length, not on how full the partition is. When the
+ * journal fills up a new checkpoint is written to the other sector, so a power loss while
+ * writing it falls back on the previous checkpoint and its complete journal.
+ *
+ * flash_alloc_sector and flash_write_alloc still search the whole user region; applications that
+ * use partitions allocate through flash_partition_alloc instead.
+ */
+
+#ifndef FLASH_PARTITION_H
+#define FLASH_PARTITION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "flash_ops.h"
+#include "flash_ops_helper.h"
+#include "flash_log.h"
+
+#define FLASH_PARTITION_MAX 8
+#define FLASH_KV_MAX_KEYS 32
+#define FLASH_KV_RECORD_HEADER 6  // key (2) | sequence (4) in front of every stored value.
+#define FLASH_KV_MAX_VALUE (FLASH_SECTOR_SIZE - METADATA_SIZE - FLASH_KV_RECORD_HEADER)
+#define FLASH_BLOB_KEY 0
+#define FLASH_KV_CHECKPOINT_MAX_SECTORS 128 // Largest partition a checkpoint can describe.
+#define FLASH_KV_JOURNAL_START (FLASH_SECTOR_SIZE / 2) // Journal position within a checkpoint sector.
+#define FLASH_KV_JOURNAL_ENTRY 16
+#define FLASH_KV_JOURNAL_ENTRIES ((FLASH_SECTOR_SIZE - FLASH_KV_JOURNAL_START) / FLASH_KV_JOURNAL_ENTRY)
+
+typedef enum {
+    FLASH_PARTITION_RAW,  // Sectors used directly by the application.
+    FLASH_PARTITION_KV,   // Keyed values, copied on write within the partition.
+    FLASH_PARTITION_LOG,  // A flash_log ring.
+    FLASH_PARTITION_BLOB  // One value replaced as a whole.
+} flash_partition_policy_t;
+
+typedef struct {
+    const char *name;
+    uint32_t first_offset;           // User-region offset of the first sector.
+    uint32_t sectors;                // Sectors in the partition.
+    flash_partition_policy_t policy;
+} flash_partition_t;
+
+// Index of a mounted KV or blob partition, rebuilt from its sector headers by flash_kv_mount.
+typedef struct {
+    const flash_partition_t *partition;
+    uint32_t scanned;                         // Sectors indexed so far; the mount is complete at partition->sectors.
+    flash_status_t mount_status;              // First problem met while indexing.
+    bool seq_known;                           // Some record has been seen, so next_seq is meaningful.
+    uint32_t next_seq;                        // Sequence number of the next put.
+    uint16_t count;                           // Keys present.
+    uint16_t keys[FLASH_KV_MAX_KEYS];
+    uint32_t offsets[FLASH_KV_MAX_KEYS];      // Sector holding the value of keys[i].
+    uint32_t seqs[FLASH_KV_MAX_KEYS];         // Sequence number of the value of keys[i].
+    const flash_partition_t *checkpoint;      // Two-sector RAW partition holding checkpoints, or NULL.
+    uint32_t generation;                      // Generation of the newest checkpoint; 0 before the first.
+    uint8_t checkpoint_slot;                  // Sector of `checkpoint` holding the newest one.
+    uint16_t journal_next;                    // Next free journal entry behind it.
+} flash_kv_t;
+
+// Checks and installs the partition table; the table must stay valid while it is in use.
+flash_status_t flash_partition_table_set(const flash_partition_t *table, size_t count);
+
+// The partition called `name` in the installed table, or NULL.
+const flash_partition_t *flash_partition_find(const char *name);
+
+// Offset of sector `index` of a partition.
+flash_status_t flash_partition_sector(const flash_partition_t *partition, uint32_t index, uint32_t *offset);
+
+// Picks the least-worn free sector of a RAW partition.
+flash_status_t flash_partition_alloc(const flash_partition_t *partition, uint32_t *offset);
+
+// Opens the flash_log kept in a LOG partition.
+flash_status_t flash_partition_log_open(const flash_partition_t *partition, flash_log_t *log, size_t record_size);
+
+// Scans a KV or blob partition and builds its index, finishing any put a power loss interrupted.
+flash_status_t flash_kv_mount(flash_kv_t *kv, const flash_partition_t *partition);
+
+// Prepares the index of a KV or blob partition without touching flash; see flash_kv_mount_step.
+flash_status_t flash_kv_mount_lazy(flash_kv_t *kv, const flash_partition_t *partition);
+
+// Indexes up to max_sectors more sectors (0 for all that remain); returns the mount's status so far.
+flash_status_t flash_kv_mount_step(flash_kv_t *kv, uint32_t max_sectors);
+
+// Whether every sector of the partition has been indexed.
+bool flash_kv_mounted(const flash_kv_t *kv);
+
+// Mounts from the newest checkpoint kept in the two-sector RAW partition `area`, replaying its journal.
+flash_status_t flash_kv_mount_checkpoint(flash_kv_t *kv, const flash_partition_t *partition, const flash_partition_t *area);
+
+// Writes a checkpoint of the current index to the other checkpoint sector and starts an empty journal.
+flash_status_t flash_kv_checkpoint(flash_kv_t *kv);
+
+// Stores a value of at most FLASH_KV_MAX_VALUE bytes under `key`, replacing any previous one.
+flash_status_t flash_kv_put(flash_kv_t *kv, uint16_t key, const void *value, size_t len);
+
+// Copies the value stored under `key`; FLASH_ERR_INVALID_DATA if there is none.
+flash_status_t flash_kv_get(flash_kv_t *kv, uint16_t key, void *value, size_t len, size_t *value_len);
+
+// Removes `key` and marks its sector obsolete.
+flash_status_t flash_kv_delete(flash_kv_t *kv, uint16_t key);
+
+#endif // FLASH_PARTITION_H
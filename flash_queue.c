@@ -0,0 +1,291 @@
+/**
+ * @file flash_queue.c
+ *
+ * Implementation of the persistent FIFO queue declared in flash_queue.h. Page headers are read
+ * straight from XIP; the only writes are whole-page programs for pushes, single-byte programs
+ * for pops, and one sector erase each time the write position enters a sector.
+ */
+
+#include "flash_queue.h"
+#include "flash_ops_helper.h"
+#include "crc32c.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#define PAGES_PER_SECTOR FLASH_PAGES_PER_SECTOR
+#define QUEUE_MAGIC 0x51
+
+// Byte positions within a page header.
+#define PAGE_SEQ 0
+#define PAGE_LEN 4
+#define PAGE_MAGIC 6
+#define PAGE_CONSUMED 7
+#define PAGE_CRC 8
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * Returns the absolute flash offset of a page of the queue.
+ */
+static uint32_t page_flash_offset(const flash_queue_t *queue, uint32_t page) {
+    return FLASH_TARGET_OFFSET + queue->first_offset + page * FLASH_PAGE_SIZE;
+}
+
+/**
+ * Returns the memory-mapped contents of a page of the queue.
+ */
+static const uint8_t *page_data(const flash_queue_t *queue, uint32_t page) {
+    return (const uint8_t *)(XIP_BASE + page_flash_offset(queue, page));
+}
+
+/**
+ * Returns the payload length of a page holding an intact message, or 0 for a blank, torn or
+ * foreign page.
+ */
+static size_t page_message_len(const uint8_t *page) {
+    size_t len = (size_t)page[PAGE_LEN] | ((size_t)page[PAGE_LEN + 1] << 8);
+    if (page[PAGE_MAGIC] != QUEUE_MAGIC || len == 0 || len > FLASH_QUEUE_MAX_MESSAGE) {
+        return 0;
+    }
+
+    // The CRC covers the header up to the magic and the payload, but not the consumed byte.
+    uint32_t crc = crc32c(page, PAGE_CONSUMED);
+    crc = crc32c_update(crc, page + FLASH_QUEUE_PAGE_HEADER, len);
+    return crc == get_u32(page + PAGE_CRC) ? len : 0;
+}
+
+/**
+ * Returns true if a page holds an intact message that has not been popped. A consumed byte that
+ * was only partly programmed before a power loss still counts as popped.
+ */
+static bool page_live(const uint8_t *page) {
+    return page[PAGE_CONSUMED] == 0xFF && page_message_len(page) > 0;
+}
+
+static bool page_blank(const uint8_t *page) {
+    for (size_t i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (page[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Recovers the queue from its sectors. Every page header is checked once; the write position
+ * follows the highest sequence number and the oldest live message has the lowest live one.
+ *
+ * @param queue Queue state to fill in.
+ * @param first_offset User-region offset of the first sector; must be sector aligned.
+ * @param sectors Number of consecutive sectors; at least two, so one can be erased while the
+ *                other still holds messages.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, FLASH_ERR_NO_SPACE for fewer than two sectors, or the
+ *         alignment or bounds error of the first or last sector.
+ */
+flash_status_t flash_queue_open(flash_queue_t *queue, uint32_t first_offset, uint32_t sectors) {
+    if (queue == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (sectors < 2) {
+        return FLASH_ERR_NO_SPACE;
+    }
+
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(first_offset, &flash_offset);
+    if (status == FLASH_OK) {
+        status = flash_check_sector(first_offset + (sectors - 1) * FLASH_SECTOR_SIZE, &flash_offset);
+    }
+    if (status != FLASH_OK) {
+        FLASH_LOG("Error: Cannot open queue at offset %u: %s\n", (unsigned)first_offset, flash_status_str(status));
+        return status;
+    }
+
+    queue->first_offset = first_offset;
+    queue->pages = sectors * PAGES_PER_SECTOR;
+    queue->count = 0;
+
+    bool any = false, any_live = false;
+    uint32_t max_seq = 0, max_page = 0, min_seq = 0, min_page = 0;
+    for (uint32_t page = 0; page < queue->pages; page++) {
+        const uint8_t *data = page_data(queue, page);
+        if (page_message_len(data) == 0) {
+            continue;
+        }
+        uint32_t seq = get_u32(data + PAGE_SEQ);
+        if (!any || seq > max_seq) {
+            max_seq = seq;
+            max_page = page;
+            any = true;
+        }
+        if (data[PAGE_CONSUMED] == 0xFF) {
+            queue->count++;
+            if (!any_live || seq < min_seq) {
+                min_seq = seq;
+                min_page = page;
+                any_live = true;
+            }
+        }
+    }
+
+    queue->head = any ? (max_page + 1) % queue->pages : 0;
+    queue->next_seq = any ? max_seq + 1 : 1;
+    queue->tail = any_live ? min_page : queue->head;
+    return FLASH_OK;
+}
+
+/**
+ * Appends a message by programming the next free page. When the write position enters a new
+ * sector that sector is erased first, which is only allowed once every message in it was popped.
+ *
+ * @param queue An opened queue.
+ * @param data The message.
+ * @param len Message length; 1 to FLASH_QUEUE_MAX_MESSAGE bytes.
+ * @return FLASH_OK, an argument error, or FLASH_ERR_NO_SPACE if the queue is full.
+ */
+flash_status_t flash_queue_push(flash_queue_t *queue, const uint8_t *data, size_t len) {
+    if (queue == NULL || data == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (len == 0) {
+        return FLASH_ERR_ZERO_LENGTH;
+    }
+    if (len > FLASH_QUEUE_MAX_MESSAGE) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+
+    // Pages left torn by a power loss are stepped over, so this normally runs once.
+    for (;;) {
+        if (queue->head % PAGES_PER_SECTOR == 0) {
+            if (queue->count > 0 && queue->tail / PAGES_PER_SECTOR == queue->head / PAGES_PER_SECTOR) {
+                return FLASH_ERR_NO_SPACE;
+            }
+            flash_erase_unmanaged(page_flash_offset(queue, queue->head) - FLASH_TARGET_OFFSET);
+        }
+        if (page_blank(page_data(queue, queue->head))) {
+            break;
+        }
+        queue->head = (queue->head + 1) % queue->pages;
+        if (queue->count == 0) {
+            queue->tail = queue->head;
+        }
+    }
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    put_u32(page + PAGE_SEQ, queue->next_seq);
+    page[PAGE_LEN] = (uint8_t)len;
+    page[PAGE_LEN + 1] = (uint8_t)(len >> 8);
+    page[PAGE_MAGIC] = QUEUE_MAGIC;
+    memcpy(page + FLASH_QUEUE_PAGE_HEADER, data, len);
+    put_u32(page + PAGE_CRC, crc32c_update(crc32c(page, PAGE_CONSUMED), data, len));
+
+    flash_status_t status = flash_program_partial(page_flash_offset(queue, queue->head), page, FLASH_PAGE_SIZE);
+    if (status != FLASH_OK) {
+        return status;
+    }
+
+    if (queue->count == 0) {
+        queue->tail = queue->head;
+    }
+    queue->head = (queue->head + 1) % queue->pages;
+    queue->count++;
+    queue->next_seq++;
+    return FLASH_OK;
+}
+
+/**
+ * Copies the oldest message without removing it, so it can be popped once it has been delivered.
+ *
+ * @param queue An opened queue.
+ * @param buffer Destination for the message.
+ * @param buffer_len Size of the destination.
+ * @param len Receives the message length; may be NULL.
+ * @return FLASH_OK, FLASH_ERR_INVALID_DATA if the queue is empty, FLASH_ERR_BUFFER_TOO_SMALL, or
+ *         FLASH_ERR_CRC if the page changed behind the queue's back.
+ */
+flash_status_t flash_queue_peek(const flash_queue_t *queue, uint8_t *buffer, size_t buffer_len, size_t *len) {
+    if (queue == NULL || buffer == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (queue->count == 0) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    const uint8_t *page = page_data(queue, queue->tail);
+    size_t message_len = page_message_len(page);
+    if (message_len == 0) {
+        return FLASH_ERR_CRC;
+    }
+    if (message_len > buffer_len) {
+        return FLASH_ERR_BUFFER_TOO_SMALL;
+    }
+
+    memcpy(buffer, page + FLASH_QUEUE_PAGE_HEADER, message_len);
+    if (len != NULL) {
+        *len = message_len;
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Removes the oldest message by clearing its consumed byte in place, then moves on to the next
+ * live page. Pages skipped on the way are torn pushes, so the walk is O(1) amortized.
+ *
+ * @param queue An opened queue.
+ * @return FLASH_OK, or FLASH_ERR_INVALID_DATA if the queue is empty.
+ */
+flash_status_t flash_queue_pop(flash_queue_t *queue) {
+    if (queue == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (queue->count == 0) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    const uint8_t consumed = 0x00;
+    flash_status_t status = flash_program_partial(page_flash_offset(queue, queue->tail) + PAGE_CONSUMED, &consumed, 1);
+    if (status != FLASH_OK) {
+        return status;
+    }
+
+    queue->count--;
+    if (queue->count == 0) {
+        queue->tail = queue->head;
+        return FLASH_OK;
+    }
+    do {
+        queue->tail = (queue->tail + 1) % queue->pages;
+    } while (!page_live(page_data(queue, queue->tail)));
+    return FLASH_OK;
+}
+
+/**
+ * Erases every sector of the queue and resets it to empty.
+ *
+ * @param queue An opened queue.
+ * @return FLASH_OK or FLASH_ERR_NULL_DATA.
+ */
+flash_status_t flash_queue_clear(flash_queue_t *queue) {
+    if (queue == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+
+    for (uint32_t page = 0; page < queue->pages; page += PAGES_PER_SECTOR) {
+        flash_erase_unmanaged(page_flash_offset(queue, page) - FLASH_TARGET_OFFSET);
+    }
+    queue->head = 0;
+    queue->tail = 0;
+    queue->count = 0;
+    queue->next_seq = 1;
+    return FLASH_OK;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file flash_queue.h
+ *
+ * Persistent FIFO queue for store-and-forward data, built on a circular run of sectors reserved
+ * for it. Every message occupies one flash page:
+ *
+ *     sequence (4) | length (2) | magic (1) | consumed (1) | CRC32C (4) | payload
+ *
+ * Pushing programs the next free page and nothing else; the sector ahead is erased only when the
+ * write position first enters it, once every 16 pushes. Popping programs the consumed byte of the
+ * oldest page from 0xFF to 0x00 in place. Neither operation scans, so both are O(1).
+ *
+ * Nothing about the queue is kept in flash besides the pages themselves. flash_queue_open scans
+ * the page headers once at boot: the page after the highest sequence number is the write
+ * position, and the live page with the lowest one is the oldest message. A power loss can cost at
+ * most the push or pop in progress; a torn page fails its CRC and is skipped.
+ *
+ * The sectors belong to the queue alone. They do not hold flash_write_safe records, so they must
+ * not be passed to the record functions or left where flash_write_alloc can pick them.
+ */
+
+#ifndef FLASH_QUEUE_H
+#define FLASH_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "flash_ops.h"
+
+#define FLASH_QUEUE_PAGE_HEADER 12
+#define FLASH_QUEUE_MAX_MESSAGE (FLASH_PAGE_SIZE - FLASH_QUEUE_PAGE_HEADER)
+
+// Queue state recovered by flash_queue_open; positions are page indexes within the queue.
+typedef struct {
+    uint32_t first_offset; // User-region offset of the first sector.
+    uint32_t pages;        // Total pages in the queue's sectors.
+    uint32_t head;         // Page the next push goes to.
+    uint32_t tail;         // Page of the oldest live message; equals head when empty.
+    uint32_t count;        // Live messages.
+    uint32_t next_seq;     // Sequence number of the next push.
+} flash_queue_t;
+
+// Recovers the queue stored in `sectors` sectors starting at `first_offset`; needs at least two.
+flash_status_t flash_queue_open(flash_queue_t *queue, uint32_t first_offset, uint32_t sectors);
+
+// Appends a message of at most FLASH_QUEUE_MAX_MESSAGE bytes.
+flash_status_t flash_queue_push(flash_queue_t *queue, const uint8_t *data, size_t len);
+
+// Copies the oldest message without removing it.
+flash_status_t flash_queue_peek(const flash_queue_t *queue, uint8_t *buffer, size_t buffer_len, size_t *len);
+
+// Removes the oldest message.
+flash_status_t flash_queue_pop(flash_queue_t *queue);
+
+// Erases every sector of the queue and empties it.
+flash_status_t flash_queue_clear(flash_queue_t *queue);
+
+#endif // FLASH_QUEUE_H
@@ -0,0 +1,159 @@
+/**
+ * @file flash_record.c
+ *
+ * Implementation of the versioned records declared in flash_record.h. An old record is decoded
+ * into a scratch struct of its own version and upgraded one version at a time, alternating
+ * between two scratch structs, until the last upgrade writes the caller's struct.
+ */
+
+#include "flash_record.h"
+#include <string.h>
+
+// Scratch structs for the upgrade chain, aligned for any member type.
+typedef union {
+    uint8_t bytes[FLASH_RECORD_MAX_STRUCT];
+    uint64_t align_u64;
+    double align_double;
+    void *align_ptr;
+} scratch_struct_t;
+
+static scratch_struct_t scratch[2];
+static uint8_t stored[FLASH_RECORD_HEADER + FLASH_RECORD_MAX_ENCODED];
+
+/**
+ * Encodes a struct in the current layout.
+ *
+ * @param schema The record type.
+ * @param record A struct of the current version.
+ * @param out Destination with room for the version byte and the current encoded size.
+ * @return The bytes written.
+ */
+size_t flash_record_encode(const flash_record_schema_t *schema, const void *record, uint8_t *out) {
+    const flash_record_version_t *current = &schema->versions[schema->version_count - 1];
+    out[0] = current->version;
+    schema->encode(record, out + FLASH_RECORD_HEADER);
+    return FLASH_RECORD_HEADER + current->encoded_size;
+}
+
+/**
+ * Decodes a stored record. A record in the current layout is decoded straight into `record`; an
+ * older one goes through every upgrade after its version.
+ *
+ * @param schema The record type.
+ * @param in The stored bytes, version byte first.
+ * @param len Number of stored bytes; must match the size of the version found.
+ * @param record Receives the current struct.
+ * @param stale Set to whether the stored layout is older than the current one; may be NULL.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, FLASH_ERR_INVALID_DATA for an unknown version or a length
+ *         that does not match it, or FLASH_ERR_TOO_LARGE if a version's struct exceeds the scratch.
+ */
+flash_status_t flash_record_decode(const flash_record_schema_t *schema, const uint8_t *in, size_t len,
+                                   void *record, bool *stale) {
+    if (schema == NULL || in == NULL || record == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (len < FLASH_RECORD_HEADER) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    uint8_t i = 0;
+    while (i < schema->version_count && schema->versions[i].version != in[0]) {
+        i++;
+    }
+    if (i == schema->version_count || len != FLASH_RECORD_HEADER + schema->versions[i].encoded_size) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    uint8_t last = schema->version_count - 1;
+    if (stale != NULL) {
+        *stale = (i != last);
+    }
+    if (i == last) {
+        schema->versions[i].decode(in + FLASH_RECORD_HEADER, record);
+        return FLASH_OK;
+    }
+
+    for (uint8_t v = i; v < last; v++) {
+        if (schema->versions[v].struct_size > FLASH_RECORD_MAX_STRUCT) {
+            return FLASH_ERR_TOO_LARGE;
+        }
+    }
+    unsigned current = 0;
+    schema->versions[i].decode(in + FLASH_RECORD_HEADER, scratch[current].bytes);
+    for (uint8_t v = i; v < last; v++) {
+        void *next = (v + 1 == last) ? record : (void *)scratch[current ^ 1].bytes;
+        memset(next, 0, schema->versions[v + 1].struct_size);
+        schema->versions[v].upgrade(scratch[current].bytes, next);
+        current ^= 1;
+    }
+    return FLASH_OK;
+}
+
+flash_status_t flash_record_write(const flash_record_schema_t *schema, uint32_t offset, const void *record) {
+    if (schema == NULL || record == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (schema->versions[schema->version_count - 1].encoded_size > FLASH_RECORD_MAX_ENCODED) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+    size_t len = flash_record_encode(schema, record, stored);
+    return flash_write_safe(offset, stored, len);
+}
+
+flash_status_t flash_record_read(const flash_record_schema_t *schema, uint32_t offset, void *record, bool *stale) {
+    if (schema == NULL || record == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    size_t len = 0;
+    flash_status_t status = flash_read_safe(offset, stored, sizeof(stored), &len);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    return flash_record_decode(schema, stored, len, record, stale);
+}
+
+/**
+ * Brings one stored record up to the current layout. Meant for housekeeping that already visits
+ * sectors, such as compaction or an idle-time sweep; a record that is current costs one read.
+ * A stale record is copied, not rewritten in place: the upgraded copy goes to a free sector of
+ * the run, verified, and only then is the old sector marked obsolete. A power loss at any point
+ * leaves at least one readable copy, the old layout or the new one.
+ *
+ * @param schema The record type.
+ * @param offset Sector holding the record.
+ * @param first_offset User-region offset of the first sector the copy may go to.
+ * @param sectors Number of sectors in that run.
+ * @param new_offset Receives the sector holding the record afterwards; `offset` itself if the
+ *                   record was already current.
+ * @return FLASH_OK, or the error reading, decoding or copying the record; on an error the record
+ *         stays where it was.
+ */
+flash_status_t flash_record_migrate(const flash_record_schema_t *schema, uint32_t offset,
+                                    uint32_t first_offset, uint32_t sectors, uint32_t *new_offset) {
+    static scratch_struct_t record;
+    bool stale = false;
+    if (schema == NULL || new_offset == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    *new_offset = offset;
+    const flash_record_version_t *current = &schema->versions[schema->version_count - 1];
+    if (current->struct_size > sizeof(record) || current->encoded_size > FLASH_RECORD_MAX_ENCODED) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+
+    flash_status_t status = flash_record_read(schema, offset, record.bytes, &stale);
+    if (status != FLASH_OK || !stale) {
+        return status;
+    }
+    size_t len = flash_record_encode(schema, record.bytes, stored);
+    uint32_t copy;
+    status = flash_write_alloc_in(first_offset, sectors, stored, len, &copy);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    *new_offset = copy;
+
+    // The copy is in place; losing the old one now costs nothing but a sector to reclaim.
+    flash_mark_obsolete(offset);
+    return FLASH_OK;
+}
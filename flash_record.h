@@ -0,0 +1,81 @@
+/**
+ * @file flash_record.h
+ *
+ * Versioned records stored with flash_write_safe. Every record starts with a one-byte schema
+ * version, followed by the fields encoded in that version's layout:
+ *
+ *     version (1) | fields
+ *
+ * A record type lists every layout it has ever been stored in, oldest first, each with a decoder
+ * and a function upgrading the decoded struct to the next version. Reading a record in an older
+ * layout decodes it as stored and walks it up the upgrade chain in RAM; the caller always gets
+ * the current struct and is told the stored copy is stale.
+ *
+ * Nothing is migrated at boot. A stale record is rewritten in the current layout the next time
+ * it is written anyway, or when housekeeping calls flash_record_migrate on it, so a device full
+ * of old records starts as fast as one with none and spreads the rewrites over normal operation.
+ * Migration copies the record to a free sector and then marks the old one obsolete, as garbage
+ * collection does, so the record moves and the caller must take its new offset.
+ *
+ * Records whose fields do not change never need a new version. Adding a field means appending a
+ * new entry whose upgrade from the previous entry fills in a default; entries are never removed
+ * while records in that layout may still exist. The read and migrate calls share static buffers
+ * and must not be used from more than one thread of execution.
+ */
+
+#ifndef FLASH_RECORD_H
+#define FLASH_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "flash_ops.h"
+
+#define FLASH_RECORD_HEADER 1
+#define FLASH_RECORD_MAX_ENCODED 255   // Largest encoded layout, version byte excluded.
+#define FLASH_RECORD_MAX_STRUCT 128    // Largest in-RAM struct of any version.
+
+// Decodes one layout into the struct of the same version.
+typedef void (*flash_record_decode_fn)(const uint8_t *in, void *record);
+
+// Encodes the current struct.
+typedef void (*flash_record_encode_fn)(const void *record, uint8_t *out);
+
+// Converts a struct of one version into the struct of the next.
+typedef void (*flash_record_upgrade_fn)(const void *old_record, void *new_record);
+
+// One layout a record type has been stored in.
+typedef struct {
+    uint8_t version;
+    size_t encoded_size;             // Bytes after the version byte.
+    size_t struct_size;              // sizeof the struct this version decodes into.
+    flash_record_decode_fn decode;
+    flash_record_upgrade_fn upgrade; // To the next entry; NULL for the last one.
+} flash_record_version_t;
+
+// Every layout of a record type, oldest first; the last entry is the current one.
+typedef struct {
+    const flash_record_version_t *versions;
+    uint8_t version_count;
+    flash_record_encode_fn encode;   // Encoder of the current layout.
+} flash_record_schema_t;
+
+// Encodes a current-version struct, version byte included; returns the bytes used.
+size_t flash_record_encode(const flash_record_schema_t *schema, const void *record, uint8_t *out);
+
+// Decodes a stored record of any known version into the current struct.
+flash_status_t flash_record_decode(const flash_record_schema_t *schema, const uint8_t *in, size_t len,
+                                   void *record, bool *stale);
+
+// Writes a record to a sector in the current layout.
+flash_status_t flash_record_write(const flash_record_schema_t *schema, uint32_t offset, const void *record);
+
+// Reads a record from a sector, upgrading it in RAM; `stale` may be NULL.
+flash_status_t flash_record_read(const flash_record_schema_t *schema, uint32_t offset, void *record, bool *stale);
+
+// Copies a record stored in an older layout to a free sector of the run in the current layout,
+// then marks the old sector obsolete; `new_offset` receives where the record now lives.
+flash_status_t flash_record_migrate(const flash_record_schema_t *schema, uint32_t offset,
+                                    uint32_t first_offset, uint32_t sectors, uint32_t *new_offset);
+
+#endif // FLASH_RECORD_H
@@ -0,0 +1,184 @@
+/**
+ * @file flash_rollup.c
+ *
+ * Implementation of the rollup tiers declared in flash_rollup.h. A tier costs one comparison and
+ * a few arithmetic operations per sample; flash is touched only when a period closes, and then
+ * only through the log's RAM page.
+ */
+
+#include "flash_rollup.h"
+#include <string.h>
+
+/**
+ * Returns the point accumulated for the tier's current period.
+ */
+static void current_point(const flash_rollup_tier_t *tier, flash_rollup_point_t *point) {
+    point->start_ms = tier->start_ms;
+    point->count = tier->count;
+    point->min = tier->min;
+    point->max = tier->max;
+    point->mean = (float)(tier->sum / tier->count);
+}
+
+/**
+ * Opens the tiers. Each tier's log is opened separately, so tiers may be added to a device that
+ * already stores others.
+ *
+ * @param rollup Rollup state to fill in.
+ * @param configs One configuration per tier, typically from finest to coarsest.
+ * @param tier_count Number of tiers, at most FLASH_ROLLUP_MAX_TIERS.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, FLASH_ERR_TOO_LARGE for too many tiers,
+ *         FLASH_ERR_ZERO_LENGTH for a zero period, or the error opening a tier's log.
+ */
+flash_status_t flash_rollup_open(flash_rollup_t *rollup, const flash_rollup_tier_config_t *configs, uint32_t tier_count) {
+    if (rollup == NULL || configs == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (tier_count > FLASH_ROLLUP_MAX_TIERS) {
+        return FLASH_ERR_TOO_LARGE;
+    }
+
+    memset(rollup, 0, sizeof(*rollup));
+    for (uint32_t i = 0; i < tier_count; i++) {
+        if (configs[i].period_ms == 0) {
+            return FLASH_ERR_ZERO_LENGTH;
+        }
+        flash_status_t status = flash_log_open(&rollup->tiers[i].log, configs[i].first_offset, configs[i].sectors,
+                                               sizeof(flash_rollup_point_t));
+        if (status != FLASH_OK) {
+            return status;
+        }
+        rollup->tiers[i].period_ms = configs[i].period_ms;
+    }
+    rollup->tier_count = tier_count;
+    return FLASH_OK;
+}
+
+/**
+ * Folds a sample into every tier. When the sample belongs to a later period than the one being
+ * accumulated, that period's point is appended to the tier's log first.
+ *
+ * @param rollup Opened rollup tiers.
+ * @param timestamp_ms Sample time.
+ * @param value The sample.
+ * @return FLASH_OK or the first error appending a point.
+ */
+flash_status_t flash_rollup_add(flash_rollup_t *rollup, uint32_t timestamp_ms, float value) {
+    if (rollup == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+
+    flash_status_t result = FLASH_OK;
+    for (uint32_t i = 0; i < rollup->tier_count; i++) {
+        flash_rollup_tier_t *tier = &rollup->tiers[i];
+        uint32_t start = timestamp_ms - timestamp_ms % tier->period_ms;
+
+        if (tier->open && start > tier->start_ms) {
+            flash_rollup_point_t point;
+            current_point(tier, &point);
+            flash_status_t status = flash_log_append(&tier->log, &point);
+            if (result == FLASH_OK) {
+                result = status;
+            }
+            tier->open = false;
+        }
+
+        if (!tier->open) {
+            tier->open = true;
+            tier->start_ms = start;
+            tier->count = 0;
+            tier->min = value;
+            tier->max = value;
+            tier->sum = 0;
+        }
+        if (value < tier->min) {
+            tier->min = value;
+        }
+        if (value > tier->max) {
+            tier->max = value;
+        }
+        tier->sum += value;
+        tier->count++;
+    }
+    return result;
+}
+
+flash_status_t flash_rollup_flush(flash_rollup_t *rollup) {
+    if (rollup == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    for (uint32_t i = 0; i < rollup->tier_count; i++) {
+        flash_status_t status = flash_log_flush(&rollup->tiers[i].log);
+        if (status != FLASH_OK) {
+            return status;
+        }
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Copies a tier's points for a time range. Stored points are in start order, so a binary search
+ * finds the first one and the rest are read in sequence: the cost is one read per point returned
+ * plus log2 of the points stored.
+ *
+ * @param rollup Opened rollup tiers.
+ * @param tier Index of the tier.
+ * @param from_ms Earliest period start to return, inclusive.
+ * @param to_ms Latest period start to return, inclusive.
+ * @param points Destination array.
+ * @param max_points Capacity of the destination; the oldest points in the range are returned first.
+ * @param point_count Receives the number of points copied.
+ * @return FLASH_OK, FLASH_ERR_NULL_DATA, FLASH_ERR_OUT_OF_BOUNDS for an unknown tier, or a read error.
+ */
+flash_status_t flash_rollup_query(const flash_rollup_t *rollup, uint32_t tier, uint32_t from_ms, uint32_t to_ms,
+                                  flash_rollup_point_t *points, uint32_t max_points, uint32_t *point_count) {
+    if (rollup == NULL || points == NULL || point_count == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (tier >= rollup->tier_count) {
+        return FLASH_ERR_OUT_OF_BOUNDS;
+    }
+    *point_count = 0;
+
+    const flash_rollup_tier_t *t = &rollup->tiers[tier];
+    uint64_t lo = flash_log_first(&t->log), hi = flash_log_end(&t->log);
+    flash_rollup_point_t point;
+
+    // Find the first stored point starting at or after from_ms.
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        flash_status_t status = flash_log_read(&t->log, mid, &point);
+        if (status != FLASH_OK) {
+            return status;
+        }
+        if (point.start_ms < from_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (uint64_t index = lo; index < flash_log_end(&t->log) && *point_count < max_points; index++) {
+        flash_status_t status = flash_log_read(&t->log, index, &point);
+        if (status != FLASH_OK) {
+            return status;
+        }
+        if (point.start_ms > to_ms) {
+            return FLASH_OK;
+        }
+        points[(*point_count)++] = point;
+    }
+
+    if (t->open && t->start_ms >= from_ms && t->start_ms <= to_ms && *point_count < max_points) {
+        current_point(t, &points[(*point_count)++]);
+    }
+    return FLASH_OK;
+}
+
+uint64_t flash_rollup_retention_ms(const flash_rollup_t *rollup, uint32_t tier) {
+    if (rollup == NULL || tier >= rollup->tier_count) {
+        return 0;
+    }
+    const flash_rollup_tier_t *t = &rollup->tiers[tier];
+    return (uint64_t)(t->log.sectors - 1) * t->log.records_per_sector * t->period_ms;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file flash_rollup.h
+ *
+ * Downsampled history of sensor_value samples, maintained as the samples arrive. Each tier has a
+ * fixed period (a minute, an hour, ...) and keeps one point per period: the start of the period,
+ * the sample count, and the min, max and mean. The point for the current period is accumulated
+ * in RAM and appended to the tier's own flash_log once a sample from a later period arrives.
+ *
+ * Every tier lives in its own sectors, so each has its own retention: a tier keeps at least
+ * (sectors - 1) * records_per_sector periods. A few sectors of an hourly tier hold weeks of
+ * history long after the raw samples have been overwritten, and drawing a chart costs one read
+ * per point shown, plus a binary search to find the first one.
+ *
+ * Timestamps are expected not to decrease; a sample older than the current period is counted in
+ * the current period. The point being accumulated is lost on power failure.
+ */
+
+#ifndef FLASH_ROLLUP_H
+#define FLASH_ROLLUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_log.h"
+
+#define FLASH_ROLLUP_MAX_TIERS 4
+
+// Where a tier is stored and how coarse it is.
+typedef struct {
+    uint32_t period_ms;
+    uint32_t first_offset; // User-region offset of the tier's first sector.
+    uint32_t sectors;      // At least two.
+} flash_rollup_tier_config_t;
+
+// One downsampled point, as stored in a tier's log.
+typedef struct {
+    uint32_t start_ms;
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+} flash_rollup_point_t;
+
+typedef struct {
+    flash_log_t log;
+    uint32_t period_ms;
+    bool open;             // Whether a period is being accumulated.
+    uint32_t start_ms;
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} flash_rollup_tier_t;
+
+typedef struct {
+    flash_rollup_tier_t tiers[FLASH_ROLLUP_MAX_TIERS];
+    uint32_t tier_count;
+} flash_rollup_t;
+
+// Opens every tier's log, resuming after its newest stored point.
+flash_status_t flash_rollup_open(flash_rollup_t *rollup, const flash_rollup_tier_config_t *configs, uint32_t tier_count);
+
+// Folds a sample into every tier, storing the points of periods it closes.
+flash_status_t flash_rollup_add(flash_rollup_t *rollup, uint32_t timestamp_ms, float value);
+
+// Programs every tier's partly filled page so all stored points survive a power loss.
+flash_status_t flash_rollup_flush(flash_rollup_t *rollup);
+
+// Copies the points of one tier whose periods start within [from_ms, to_ms], oldest first,
+// ending with the period still being accumulated.
+flash_status_t flash_rollup_query(const flash_rollup_t *rollup, uint32_t tier, uint32_t from_ms, uint32_t to_ms,
+                                  flash_rollup_point_t *points, uint32_t max_points, uint32_t *point_count);
+
+// Shortest history the tier is guaranteed to hold, in milliseconds.
+uint64_t flash_rollup_retention_ms(const flash_rollup_t *rollup, uint32_t tier);
+
+#endif // FLASH_ROLLUP_H
@@ -0,0 +1,142 @@
+/**
+ * @file flash_table.c
+ *
+ * Implementation of the in-place tables declared in flash_table.h. The builder writes the buffer
+ * with memcpy only, so the caller's buffer needs no particular alignment; alignment matters only
+ * for the copy in flash, which the padding in front of the table takes care of.
+ */
+
+#include "flash_table.h"
+#include <string.h>
+#include "hardware/flash.h"
+
+#define ALIGN4(n) (((n) + 3u) & ~(size_t)3u)
+
+// Offset from the start of the table to the first optional field entry.
+static size_t entries_offset(uint16_t fixed_size) {
+    return sizeof(flash_table_t) + ALIGN4(fixed_size);
+}
+
+/**
+ * Starts a table. The fixed part is copied right away and every optional field starts absent.
+ * Errors are remembered and reported by flash_table_builder_finish, so building needs no checks
+ * after each call.
+ *
+ * @param b Builder to initialise.
+ * @param buffer Destination for the payload.
+ * @param capacity Size of the destination.
+ * @param fixed The fixed part, typically a struct.
+ * @param fixed_size Size of the fixed part.
+ * @param optional_count Number of optional fields the record type defines.
+ */
+void flash_table_builder_init(flash_table_builder_t *b, uint8_t *buffer, size_t capacity,
+                              const void *fixed, size_t fixed_size, uint16_t optional_count) {
+    b->buffer = buffer;
+    b->capacity = capacity;
+    b->fixed_size = (uint16_t)fixed_size;
+    b->optional_count = optional_count;
+    b->status = FLASH_OK;
+    b->length = FLASH_TABLE_PAD + entries_offset(b->fixed_size) + (size_t)optional_count * sizeof(uint32_t);
+
+    if (buffer == NULL || (fixed == NULL && fixed_size > 0)) {
+        b->status = FLASH_ERR_NULL_DATA;
+        return;
+    }
+    if (fixed_size > UINT16_MAX || b->length > capacity) {
+        b->status = FLASH_ERR_BUFFER_TOO_SMALL;
+        return;
+    }
+    memset(buffer, 0, b->length);
+    memcpy(buffer + FLASH_TABLE_PAD + sizeof(flash_table_t), fixed, fixed_size);
+}
+
+void flash_table_builder_add(flash_table_builder_t *b, uint16_t field, const void *data, size_t len) {
+    if (b->status != FLASH_OK) {
+        return;
+    }
+    if (field >= b->optional_count) {
+        b->status = FLASH_ERR_OUT_OF_BOUNDS;
+        return;
+    }
+    if (data == NULL || len == 0) {
+        b->status = FLASH_ERR_NULL_DATA;
+        return;
+    }
+
+    size_t position = FLASH_TABLE_PAD + ALIGN4(b->length - FLASH_TABLE_PAD);
+    size_t offset = position - FLASH_TABLE_PAD;
+    if (position + len > b->capacity || offset + len > UINT16_MAX || len > UINT16_MAX) {
+        b->status = FLASH_ERR_BUFFER_TOO_SMALL;
+        return;
+    }
+    memset(b->buffer + b->length, 0, position - b->length);
+    memcpy(b->buffer + position, data, len);
+    b->length = position + len;
+
+    uint32_t entry = (uint32_t)offset | ((uint32_t)len << 16);
+    memcpy(b->buffer + FLASH_TABLE_PAD + entries_offset(b->fixed_size) + field * sizeof(uint32_t), &entry, sizeof(entry));
+}
+
+flash_status_t flash_table_builder_finish(flash_table_builder_t *b, size_t *payload_len) {
+    if (b->status != FLASH_OK) {
+        return b->status;
+    }
+    flash_table_t header = {
+        .magic = FLASH_TABLE_MAGIC,
+        .fixed_size = b->fixed_size,
+        .optional_count = b->optional_count,
+        .table_size = (uint16_t)(b->length - FLASH_TABLE_PAD),
+    };
+    memcpy(b->buffer + FLASH_TABLE_PAD, &header, sizeof(header));
+    if (payload_len != NULL) {
+        *payload_len = b->length;
+    }
+    return FLASH_OK;
+}
+
+/**
+ * Locates the table in a sector and checks, once, everything the accessors rely on: the sector
+ * holds valid data, the magic matches, and the fixed part, offset table and every optional field
+ * lie within the stored payload.
+ *
+ * @param offset Sector offset from the start of the user region.
+ * @param table Receives a pointer to the table in XIP flash.
+ * @return FLASH_OK, FLASH_ERR_INVALID_DATA for a sector without a well-formed table, or the error
+ *         inspecting the sector.
+ */
+flash_status_t flash_table_open(uint32_t offset, const flash_table_t **table) {
+    if (table == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    uint32_t flash_offset;
+    flash_status_t status = flash_check_sector(offset, &flash_offset);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    flash_stat_t stat;
+    status = flash_stat(offset, &stat);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    if (!stat.valid || stat.data_len < FLASH_TABLE_PAD + sizeof(flash_table_t)) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    const flash_table_t *t = (const flash_table_t *)(XIP_BASE + flash_offset + FLASH_HEADER_SIZE + FLASH_TABLE_PAD);
+    size_t stored = stat.data_len - FLASH_TABLE_PAD;
+    size_t fields_start = entries_offset(t->fixed_size) + (size_t)t->optional_count * sizeof(uint32_t);
+    if (t->magic != FLASH_TABLE_MAGIC || t->table_size > stored || fields_start > t->table_size) {
+        return FLASH_ERR_INVALID_DATA;
+    }
+
+    const uint32_t *entries = (const uint32_t *)((const uint8_t *)t + entries_offset(t->fixed_size));
+    for (uint16_t i = 0; i < t->optional_count; i++) {
+        uint32_t field_offset = entries[i] & 0xFFFF, len = entries[i] >> 16;
+        if (entries[i] != 0 && (field_offset < fields_start || field_offset % 4 != 0 ||
+                                field_offset + len > t->table_size)) {
+            return FLASH_ERR_INVALID_DATA;
+        }
+    }
+    *table = t;
+    return FLASH_OK;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file flash_table.h
+ *
+ * Records that are read in place from XIP flash instead of being copied and deserialized, in the
+ * spirit of FlatBuffers. A table is stored as the payload of a sector written with
+ * flash_write_safe and consists of:
+ *
+ *     header (8) | fixed part | offset table | optional fields
+ *
+ * - The fixed part is a plain C struct holding the fields every record has. It is stored with its
+ *   in-memory layout, so a field is read through a struct pointer into flash with one load.
+ * - The offset table has one 32-bit entry per optional field: the field's offset from the start of
+ *   the table in the low half and its length in the high half, or zero when the field is absent.
+ *   Reading an optional field costs the entry load plus the field load.
+ * - Optional fields follow, each starting on a 4-byte boundary.
+ *
+ * The builder pads the front of the payload so that the table itself starts on a 4-byte boundary
+ * in flash; structs in the fixed part, and optional fields read as scalars, must not need more
+ * than 4-byte alignment. Fields are stored in the byte order of the device (little-endian), so
+ * tables are not portable to big-endian readers.
+ *
+ * flash_table_open checks the sector header and the table's bounds once; the accessors that follow
+ * do no checking at all. Call flash_verify_sector first when the payload checksum matters.
+ */
+
+#ifndef FLASH_TABLE_H
+#define FLASH_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "flash_ops.h"
+#include "flash_ops_helper.h"
+
+#define FLASH_TABLE_MAGIC 0x5446 // "FT"
+// Bytes in front of the table that bring it onto a 4-byte boundary after the sector header.
+#define FLASH_TABLE_PAD ((4 - FLASH_HEADER_SIZE % 4) % 4)
+
+typedef struct {
+    uint16_t magic;
+    uint16_t fixed_size;     // Bytes in the fixed part.
+    uint16_t optional_count; // Entries in the offset table.
+    uint16_t table_size;     // Bytes in the whole table, header included.
+} flash_table_t;
+
+// Lays out a table in a caller-provided buffer.
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;           // Bytes used so far, padding included.
+    uint16_t fixed_size;
+    uint16_t optional_count;
+    flash_status_t status;   // First error hit while building, reported by finish.
+} flash_table_builder_t;
+
+// Starts a table with the given fixed part and room for `optional_count` optional fields.
+void flash_table_builder_init(flash_table_builder_t *b, uint8_t *buffer, size_t capacity,
+                              const void *fixed, size_t fixed_size, uint16_t optional_count);
+
+// Stores optional field `field`.
+void flash_table_builder_add(flash_table_builder_t *b, uint16_t field, const void *data, size_t len);
+
+// Completes the table; the first `*payload_len` bytes of the buffer go to flash_write_safe.
+flash_status_t flash_table_builder_finish(flash_table_builder_t *b, size_t *payload_len);
+
+// Returns the table stored in a sector, in place in XIP flash, after checking its header and bounds.
+flash_status_t flash_table_open(uint32_t offset, const flash_table_t **table);
+
+// The fixed part.
+static inline const void *flash_table_fixed(const flash_table_t *table) {
+    return (const uint8_t *)table + sizeof(flash_table_t);
+}
+
+// Typed access to the fixed part: FLASH_TABLE_FIXED(table, DeviceConfig)->sensor_value.
+#define FLASH_TABLE_FIXED(table, type) ((const type *)flash_table_fixed(table))
+
+// An optional field and its length, or NULL if the record does not have it.
+static inline const void *flash_table_optional(const flash_table_t *table, uint16_t field, size_t *len) {
+    const uint32_t *entries = (const uint32_t *)((const uint8_t *)table + sizeof(flash_table_t) +
+                                                 ((table->fixed_size + 3u) & ~3u));
+    uint32_t entry = field < table->optional_count ? entries[field] : 0;
+    if (len != NULL) {
+        *len = entry >> 16;
+    }
+    return entry ? (const uint8_t *)table + (entry & 0xFFFF) : NULL;
+}
+
+// An optional 32-bit field, or `fallback` if the record does not have it.
+static inline uint32_t flash_table_u32(const flash_table_t *table, uint16_t field, uint32_t fallback) {
+    size_t len;
+    const uint32_t *value = (const uint32_t *)flash_table_optional(table, field, &len);
+    return value != NULL && len == sizeof(uint32_t) ? *value : fallback;
+}
+
+#endif // FLASH_TABLE_H
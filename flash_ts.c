@@ -0,0 +1,524 @@
+/**
+ * @file flash_ts.c
+ *
+ * Implementation of the compressed time series declared in flash_ts.h. The encoder works out the
+ * exact size of a sample's bits before writing any of them, so a sample that does not fit leaves
+ * the block untouched and simply goes into the next one.
+ */
+
+#include "flash_ts.h"
+#include <string.h>
+#include <math.h>
+
+#define PAYLOAD_BITS ((FLASH_TS_BLOCK_SIZE - FLASH_TS_BLOCK_HEADER) * 8)
+#define NO_WINDOW 0xFF
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static void put_float(uint8_t *p, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(p, bits);
+}
+
+static void put_double(uint8_t *p, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(p, (uint32_t)bits);
+    put_u32(p + 4, (uint32_t)(bits >> 32));
+}
+
+static double get_double(const uint8_t *p) {
+    uint64_t bits = (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static float get_float(const uint8_t *p) {
+    uint32_t bits = get_u32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/**
+ * Appends the low `n` bits of `value` (n <= 32) to the payload, up to a byte at a time.
+ */
+static void put_bits(flash_ts_encoder_t *enc, uint32_t value, unsigned n) {
+    uint8_t *payload = enc->block + FLASH_TS_BLOCK_HEADER;
+    while (n > 0) {
+        unsigned space = 8 - (enc->bit_pos & 7);
+        unsigned take = n < space ? n : space;
+        uint32_t chunk = (value >> (n - take)) & ((1u << take) - 1);
+        payload[enc->bit_pos >> 3] |= (uint8_t)(chunk << (space - take));
+        enc->bit_pos += take;
+        n -= take;
+    }
+}
+
+/**
+ * Reads `n` bits (n <= 32) from the payload; returns false if that would run past the block.
+ */
+static bool get_bits(flash_ts_decoder_t *dec, unsigned n, uint32_t *value) {
+    if (dec->bit_pos + n > PAYLOAD_BITS) {
+        return false;
+    }
+    const uint8_t *payload = dec->block + FLASH_TS_BLOCK_HEADER;
+    uint32_t result = 0;
+    while (n > 0) {
+        unsigned avail = 8 - (dec->bit_pos & 7);
+        unsigned take = n < avail ? n : avail;
+        uint32_t byte = payload[dec->bit_pos >> 3];
+        result = (result << take) | ((byte >> (avail - take)) & ((1u << take) - 1));
+        dec->bit_pos += take;
+        n -= take;
+    }
+    *value = result;
+    return true;
+}
+
+/**
+ * Chooses the code for a delta-of-delta: a prefix of up to four bits followed by a biased value.
+ * Returns the total bit count and sets the prefix, its length and the value bits.
+ */
+static unsigned timestamp_code(int64_t dod, uint32_t raw, uint32_t *prefix, unsigned *prefix_len, uint32_t *field, unsigned *field_len) {
+    if (dod == 0) {
+        *prefix = 0x0; *prefix_len = 1; *field_len = 0;
+    } else if (dod >= -63 && dod <= 64) {
+        *prefix = 0x2; *prefix_len = 2; *field = (uint32_t)(dod + 63); *field_len = 7;
+    } else if (dod >= -255 && dod <= 256) {
+        *prefix = 0x6; *prefix_len = 3; *field = (uint32_t)(dod + 255); *field_len = 9;
+    } else if (dod >= -2047 && dod <= 2048) {
+        *prefix = 0xE; *prefix_len = 4; *field = (uint32_t)(dod + 2047); *field_len = 12;
+    } else {
+        *prefix = 0xF; *prefix_len = 4; *field = raw; *field_len = 32;
+    }
+    return *prefix_len + *field_len;
+}
+
+/**
+ * Writes the encoder's running zone map into the block header.
+ */
+static void update_zone_map(flash_ts_encoder_t *enc, uint32_t last_ts) {
+    put_u32(enc->block + 10, last_ts);
+    put_float(enc->block + 14, enc->min);
+    put_float(enc->block + 18, enc->max);
+    put_double(enc->block + 22, enc->sum);
+}
+
+void flash_ts_encoder_reset(flash_ts_encoder_t *enc) {
+    memset(enc, 0, sizeof(*enc));
+    enc->leading = NO_WINDOW;
+}
+
+/**
+ * Adds a sample to the block being built. The first sample goes into the header; every later one
+ * costs a timestamp code followed by a value code.
+ *
+ * @param enc The encoder.
+ * @param timestamp_ms Sample time; consecutive samples may be any distance apart.
+ * @param value The sample.
+ * @return true if the sample was added, false if the block is full.
+ */
+bool flash_ts_encoder_append(flash_ts_encoder_t *enc, uint32_t timestamp_ms, float value) {
+    uint32_t bits = float_bits(value);
+
+    if (enc->count == 0) {
+        put_u32(enc->block + 2, timestamp_ms);
+        put_u32(enc->block + 6, bits);
+        enc->prev_ts = timestamp_ms;
+        enc->prev_delta = 0;
+        enc->prev_bits = bits;
+        enc->count = 1;
+        enc->block[0] = 1;
+        enc->block[1] = 0;
+        enc->min = value;
+        enc->max = value;
+        enc->sum = value;
+        update_zone_map(enc, timestamp_ms);
+        return true;
+    }
+    if (enc->count == UINT16_MAX) {
+        return false;
+    }
+
+    // Timestamp: the change in delta, computed wide enough that it cannot overflow.
+    int32_t delta = (int32_t)(timestamp_ms - enc->prev_ts);
+    int64_t dod = (int64_t)delta - enc->prev_delta;
+    uint32_t ts_prefix, ts_field = 0;
+    unsigned ts_prefix_len, ts_field_len;
+    unsigned needed = timestamp_code(dod, (uint32_t)delta - (uint32_t)enc->prev_delta,
+                                     &ts_prefix, &ts_prefix_len, &ts_field, &ts_field_len);
+
+    // Value: nothing, the bits inside the previous window, or a new window.
+    uint32_t xor = bits ^ enc->prev_bits;
+    unsigned leading = 0, trailing = 0;
+    bool reuse = false;
+    if (xor == 0) {
+        needed += 1;
+    } else {
+        leading = (unsigned)__builtin_clz(xor);
+        trailing = (unsigned)__builtin_ctz(xor);
+        reuse = enc->leading != NO_WINDOW && leading >= enc->leading && trailing >= enc->trailing;
+        if (reuse) {
+            needed += 2 + (32 - enc->leading - enc->trailing);
+        } else {
+            needed += 2 + 5 + 5 + (32 - leading - trailing);
+        }
+    }
+    if (enc->bit_pos + needed > PAYLOAD_BITS) {
+        return false;
+    }
+
+    put_bits(enc, ts_prefix, ts_prefix_len);
+    put_bits(enc, ts_field, ts_field_len);
+    if (xor == 0) {
+        put_bits(enc, 0, 1);
+    } else if (reuse) {
+        put_bits(enc, 0x2, 2);
+        put_bits(enc, xor >> enc->trailing, 32 - enc->leading - enc->trailing);
+    } else {
+        unsigned len = 32 - leading - trailing;
+        put_bits(enc, 0x3, 2);
+        put_bits(enc, leading, 5);
+        put_bits(enc, len - 1, 5);
+        put_bits(enc, xor >> trailing, len);
+        enc->leading = (uint8_t)leading;
+        enc->trailing = (uint8_t)trailing;
+    }
+
+    enc->prev_ts = timestamp_ms;
+    enc->prev_delta = delta;
+    enc->prev_bits = bits;
+    enc->count++;
+    enc->block[0] = (uint8_t)enc->count;
+    enc->block[1] = (uint8_t)(enc->count >> 8);
+
+    // Comparisons with NaN are false, so NaN never becomes the min or max.
+    if (value < enc->min || isnan(enc->min)) {
+        enc->min = value;
+    }
+    if (value > enc->max || isnan(enc->max)) {
+        enc->max = value;
+    }
+    enc->sum += value;
+    update_zone_map(enc, timestamp_ms);
+    return true;
+}
+
+void flash_ts_decoder_init(flash_ts_decoder_t *dec, const uint8_t *block) {
+    memset(dec, 0, sizeof(*dec));
+    dec->block = block;
+    dec->count = (uint16_t)(block[0] | (block[1] << 8));
+    dec->remaining = dec->count;
+    dec->leading = NO_WINDOW;
+}
+
+/**
+ * Decodes the next sample of the block. Only the bits of this one sample are read, so decoding
+ * from XIP touches flash sequentially and nothing is buffered.
+ *
+ * @param dec The decoder.
+ * @param timestamp_ms Receives the sample time.
+ * @param value Receives the sample.
+ * @return true if a sample was produced, false at the end of the block or if it is malformed.
+ */
+bool flash_ts_decoder_next(flash_ts_decoder_t *dec, uint32_t *timestamp_ms, float *value) {
+    if (dec->remaining == 0) {
+        return false;
+    }
+
+    if (dec->remaining == dec->count) {
+        dec->ts = get_u32(dec->block + 2);
+        dec->bits = get_u32(dec->block + 6);
+    } else {
+        // Count the prefix ones, up to four, to find the timestamp bucket.
+        unsigned ones = 0;
+        uint32_t bit;
+        while (ones < 4) {
+            if (!get_bits(dec, 1, &bit)) {
+                return false;
+            }
+            if (bit == 0) {
+                break;
+            }
+            ones++;
+        }
+
+        static const unsigned field_len[] = {0, 7, 9, 12, 32};
+        static const int32_t bias[] = {0, 63, 255, 2047, 0};
+        uint32_t field = 0;
+        if (field_len[ones] > 0 && !get_bits(dec, field_len[ones], &field)) {
+            return false;
+        }
+        if (ones == 4) {
+            dec->delta = (int32_t)((uint32_t)dec->delta + field);
+        } else {
+            dec->delta += (int32_t)field - bias[ones];
+        }
+        dec->ts += (uint32_t)dec->delta;
+
+        uint32_t control;
+        if (!get_bits(dec, 1, &control)) {
+            return false;
+        }
+        if (control == 1) {
+            if (!get_bits(dec, 1, &control)) {
+                return false;
+            }
+            if (control == 1) {
+                uint32_t leading, len;
+                if (!get_bits(dec, 5, &leading) || !get_bits(dec, 5, &len) || leading + len + 1 > 32) {
+                    return false;
+                }
+                dec->leading = (uint8_t)leading;
+                dec->trailing = (uint8_t)(32 - leading - (len + 1));
+            } else if (dec->leading == NO_WINDOW) {
+                return false;
+            }
+            uint32_t meaningful;
+            if (!get_bits(dec, 32 - dec->leading - dec->trailing, &meaningful)) {
+                return false;
+            }
+            dec->bits ^= meaningful << dec->trailing;
+        }
+    }
+
+    dec->remaining--;
+    *timestamp_ms = dec->ts;
+    memcpy(value, &dec->bits, sizeof(*value));
+    return true;
+}
+
+/**
+ * Opens a series. Sealed blocks are found again in the log; the block that was being filled when
+ * power was lost is gone, so call flash_ts_seal before a planned shutdown.
+ *
+ * @param store Series state to fill in.
+ * @param first_offset User-region offset of the first sector.
+ * @param sectors Number of consecutive sectors; at least two.
+ * @return The status of opening the underlying log.
+ */
+flash_status_t flash_ts_open(flash_ts_store_t *store, uint32_t first_offset, uint32_t sectors) {
+    if (store == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    flash_ts_encoder_reset(&store->encoder);
+    return flash_log_open(&store->log, first_offset, sectors, FLASH_TS_BLOCK_SIZE);
+}
+
+flash_status_t flash_ts_seal(flash_ts_store_t *store) {
+    if (store == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (store->encoder.count == 0) {
+        return FLASH_OK;
+    }
+    // A block that could not be written stays in the encoder so that sealing can be retried.
+    flash_status_t status = flash_log_append(&store->log, store->encoder.block);
+    if (status == FLASH_OK) {
+        flash_ts_encoder_reset(&store->encoder);
+    }
+    return status;
+}
+
+flash_status_t flash_ts_append(flash_ts_store_t *store, uint32_t timestamp_ms, float value) {
+    if (store == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    if (flash_ts_encoder_append(&store->encoder, timestamp_ms, value)) {
+        return FLASH_OK;
+    }
+
+    // The block is full: seal it and start the next one with this sample. If sealing fails the
+    // sample is not taken, and the caller can append it again.
+    flash_status_t status = flash_ts_seal(store);
+    if (status != FLASH_OK) {
+        return status;
+    }
+    flash_ts_encoder_append(&store->encoder, timestamp_ms, value);
+    return FLASH_OK;
+}
+
+/**
+ * Returns a sealed block for decoding. Blocks already programmed are returned in place; only a
+ * block whose last page is still in the log's RAM page is copied, into the store's scratch block.
+ *
+ * @param store An opened series.
+ * @param index Block index between flash_log_first and flash_log_end of store->log.
+ * @param block Receives a pointer to the block.
+ * @return FLASH_OK or the log's error for the index.
+ */
+flash_status_t flash_ts_block(flash_ts_store_t *store, uint64_t index, const uint8_t **block) {
+    if (store == NULL || block == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    const uint8_t *in_flash = flash_log_record_ptr(&store->log, index);
+    if (in_flash != NULL) {
+        *block = in_flash;
+        return FLASH_OK;
+    }
+    flash_status_t status = flash_log_read(&store->log, index, store->scratch);
+    if (status == FLASH_OK) {
+        *block = store->scratch;
+    }
+    return status;
+}
+
+/**
+ * Reads a block's zone map without decoding any samples.
+ *
+ * @param block A sealed block or an encoder's block.
+ * @param summary Receives count, timestamps, min, max and sum; the work counters are zeroed.
+ */
+void flash_ts_block_summary(const uint8_t *block, flash_ts_summary_t *summary) {
+    summary->count = (uint32_t)block[0] | ((uint32_t)block[1] << 8);
+    summary->first_ts = get_u32(block + 2);
+    summary->last_ts = get_u32(block + 10);
+    summary->min = get_float(block + 14);
+    summary->max = get_float(block + 18);
+    summary->sum = get_double(block + 22);
+    summary->blocks_summarized = 0;
+    summary->blocks_decoded = 0;
+}
+
+/**
+ * Adds one sample to a running aggregate.
+ */
+static void add_sample(flash_ts_summary_t *result, uint32_t ts, float value) {
+    if (result->count == 0) {
+        result->first_ts = ts;
+        result->min = value;
+        result->max = value;
+    }
+    if (value < result->min || isnan(result->min)) {
+        result->min = value;
+    }
+    if (value > result->max || isnan(result->max)) {
+        result->max = value;
+    }
+    result->sum += value;
+    result->last_ts = ts;
+    result->count++;
+}
+
+/**
+ * Folds one block into a query result: skipped if it lies outside the range, merged from its
+ * header if it lies entirely inside, and decoded only if it straddles an end of the range.
+ *
+ * @return false once the block starts after the range, so the caller can stop.
+ */
+static bool query_block(const uint8_t *block, uint32_t from_ms, uint32_t to_ms, flash_ts_summary_t *result) {
+    flash_ts_summary_t zone;
+    flash_ts_block_summary(block, &zone);
+    if (zone.count == 0 || zone.last_ts < from_ms) {
+        return true;
+    }
+    if (zone.first_ts > to_ms) {
+        return false;
+    }
+
+    if (zone.first_ts >= from_ms && zone.last_ts <= to_ms) {
+        if (result->count == 0) {
+            result->first_ts = zone.first_ts;
+            result->min = zone.min;
+            result->max = zone.max;
+        }
+        if (zone.min < result->min || isnan(result->min)) {
+            result->min = zone.min;
+        }
+        if (zone.max > result->max || isnan(result->max)) {
+            result->max = zone.max;
+        }
+        result->sum += zone.sum;
+        result->last_ts = zone.last_ts;
+        result->count += zone.count;
+        result->blocks_summarized++;
+        return true;
+    }
+
+    flash_ts_decoder_t dec;
+    uint32_t ts;
+    float value;
+    flash_ts_decoder_init(&dec, block);
+    while (flash_ts_decoder_next(&dec, &ts, &value) && ts <= to_ms) {
+        if (ts >= from_ms) {
+            add_sample(result, ts, value);
+        }
+    }
+    result->blocks_decoded++;
+    return true;
+}
+
+/**
+ * Aggregates the samples in a time range. The first block of each log sector serves as a sparse
+ * index: a binary search over those headers finds the sector where the range starts, and from
+ * there blocks are read in order until one starts after the range. The cost grows with the
+ * number of blocks the range touches plus the logarithm of the number of sectors, and only the
+ * blocks at the two ends of the range are ever decoded.
+ *
+ * @param store An opened series.
+ * @param from_ms First timestamp of the range, inclusive.
+ * @param to_ms Last timestamp of the range, inclusive.
+ * @param result Receives the aggregate; count is 0 if no sample lies in the range.
+ * @return FLASH_OK or FLASH_ERR_NULL_DATA.
+ */
+flash_status_t flash_ts_query(flash_ts_store_t *store, uint32_t from_ms, uint32_t to_ms, flash_ts_summary_t *result) {
+    if (store == NULL || result == NULL) {
+        return FLASH_ERR_NULL_DATA;
+    }
+    memset(result, 0, sizeof(*result));
+
+    const flash_log_t *log = &store->log;
+    uint64_t first = flash_log_first(log);
+    uint64_t end = flash_log_end(log);
+    uint32_t per_sector = log->records_per_sector;
+
+    // Find the last sector whose first block starts at or before from_ms.
+    uint64_t lo = first / per_sector, hi = end > first ? (end - 1) / per_sector : lo;
+    uint64_t start_sector = lo;
+    while (end > first && lo <= hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint64_t index = mid * per_sector < first ? first : mid * per_sector;
+        const uint8_t *block;
+        if (flash_ts_block(store, index, &block) != FLASH_OK) {
+            break;
+        }
+        if (get_u32(block + 2) <= from_ms) {
+            start_sector = mid;
+            lo = mid + 1;
+        } else if (mid == 0) {
+            break;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    uint64_t index = start_sector * per_sector < first ? first : start_sector * per_sector;
+    for (; index < end; index++) {
+        const uint8_t *block;
+        if (flash_ts_block(store, index, &block) != FLASH_OK || !query_block(block, from_ms, to_ms, result)) {
+            return FLASH_OK;
+        }
+    }
+
+    // The block still being filled is part of the series too.
+    query_block(store->encoder.block, from_ms, to_ms, result);
+    return FLASH_OK;
+}
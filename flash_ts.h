@@ -0,0 +1,118 @@
+/**
+ * @file flash_ts.h
+ *
+ * Compressed time series of sensor_value samples. Samples are packed into blocks of
+ * FLASH_TS_BLOCK_SIZE bytes using the scheme from Facebook's Gorilla paper:
+ *
+ * - Timestamps are stored as the difference between consecutive deltas. A steady sample rate
+ *   gives a delta-of-delta of zero, which costs a single bit; jitter falls into 7, 9 or 12 bit
+ *   buckets and anything larger is stored in full.
+ * - Values are XORed with the previous value. An unchanged value costs one bit; otherwise only
+ *   the meaningful bits between the leading and trailing zeros are stored, reusing the previous
+ *   window when the new bits fit inside it.
+ *
+ * A block starts with a 30-byte header followed by the bit stream, most significant bit first:
+ *
+ *     count (2) | first timestamp (4) | first value (4) | last timestamp (4) | min (4) | max (4) | sum (8)
+ *
+ * The last five fields are the block's zone map. They are kept current as samples are added, so
+ * an aggregate over whole blocks is answered from headers alone and a time range query skips
+ * every block whose timestamps lie outside the range without decoding it. The first block of
+ * each log sector doubles as a sparse index: a binary search over those headers finds where a
+ * range starts. Queries assume timestamps never decrease. NaN samples are left out of min and
+ * max but do propagate into the sum. The sum is a double, as in flash_rollup, so a range gives
+ * the same sum to double precision whether its blocks come from headers or are decoded.
+ *
+ * Sealed blocks are appended as records to a flash_log, FLASH_TS_BLOCK_SIZE being chosen so that
+ * 16 blocks fill a log sector and each block costs about one page program. A decoder walks a
+ * block sample by sample straight from XIP and keeps only a few words of state.
+ */
+
+#ifndef FLASH_TS_H
+#define FLASH_TS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_log.h"
+
+#define FLASH_TS_BLOCK_SIZE ((FLASH_SECTOR_SIZE - FLASH_LOG_SECTOR_HEADER) / FLASH_PAGES_PER_SECTOR)
+#define FLASH_TS_BLOCK_HEADER 30
+
+// Aggregate over a set of samples, and the work done to compute it.
+typedef struct {
+    uint32_t count;
+    uint32_t first_ts;      // Timestamps of the first and last sample counted.
+    uint32_t last_ts;
+    float min;
+    float max;
+    double sum;
+    uint32_t blocks_summarized; // Blocks answered from their header alone.
+    uint32_t blocks_decoded;    // Blocks that straddled the range and had to be decoded.
+} flash_ts_summary_t;
+
+// Builds one block in RAM.
+typedef struct {
+    uint8_t block[FLASH_TS_BLOCK_SIZE];
+    uint32_t bit_pos;      // Bits used after the header.
+    uint16_t count;        // Samples in the block, also kept in the block header.
+    uint32_t prev_ts;
+    int32_t prev_delta;
+    uint32_t prev_bits;    // Bit pattern of the previous value.
+    uint8_t leading;       // Window of the previous stored XOR; leading > 32 means none yet.
+    uint8_t trailing;
+    float min;             // Zone map of the block, mirrored into its header.
+    float max;
+    double sum;
+} flash_ts_encoder_t;
+
+// Walks the samples of one block in order.
+typedef struct {
+    const uint8_t *block;
+    uint32_t bit_pos;
+    uint16_t remaining;
+    uint16_t count;
+    uint32_t ts;
+    int32_t delta;
+    uint32_t bits;
+    uint8_t leading;
+    uint8_t trailing;
+} flash_ts_decoder_t;
+
+// A compressed series: sealed blocks in a log plus the block being filled.
+typedef struct {
+    flash_log_t log;
+    flash_ts_encoder_t encoder;
+    uint8_t scratch[FLASH_TS_BLOCK_SIZE]; // Copy of a sealed block whose last page is not yet programmed.
+} flash_ts_store_t;
+
+// Empties an encoder.
+void flash_ts_encoder_reset(flash_ts_encoder_t *enc);
+
+// Adds a sample; returns false, leaving the block unchanged, when the sample does not fit.
+bool flash_ts_encoder_append(flash_ts_encoder_t *enc, uint32_t timestamp_ms, float value);
+
+// Starts decoding a block; works on RAM blocks and directly on blocks in XIP flash.
+void flash_ts_decoder_init(flash_ts_decoder_t *dec, const uint8_t *block);
+
+// Produces the next sample; returns false at the end of the block or on a malformed block.
+bool flash_ts_decoder_next(flash_ts_decoder_t *dec, uint32_t *timestamp_ms, float *value);
+
+// Opens a series stored in `sectors` sectors from `first_offset`.
+flash_status_t flash_ts_open(flash_ts_store_t *store, uint32_t first_offset, uint32_t sectors);
+
+// Adds a sample, sealing the current block into flash when it is full; on an error the sample was not added.
+flash_status_t flash_ts_append(flash_ts_store_t *store, uint32_t timestamp_ms, float value);
+
+// Seals the current block even if it is not full, e.g. before shutting down; on an error the block is kept for a retry.
+flash_status_t flash_ts_seal(flash_ts_store_t *store);
+
+// Returns a sealed block for decoding, from XIP when possible; see flash_log_first/end for indexes.
+flash_status_t flash_ts_block(flash_ts_store_t *store, uint64_t index, const uint8_t **block);
+
+// Reads the zone map from a block header.
+void flash_ts_block_summary(const uint8_t *block, flash_ts_summary_t *summary);
+
+// Aggregates every sample with from_ms <= timestamp <= to_ms, including the unsealed block.
+flash_status_t flash_ts_query(flash_ts_store_t *store, uint32_t from_ms, uint32_t to_ms, flash_ts_summary_t *result);
+
+#endif // FLASH_TS_H
@@ -0,0 +1,210 @@
+/**
+ * @file flash_typed.hpp
+ *
+ * Header-only C++17 layer over the C flash library for trivially copyable record types.
+ *
+ * - FlashRecord<T> keeps one T in a sector, stored as the fixed part of a flash_table so that it
+ *   can be read in place. write and read copy a T in or out; view returns a RecordView<T> pointing
+ *   straight into XIP flash.
+ * - FlashLogWriter<T> streams T records into a flash_log. It is move-only and flushes the log's
+ *   partly filled page when it goes out of scope, so every record appended through it survives a
+ *   power loss once the writer is gone.
+ * - view_log_record returns a RecordView<T> of one record of such a log.
+ * - Geometry<SizeBytes> is the layout of flash_geometry.h as constexpr values for any flash size,
+ *   for code that is specialised per board; BoardGeometry is the one this build targets.
+ *
+ * Everything that can be checked about T (trivially copyable, fits the sector payload or a log
+ * record, alignment within what the XIP mapping guarantees) is checked by static_assert. The
+ * member functions are thin inline wrappers around the C calls, so the typed layer compiles to
+ * the same calls a C caller would make.
+ *
+ * A view is valid until its sector is next written or erased; the C library cannot tell it when
+ * that happens, so keep views short-lived, typically within one scope.
+ */
+
+#ifndef FLASH_TYPED_HPP
+#define FLASH_TYPED_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+extern "C" {
+#include "flash_ops.h"
+#include "flash_ops_helper.h"
+#include "flash_table.h"
+#include "flash_log.h"
+}
+
+namespace flash {
+
+// The flash layout for a part of `SizeBytes`, with the same rules flash_geometry.h enforces.
+template <uint32_t SizeBytes>
+struct Geometry {
+    static constexpr uint32_t kSize = SizeBytes;
+    static constexpr uint32_t kSectorSize = FLASH_SECTOR_SIZE;
+    static constexpr uint32_t kPageSize = FLASH_PAGE_SIZE;
+    static constexpr uint32_t kTargetOffset = FLASH_TARGET_OFFSET;
+    static constexpr uint32_t kSystemSectors = FLASH_SYSTEM_SECTORS_FOR(SizeBytes);
+    static constexpr uint32_t kUserRegionSize = SizeBytes - FLASH_TARGET_OFFSET - kSystemSectors * FLASH_SECTOR_SIZE;
+    static constexpr uint32_t kUserSectors = kUserRegionSize / FLASH_SECTOR_SIZE;
+    static constexpr uint32_t kLastUserSector = kUserRegionSize - FLASH_SECTOR_SIZE;
+
+    static_assert((SizeBytes & (SizeBytes - 1)) == 0 && SizeBytes >= 1024 * 1024 && SizeBytes <= 16 * 1024 * 1024,
+                  "flash size must be a power of two between 1 MB and the 16 MB XIP window");
+    static_assert(SizeBytes > FLASH_TARGET_OFFSET + (kSystemSectors + 1) * FLASH_SECTOR_SIZE,
+                  "flash is too small for the program, the system sectors and one user sector");
+
+    // Same rule as flash_check_sector: aligned, and the whole sector inside the user region.
+    static constexpr bool valid_sector(uint32_t offset) {
+        return (offset & FLASH_SECTOR_MASK) == 0 && offset <= kLastUserSector;
+    }
+};
+
+using Geometry2MB = Geometry<2u * 1024 * 1024>;
+using Geometry4MB = Geometry<4u * 1024 * 1024>;
+using Geometry16MB = Geometry<16u * 1024 * 1024>;
+using BoardGeometry = Geometry<FLASH_SIZE>;
+
+static_assert(BoardGeometry::kUserSectors == FLASH_USER_SECTORS && BoardGeometry::kLastUserSector == FLASH_LAST_USER_SECTOR,
+              "flash_geometry.h and flash::Geometry disagree");
+
+// Bytes a FlashRecord<T> has for its T once the sector header, padding and table header are taken.
+constexpr std::size_t kRecordPayloadMax = FLASH_SECTOR_SIZE - FLASH_HEADER_SIZE - FLASH_TABLE_PAD - sizeof(flash_table_t);
+
+// A T read in place from XIP flash. Move-only, so a view is handed on rather than duplicated.
+template <typename T>
+class RecordView {
+public:
+    RecordView(const T *record, flash_status_t status) : record_(record), status_(status) {}
+    RecordView(RecordView &&other) noexcept : record_(other.record_), status_(other.status_) {
+        other.record_ = nullptr;
+    }
+    RecordView &operator=(RecordView &&other) noexcept {
+        record_ = other.record_;
+        status_ = other.status_;
+        other.record_ = nullptr;
+        return *this;
+    }
+    RecordView(const RecordView &) = delete;
+    RecordView &operator=(const RecordView &) = delete;
+
+    explicit operator bool() const { return record_ != nullptr; }
+    flash_status_t status() const { return status_; }
+    const T &operator*() const { return *record_; }
+    const T *operator->() const { return record_; }
+    const T *get() const { return record_; }
+
+private:
+    const T *record_;
+    flash_status_t status_;
+};
+
+// One T kept in the sector at a user-region offset.
+template <typename T>
+class FlashRecord {
+    static_assert(std::is_trivially_copyable_v<T>, "FlashRecord<T> stores the bytes of T, so T must be trivially copyable");
+    static_assert(sizeof(T) <= kRecordPayloadMax, "T does not fit in one sector payload");
+    static_assert(alignof(T) <= 4, "tables in XIP are only 4-byte aligned");
+
+public:
+    // Bytes written to the sector payload for one T.
+    static constexpr std::size_t kStoredSize = FLASH_TABLE_PAD + sizeof(flash_table_t) + sizeof(T);
+
+    constexpr explicit FlashRecord(uint32_t offset) : offset_(offset) {}
+
+    // A record whose offset is a constant can be checked against the board's flash at build time.
+    template <uint32_t Offset>
+    static constexpr FlashRecord at() {
+        static_assert(BoardGeometry::valid_sector(Offset), "record offset is not a user sector on this board");
+        return FlashRecord(Offset);
+    }
+
+    constexpr uint32_t offset() const { return offset_; }
+
+    flash_status_t write(const T &value) const {
+        uint8_t buffer[kStoredSize];
+        flash_table_builder_t builder;
+        std::size_t len = 0;
+        flash_table_builder_init(&builder, buffer, sizeof(buffer), &value, sizeof(T), 0);
+        flash_status_t status = flash_table_builder_finish(&builder, &len);
+        return status == FLASH_OK ? flash_write_safe(offset_, buffer, len) : status;
+    }
+
+    RecordView<T> view() const {
+        const flash_table_t *table = nullptr;
+        flash_status_t status = flash_table_open(offset_, &table);
+        if (status == FLASH_OK && table->fixed_size != sizeof(T)) {
+            status = FLASH_ERR_INVALID_DATA;
+        }
+        return RecordView<T>(status == FLASH_OK ? FLASH_TABLE_FIXED(table, T) : nullptr, status);
+    }
+
+    flash_status_t read(T &value) const {
+        RecordView<T> v = view();
+        if (v) {
+            std::memcpy(&value, v.get(), sizeof(T));
+        }
+        return v.status();
+    }
+
+private:
+    uint32_t offset_;
+};
+
+// Streams T records into a flash_log opened for sizeof(T) records; flushes when destroyed.
+template <typename T>
+class FlashLogWriter {
+    static_assert(std::is_trivially_copyable_v<T>, "log records are the bytes of T, so T must be trivially copyable");
+    static_assert(sizeof(T) <= FLASH_LOG_MAX_RECORD, "T is larger than a log record may be");
+
+public:
+    explicit FlashLogWriter(flash_log_t &log) : log_(&log) {}
+    FlashLogWriter(FlashLogWriter &&other) noexcept : log_(other.log_) { other.log_ = nullptr; }
+    FlashLogWriter &operator=(FlashLogWriter &&other) noexcept {
+        if (this != &other) {
+            flush();
+            log_ = other.log_;
+            other.log_ = nullptr;
+        }
+        return *this;
+    }
+    FlashLogWriter(const FlashLogWriter &) = delete;
+    FlashLogWriter &operator=(const FlashLogWriter &) = delete;
+    ~FlashLogWriter() { flush(); }
+
+    // Opens `log` for T records and returns a writer for it; check `status` before appending.
+    static FlashLogWriter open(flash_log_t &log, uint32_t first_offset, uint32_t sectors, flash_status_t &status) {
+        status = flash_log_open(&log, first_offset, sectors, sizeof(T));
+        return FlashLogWriter(log);
+    }
+
+    flash_status_t append(const T &record) {
+        return log_ != nullptr ? flash_log_append(log_, &record) : FLASH_ERR_NULL_DATA;
+    }
+
+    flash_status_t flush() {
+        return log_ != nullptr ? flash_log_flush(log_) : FLASH_OK;
+    }
+
+private:
+    flash_log_t *log_;
+};
+
+// One record of a log of T, in place; empty if it is not entirely in flash yet or was overwritten.
+template <typename T>
+RecordView<T> view_log_record(const flash_log_t &log, uint64_t index) {
+    static_assert(std::is_trivially_copyable_v<T>, "log records are the bytes of T, so T must be trivially copyable");
+    static_assert(alignof(T) <= FLASH_LOG_SECTOR_HEADER && sizeof(T) % alignof(T) == 0,
+                  "records of T would not be aligned in the log");
+    if (log.record_size != sizeof(T)) {
+        return RecordView<T>(nullptr, FLASH_ERR_INVALID_DATA);
+    }
+    const uint8_t *record = flash_log_record_ptr(&log, index);
+    return RecordView<T>(reinterpret_cast<const T *>(record), record != nullptr ? FLASH_OK : FLASH_ERR_OUT_OF_BOUNDS);
+}
+
+} // namespace flash
+
+#endif // FLASH_TYPED_HPP
@@ -0,0 +1,171 @@
+/**
+ * @file flash_wear.c
+ *
+ * Implementation of the incremental wear scan declared in flash_wear.h. A pass accumulates the
+ * count, sum and sum of squares of the write counts so the mean and standard deviation can be
+ * derived once at the end without keeping per-sector state. The erase rate is taken from the
+ * growth of the total write count between consecutive passes, because every write and every
+ * erase performed by the library adds exactly one to the count of the sector it touches.
+ */
+
+#include "flash_wear.h"
+#include "flash_ops.h"
+#include "flash_ops_helper.h"
+#include <math.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+// Weight given to the newest rate sample; lower values smooth out bursts of activity.
+#define WEAR_RATE_SMOOTHING 0.25f
+
+#define US_PER_HOUR 3600000000.0f
+
+/**
+ * Clears the accumulators of the pass in progress.
+ */
+static void wear_begin_pass(flash_wear_monitor_t *monitor) {
+    monitor->cursor = 0;
+    monitor->count = 0;
+    monitor->min = UINT32_MAX;
+    monitor->max = 0;
+    monitor->sum = 0;
+    monitor->sum_sq = 0;
+    memset(monitor->histogram, 0, sizeof(monitor->histogram));
+}
+
+/**
+ * Turns the accumulators of a finished pass into statistics and updates the erase rate.
+ */
+static void wear_finish_pass(flash_wear_monitor_t *monitor) {
+    flash_wear_stats_t *stats = &monitor->stats;
+    uint64_t now = time_us_64();
+
+    stats->sectors = monitor->count;
+    stats->total = monitor->sum;
+    stats->min = monitor->count ? monitor->min : 0;
+    stats->max = monitor->max;
+    memcpy(stats->histogram, monitor->histogram, sizeof(stats->histogram));
+
+    // Double precision keeps the difference of two large sums from cancelling out; it runs once per pass.
+    if (monitor->count > 0) {
+        double mean = (double)monitor->sum / monitor->count;
+        double variance = (double)monitor->sum_sq / monitor->count - mean * mean;
+        stats->mean = (float)mean;
+        stats->stddev = variance > 0.0 ? (float)sqrt(variance) : 0.0f;
+    } else {
+        stats->mean = 0.0f;
+        stats->stddev = 0.0f;
+    }
+
+    // Derive the erase rate from the growth of the total since the previous pass.
+    if (monitor->have_previous && now > monitor->last_time_us && monitor->sum >= monitor->last_total) {
+        float hours = (float)(now - monitor->last_time_us) / US_PER_HOUR;
+        float sample = (float)(monitor->sum - monitor->last_total) / hours;
+        if (monitor->rate_per_hour == 0.0f) {
+            monitor->rate_per_hour = sample;  // The first sample seeds the average directly.
+        } else {
+            monitor->rate_per_hour += WEAR_RATE_SMOOTHING * (sample - monitor->rate_per_hour);
+        }
+    }
+    monitor->have_previous = true;
+    monitor->last_total = monitor->sum;
+    monitor->last_time_us = now;
+    stats->erase_rate_per_hour = monitor->rate_per_hour;
+
+    // Project the lifetime assuming further wear is spread evenly over the region.
+    uint64_t budget = (uint64_t)FLASH_ENDURANCE_CYCLES * monitor->count;
+    uint64_t left = budget > monitor->sum ? budget - monitor->sum : 0;
+    stats->remaining_hours = monitor->rate_per_hour > 0.0f ? (float)left / monitor->rate_per_hour : -1.0f;
+    stats->worst_percent_used = 100.0f * (float)monitor->max / (float)FLASH_ENDURANCE_CYCLES;
+}
+
+/**
+ * Resets the monitor. No statistics are available until the first pass completes, and the erase
+ * rate needs a second completed pass.
+ *
+ * @param monitor The monitor to initialise.
+ */
+void flash_wear_init(flash_wear_monitor_t *monitor) {
+    flash_wear_init_range(monitor, 0, FLASH_USER_SECTORS);
+}
+
+/**
+ * Resets the monitor to cover a run of sectors only, so that each partition's wear and
+ * projected lifetime can be watched separately. The run is clipped to the user region.
+ *
+ * @param monitor The monitor to initialise.
+ * @param first_offset User-region offset of the first sector; must be sector aligned.
+ * @param sectors Number of sectors to monitor.
+ */
+void flash_wear_init_range(flash_wear_monitor_t *monitor, uint32_t first_offset, uint32_t sectors) {
+    memset(monitor, 0, sizeof(*monitor));
+    uint32_t first = first_offset / FLASH_SECTOR_SIZE;
+    monitor->first_offset = first * FLASH_SECTOR_SIZE;
+    monitor->sectors = first < FLASH_USER_SECTORS && sectors <= FLASH_USER_SECTORS - first ? sectors :
+                       first < FLASH_USER_SECTORS ? FLASH_USER_SECTORS - first : 0;
+    monitor->stats.remaining_hours = -1.0f;
+    wear_begin_pass(monitor);
+}
+
+/**
+ * Inspects up to max_sectors sectors of the monitored region. When the last sector has been
+ * inspected the pass is summarised into the statistics and a new pass starts on the next call.
+ *
+ * @param monitor The monitor holding the scan state.
+ * @param max_sectors Upper bound on the sectors inspected by this call; 0 completes the pass.
+ * @return true if this call completed a pass and refreshed the statistics.
+ */
+bool flash_wear_step(flash_wear_monitor_t *monitor, uint32_t max_sectors) {
+    uint32_t end = monitor->sectors;
+    if (max_sectors != 0 && end - monitor->cursor > max_sectors) {
+        end = monitor->cursor + max_sectors;
+    }
+
+    for (; monitor->cursor < end; monitor->cursor++) {
+        // Log, queue and time-series sectors have no record header and fail its checksum, yet they
+        // are the most erased sectors of all; flash_stat still reports their count from the
+        // erase-count log, so they are included like any other.
+        flash_stat_t stat;
+        flash_status_t status = flash_stat(monitor->first_offset + monitor->cursor * FLASH_SECTOR_SIZE, &stat);
+        if (status != FLASH_OK && status != FLASH_ERR_CRC) {
+            continue;
+        }
+
+        uint32_t wear = stat.write_count;
+        monitor->count++;
+        monitor->sum += wear;
+        monitor->sum_sq += (uint64_t)wear * wear;
+        if (wear < monitor->min) {
+            monitor->min = wear;
+        }
+        if (wear > monitor->max) {
+            monitor->max = wear;
+        }
+
+        // Sectors past their rated endurance land in the last bin.
+        uint32_t bin = (uint32_t)(((uint64_t)wear * FLASH_WEAR_HISTOGRAM_BINS) / FLASH_ENDURANCE_CYCLES);
+        if (bin >= FLASH_WEAR_HISTOGRAM_BINS) {
+            bin = FLASH_WEAR_HISTOGRAM_BINS - 1;
+        }
+        monitor->histogram[bin]++;
+    }
+
+    if (monitor->cursor < monitor->sectors) {
+        return false;
+    }
+
+    wear_finish_pass(monitor);
+    wear_begin_pass(monitor);
+    return true;
+}
+
+/**
+ * Returns the statistics of the most recent completed pass.
+ *
+ * @param monitor The monitor holding the scan state.
+ * @return Pointer into the monitor; valid until the next completed pass.
+ */
+const flash_wear_stats_t *flash_wear_stats(const flash_wear_monitor_t *monitor) {
+    return &monitor->stats;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file flash_wear.h
+ *
+ * Wear statistics and endurance projection for the user flash region. The per-sector write
+ * count that flash_write_safe, flash_erase_safe and flash_erase_unmanaged maintain, in sector
+ * headers and the erase-count log, is aggregated into a min/max/mean/stddev summary and a
+ * histogram of how much of the rated endurance each sector has used.
+ * The scan is incremental: each call to flash_wear_step inspects a bounded number of sectors,
+ * so it can run from the main loop without stalling the application. Sector headers are taken
+ * from the cached header table whenever it is warm, which makes a pass cost no flash reads.
+ */
+
+#ifndef FLASH_WEAR_H
+#define FLASH_WEAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Rated program/erase cycles per sector; the RP2040 boards use parts rated for 100k cycles.
+#ifndef FLASH_ENDURANCE_CYCLES
+#define FLASH_ENDURANCE_CYCLES 100000u
+#endif
+
+// Number of histogram bins; bin i counts sectors that used [i, i+1) / BINS of their endurance.
+#define FLASH_WEAR_HISTOGRAM_BINS 10
+
+/**
+ * Summary of one completed pass over the managed region.
+ */
+typedef struct {
+    uint32_t sectors;           // Number of sectors included in the pass.
+    uint32_t min;               // Lowest write count of any sector.
+    uint32_t max;               // Highest write count of any sector.
+    float mean;                 // Average write count.
+    float stddev;               // Standard deviation of the write counts.
+    uint64_t total;             // Sum of all write counts.
+    uint32_t histogram[FLASH_WEAR_HISTOGRAM_BINS]; // Sectors per endurance-used bin.
+    float erase_rate_per_hour;  // Smoothed recent erase rate over the whole region.
+    float remaining_hours;      // Projected lifetime if wear stays evenly spread; negative if unknown.
+    float worst_percent_used;   // Share of the endurance used by the most-worn sector.
+} flash_wear_stats_t;
+
+/**
+ * State of the incremental scan. Treat as opaque; initialise with flash_wear_init.
+ */
+typedef struct {
+    uint32_t first_offset;      // User-region offset of the first sector monitored.
+    uint32_t sectors;           // Sectors monitored.
+    uint32_t cursor;            // Next sector index to inspect.
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint64_t sum_sq;
+    uint32_t histogram[FLASH_WEAR_HISTOGRAM_BINS];
+    uint64_t last_total;        // Total write count of the previous completed pass.
+    uint64_t last_time_us;      // Time at which the previous pass completed.
+    bool have_previous;         // A previous pass exists to derive a rate from.
+    float rate_per_hour;        // Exponentially smoothed erase rate.
+    flash_wear_stats_t stats;   // Result of the most recent completed pass.
+} flash_wear_monitor_t;
+
+// Resets the monitor; the first completed pass establishes the baseline for the erase rate.
+void flash_wear_init(flash_wear_monitor_t *monitor);
+
+// As flash_wear_init, but monitors only the `sectors` sectors from `first_offset`, such as one partition.
+void flash_wear_init_range(flash_wear_monitor_t *monitor, uint32_t first_offset, uint32_t sectors);
+
+// Inspects up to max_sectors sectors; returns true when this call completed a pass.
+bool flash_wear_step(flash_wear_monitor_t *monitor, uint32_t max_sectors);
+
+// Returns the statistics of the most recent completed pass.
+const flash_wear_stats_t *flash_wear_stats(const flash_wear_monitor_t *monitor);
+
+#endif // FLASH_WEAR_H
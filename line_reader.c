@@ -0,0 +1,170 @@
+/**
+ * @file line_reader.c
+ *
+ * Implementation of the non-blocking console reader declared in line_reader.h. The ring buffer
+ * has exactly one producer (the chars-available callback, which may run in interrupt context)
+ * and one consumer (line_reader_poll in the main loop), so the indices need no locking: each side
+ * only writes its own index and reads the other's.
+ */
+
+#include "line_reader.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+static uint8_t ring[LINE_READER_RING];
+static volatile uint32_t ring_head;   // Written by the producer only.
+static volatile uint32_t ring_tail;   // Written by the consumer only.
+static volatile bool ring_stalled;   // The producer left input in the driver because the ring was full.
+
+static line_reader_write_fn echo_write;
+static line_reader_frame_fn frame_sink;
+
+#define ECHO_BUF_SIZE 128
+
+static char line[LINE_READER_MAX];
+static uint8_t echo[ECHO_BUF_SIZE];
+static size_t echo_len;
+static size_t line_len;
+static bool line_ready;
+static bool in_frame;
+
+/**
+ * Drains the characters the stdio driver has buffered into the ring. Registered as the stdio
+ * chars-available callback, so it runs as soon as USB data arrives and never blocks. When the
+ * ring is full the rest stays in the driver, which stops accepting USB packets until there is
+ * room: the host is throttled instead of losing bytes.
+ */
+static void on_chars_available(void *param) {
+    (void)param;
+    while (ring_head - ring_tail < LINE_READER_RING) {
+        int ch = getchar_timeout_us(0);
+        if (ch == PICO_ERROR_TIMEOUT || ch < 0) {
+            return;
+        }
+        uint32_t head = ring_head;
+        ring[head & (LINE_READER_RING - 1)] = (uint8_t)ch;
+        ring_head = head + 1;
+    }
+    ring_stalled = true;
+}
+
+/**
+ * Sends the pending echo output in one write.
+ */
+static void flush_echo(void) {
+    if (echo_len > 0 && echo_write != NULL) {
+        echo_write(echo, echo_len);
+    }
+    echo_len = 0;
+}
+
+/**
+ * Registers the chars-available callback and the sinks, and clears any partial line.
+ *
+ * @param echo Sink for echoed characters; may be NULL to disable echo.
+ * @param frame_byte Sink for binary frame bytes; may be NULL to discard frames.
+ */
+void line_reader_init(line_reader_write_fn echo, line_reader_frame_fn frame_byte) {
+    echo_write = echo;
+    frame_sink = frame_byte;
+    line_len = 0;
+    line_ready = false;
+    in_frame = false;
+    stdio_set_chars_available_callback(on_chars_available, NULL);
+}
+
+/**
+ * Queues bytes as if they had arrived from the stdio driver, for input from another source such
+ * as a second port or a test. Interrupts are off meanwhile, so the chars-available callback does
+ * not interleave its own bytes.
+ *
+ * @param data Bytes to queue.
+ * @param len Number of bytes.
+ * @return The number of bytes queued; fewer than len if the ring filled up.
+ */
+size_t line_reader_feed(const uint8_t *data, size_t len) {
+    uint32_t ints = save_and_disable_interrupts();
+    size_t queued = 0;
+    while (queued < len && ring_head - ring_tail < LINE_READER_RING) {
+        uint32_t head = ring_head;
+        ring[head & (LINE_READER_RING - 1)] = data[queued++];
+        ring_head = head + 1;
+    }
+    restore_interrupts(ints);
+    return queued;
+}
+
+/**
+ * Processes buffered input until a line completes or the ring is empty. All echo produced by one
+ * poll is sent with a single write (or one per ECHO_BUF_SIZE bytes), so pasting a long command
+ * costs a handful of USB transfers rather than one per character.
+ *
+ * @return The completed line without its terminator, or NULL if no line is complete yet.
+ */
+char *line_reader_poll(void) {
+    char *result = NULL;
+
+    // The previous line has been handed out; start a new one.
+    if (line_ready) {
+        line_ready = false;
+        line_len = 0;
+    }
+
+    while (result == NULL && ring_tail != ring_head) {
+        uint32_t tail = ring_tail;
+        uint8_t ch = ring[tail & (LINE_READER_RING - 1)];
+        ring_tail = tail + 1;
+
+        // Frame bytes bypass the editor; the second delimiter ends the frame.
+        if (in_frame || ch == 0) {
+            // Echo typed before the frame must reach the host before the frame's response.
+            if (!in_frame) {
+                flush_echo();
+            }
+            if (frame_sink != NULL) {
+                frame_sink(ch);
+            }
+            in_frame = !(in_frame && ch == 0);
+            continue;
+        }
+
+        if (ch == '\r' || ch == '\n') {
+            // An empty line (such as the \n of a \r\n pair) is not a command.
+            if (line_len > 0) {
+                line[line_len] = '\0';
+                line_ready = true;
+                result = line;
+                echo[echo_len++] = '\r';
+                echo[echo_len++] = '\n';
+            }
+        } else if (ch == '\b' || ch == 0x7F) {
+            if (line_len > 0) {
+                line_len--;
+                memcpy(echo + echo_len, "\b \b", 3);
+                echo_len += 3;
+            }
+        } else if (ch >= 32 && ch <= 126 && line_len < LINE_READER_MAX - 1) {
+            line[line_len++] = (char)ch;
+            echo[echo_len++] = ch;
+        }
+        // Non-printable characters are ignored.
+
+        // Keep room for the longest echo sequence.
+        if (echo_len + 3 > sizeof(echo)) {
+            flush_echo();
+        }
+    }
+
+    flush_echo();
+
+    // The driver only signals new data, so input left behind by a full ring is fetched here.
+    // Interrupts stay off meanwhile to keep the callback the ring's only active producer.
+    if (ring_stalled && ring_head - ring_tail < LINE_READER_RING) {
+        uint32_t ints = save_and_disable_interrupts();
+        ring_stalled = false;
+        on_chars_available(NULL);
+        restore_interrupts(ints);
+    }
+    return result;
+}
@@ -0,0 +1,40 @@
+/**
+ * @file line_reader.h
+ *
+ * Non-blocking console input. Characters are moved from the USB stdio driver into a ring buffer
+ * by the stdio chars-available callback, so nothing waits on getchar(). The main loop calls
+ * line_reader_poll whenever it likes; the poll edits the current line (printable characters and
+ * backspace), echoes everything it consumed in one write, and returns the line once Enter is seen.
+ *
+ * Binary protocol frames share the same input: a 0x00 byte switches the reader to frame mode, and
+ * every byte up to and including the next 0x00 goes to the frame sink instead of the line editor.
+ * That closing 0x00 returns the reader to the editor, so every frame must open with a 0x00 of its
+ * own; a single zero between two frames is not enough.
+ */
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LINE_READER_MAX 256       // Longest line, including the terminator.
+#define LINE_READER_RING 2048     // Input ring size; must be a power of two.
+
+// Writes echo output without newline translation.
+typedef void (*line_reader_write_fn)(const uint8_t *data, size_t len);
+
+// Receives the bytes of 0x00-delimited binary frames, delimiters included.
+typedef void (*line_reader_frame_fn)(uint8_t byte);
+
+// Registers the input callback and the echo and frame sinks.
+void line_reader_init(line_reader_write_fn echo, line_reader_frame_fn frame_byte);
+
+// Queues bytes as if they came from stdio; returns how many fit in the ring.
+size_t line_reader_feed(const uint8_t *data, size_t len);
+
+// Processes buffered input; returns a completed line (valid until the next poll) or NULL.
+char *line_reader_poll(void);
+
+#endif // LINE_READER_H
@@ -1,12 +1,18 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "test.h"
+#include "bench.h"
+#include "cli.h"
+#include "flash_erase_count.h"
 #include <stdlib.h>
 #include <string.h>
 
 
 int main() {
     stdio_init_all();
+
+    // Open the erase-count log before anything can erase; the first boot of a new layout formats it.
+    flash_erase_count_init();
  
     // Wait for USB connection
     while (!stdio_usb_connected()) {
@@ -17,6 +23,18 @@ int main() {
     run_all_tests();
 
     printf("buyeeeeeeee all tests...\n");
+
+    // Report throughput figures for the storage paths.
+    run_all_benchmarks();
+
+    // Serve text commands and binary protocol frames from here on.
+    printf("Ready for commands.\n");
+    cli_init();
+    while (true) {
+        // Input is buffered by interrupt, so the loop is free for other work between polls.
+        cli_poll();
+        tight_loop_contents();
+    }
     return 0;
 }
 
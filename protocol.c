@@ -0,0 +1,347 @@
+/**
+ * @file protocol.c
+ *
+ * Implementation of the binary framed protocol declared in protocol.h. Incoming bytes are
+ * collected until a 0x00 delimiter, decoded in place, checked against their length and CRC32C,
+ * and then either answered at once or queued for proto_poll (see protocol.h). Responses are
+ * assembled directly in a static transmit frame (flash reads land in it straight from XIP) and
+ * handed to the output sink in one call.
+ */
+
+#include "protocol.h"
+#include "cobs.h"
+#include "crc32c.h"
+#include "flash_ops.h"
+#include "flash_ops_helper.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+
+static proto_write_fn proto_write;
+
+// Encoded bytes of the frame being received; decoded in place once the delimiter arrives.
+static uint8_t rx_buf[COBS_MAX_ENCODED(PROTO_MAX_FRAME)];
+static size_t rx_len;
+static bool rx_overflow;
+
+// Frame being sent and its encoding, with room for both delimiters.
+static uint8_t tx_frame[PROTO_MAX_FRAME];
+static uint8_t tx_encoded[COBS_MAX_ENCODED(PROTO_MAX_FRAME) + 2];
+
+// A checked request waiting for execution.
+typedef struct {
+    uint8_t opcode;
+    uint8_t seq;
+    uint16_t len;
+    uint8_t payload[PROTO_MAX_PAYLOAD];
+} proto_request_t;
+
+// Ring of queued requests, executed oldest first.
+static proto_request_t queue[PROTO_QUEUE_DEPTH];
+static size_t queue_head;
+static size_t queue_count;
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * Completes the frame whose payload has already been placed in tx_frame, then encodes and sends it.
+ *
+ * @param opcode Opcode to send, including PROTO_RESPONSE for responses.
+ * @param seq Sequence number copied from the request.
+ * @param len Length of the payload at tx_frame + PROTO_HEADER_SIZE.
+ */
+static void send_tx_frame(uint8_t opcode, uint8_t seq, size_t len) {
+    tx_frame[0] = opcode;
+    tx_frame[1] = seq;
+    tx_frame[2] = (uint8_t)len;
+    tx_frame[3] = (uint8_t)(len >> 8);
+    put_u32(tx_frame + PROTO_HEADER_SIZE + len, crc32c(tx_frame, PROTO_HEADER_SIZE + len));
+
+    // The leading delimiter separates the frame from any console text sent before it.
+    size_t encoded = cobs_encode(tx_frame, PROTO_HEADER_SIZE + len + PROTO_CRC_SIZE, tx_encoded + 1);
+    tx_encoded[0] = 0;
+    tx_encoded[encoded + 1] = 0;
+    if (proto_write != NULL) {
+        proto_write(tx_encoded, encoded + 2);
+    }
+}
+
+/**
+ * Encodes and sends one frame with the given payload.
+ *
+ * @param opcode Opcode of the frame.
+ * @param seq Sequence number of the frame.
+ * @param payload Payload bytes; may already live inside the transmit frame.
+ * @param len Payload length; truncated to PROTO_MAX_PAYLOAD.
+ */
+void proto_send(uint8_t opcode, uint8_t seq, const uint8_t *payload, size_t len) {
+    if (len > PROTO_MAX_PAYLOAD) {
+        len = PROTO_MAX_PAYLOAD;
+    }
+    memmove(tx_frame + PROTO_HEADER_SIZE, payload, len);
+    send_tx_frame(opcode, seq, len);
+}
+
+/**
+ * Sends a response consisting of a status byte only.
+ */
+static void respond_status(uint8_t opcode, uint8_t seq, uint8_t status) {
+    tx_frame[PROTO_HEADER_SIZE] = status;
+    send_tx_frame(opcode | PROTO_RESPONSE, seq, 1);
+}
+
+/**
+ * Streams a byte range of the user region as a series of dump frames read straight from XIP,
+ * followed by an end frame carrying the CRC32C of everything sent. Each chunk is copied once,
+ * from flash into the transmit frame, and the CRC runs over the same bytes as they are copied.
+ */
+static void handle_dump(uint8_t seq, uint32_t offset, uint32_t length) {
+    uint8_t *resp = tx_frame + PROTO_HEADER_SIZE;
+
+    if (offset <= FLASH_USER_REGION_SIZE && length == PROTO_DUMP_TO_END) {
+        length = FLASH_USER_REGION_SIZE - offset;
+    }
+    if (offset > FLASH_USER_REGION_SIZE || length > FLASH_USER_REGION_SIZE - offset) {
+        respond_status(PROTO_OP_DUMP, seq, FLASH_ERR_OUT_OF_BOUNDS);
+        return;
+    }
+
+    uint32_t end = offset + length;
+    uint32_t crc = 0;
+    while (offset < end) {
+        uint32_t chunk = end - offset;
+        if (chunk > PROTO_DUMP_CHUNK) {
+            chunk = PROTO_DUMP_CHUNK;
+        }
+        resp[0] = FLASH_OK;
+        put_u32(resp + 1, offset);
+        memcpy(resp + 5, (const void *)(XIP_BASE + FLASH_TARGET_OFFSET + offset), chunk);
+        crc = crc32c_update(crc, resp + 5, chunk);
+        send_tx_frame(PROTO_OP_DUMP | PROTO_RESPONSE, seq, 5 + chunk);
+        offset += chunk;
+    }
+
+    resp[0] = FLASH_OK;
+    put_u32(resp + 1, end);
+    put_u32(resp + 5, crc);
+    send_tx_frame(PROTO_OP_DUMP | PROTO_RESPONSE, seq, 9);
+}
+
+/**
+ * Executes one request whose frame has passed all checks.
+ */
+static void dispatch(uint8_t opcode, uint8_t seq, const uint8_t *payload, size_t len) {
+    uint8_t *resp = tx_frame + PROTO_HEADER_SIZE;
+
+    // Every opcode except PING and CREDITS starts with a sector or byte offset.
+    if (opcode != PROTO_OP_PING && opcode != PROTO_OP_CREDITS && len < 4) {
+        respond_status(opcode, seq, PROTO_ERR_BAD_LENGTH);
+        return;
+    }
+
+    switch (opcode) {
+        case PROTO_OP_PING: {
+            // The payload is still in the receive buffer, so it can be copied behind the status byte.
+            size_t echo = len < PROTO_MAX_PAYLOAD ? len : PROTO_MAX_PAYLOAD - 1;
+            resp[0] = FLASH_OK;
+            memcpy(resp + 1, payload, echo);
+            send_tx_frame(opcode | PROTO_RESPONSE, seq, 1 + echo);
+            break;
+        }
+
+        case PROTO_OP_WRITE:
+            respond_status(opcode, seq, flash_write_safe(get_u32(payload), payload + 4, len - 4));
+            break;
+
+        case PROTO_OP_READ: {
+            size_t bytes_read = 0;
+            resp[0] = flash_read_safe(get_u32(payload), resp + 1, PROTO_MAX_PAYLOAD - 1, &bytes_read);
+            send_tx_frame(opcode | PROTO_RESPONSE, seq, 1 + bytes_read);
+            break;
+        }
+
+        case PROTO_OP_ERASE:
+            respond_status(opcode, seq, flash_erase_safe(get_u32(payload)));
+            break;
+
+        case PROTO_OP_STAT: {
+            flash_stat_t stat = {0};
+            resp[0] = flash_stat(get_u32(payload), &stat);
+            resp[1] = stat.valid;
+            resp[2] = stat.blank;
+            put_u32(resp + 3, stat.write_count);
+            put_u32(resp + 7, stat.data_len);
+            put_u32(resp + 11, stat.data_crc);
+            send_tx_frame(opcode | PROTO_RESPONSE, seq, 15);
+            break;
+        }
+
+        case PROTO_OP_DUMP:
+            if (len < 8) {
+                respond_status(opcode, seq, PROTO_ERR_BAD_LENGTH);
+            } else {
+                handle_dump(seq, get_u32(payload), get_u32(payload + 4));
+            }
+            break;
+
+        case PROTO_OP_LOAD: {
+            uint32_t offset = get_u32(payload);
+            resp[0] = flash_load_sector(offset, payload + 4, len - 4);
+            uint32_t crc = 0;
+            if (resp[0] == FLASH_OK) {
+                crc = crc32c((const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset), FLASH_SECTOR_SIZE);
+            }
+            put_u32(resp + 1, crc);
+            send_tx_frame(opcode | PROTO_RESPONSE, seq, 5);
+            break;
+        }
+
+        case PROTO_OP_CREDITS:
+            resp[0] = FLASH_OK;
+            resp[1] = (uint8_t)(PROTO_QUEUE_DEPTH - queue_count);
+            resp[2] = PROTO_QUEUE_DEPTH;
+            send_tx_frame(opcode | PROTO_RESPONSE, seq, 3);
+            break;
+
+        default:
+            respond_status(opcode, seq, PROTO_ERR_UNKNOWN_OP);
+            break;
+    }
+}
+
+/**
+ * Returns true if a queued write, erase or load targets the given sector, in which case a read or stat
+ * of that sector has to wait its turn.
+ */
+static bool queue_touches(uint32_t offset) {
+    for (size_t i = 0; i < queue_count; i++) {
+        const proto_request_t *req = &queue[(queue_head + i) % PROTO_QUEUE_DEPTH];
+        bool modifies = req->opcode == PROTO_OP_WRITE || req->opcode == PROTO_OP_ERASE || req->opcode == PROTO_OP_LOAD;
+        if (modifies && get_u32(req->payload) == offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Decides whether a request can be answered on arrival. Anything that modifies flash or streams
+ * large amounts of it is queued; so is a read of a sector that a queued request will change.
+ * Malformed and unknown requests are answered at once, since they only produce an error.
+ */
+static bool runs_immediately(uint8_t opcode, const uint8_t *payload, size_t len) {
+    switch (opcode) {
+        case PROTO_OP_WRITE:
+        case PROTO_OP_ERASE:
+        case PROTO_OP_LOAD:
+        case PROTO_OP_DUMP:
+            return len < 4;
+        case PROTO_OP_READ:
+        case PROTO_OP_STAT:
+            return len < 4 || !queue_touches(get_u32(payload));
+        default:
+            return true;
+    }
+}
+
+/**
+ * Decodes and checks the frame collected in rx_buf, then answers or queues it.
+ */
+static void handle_frame(void) {
+    size_t n = rx_overflow ? 0 : cobs_decode(rx_buf, rx_len, rx_buf);
+    if (n < PROTO_HEADER_SIZE + PROTO_CRC_SIZE) {
+        respond_status(0, 0, PROTO_ERR_BAD_FRAME);
+        return;
+    }
+
+    uint8_t opcode = rx_buf[0];
+    uint8_t seq = rx_buf[1];
+    size_t len = (size_t)rx_buf[2] | ((size_t)rx_buf[3] << 8);
+    if (len != n - PROTO_HEADER_SIZE - PROTO_CRC_SIZE ||
+        crc32c(rx_buf, PROTO_HEADER_SIZE + len) != get_u32(rx_buf + PROTO_HEADER_SIZE + len)) {
+        respond_status(opcode, seq, PROTO_ERR_BAD_FRAME);
+        return;
+    }
+
+    const uint8_t *payload = rx_buf + PROTO_HEADER_SIZE;
+    if (runs_immediately(opcode, payload, len)) {
+        dispatch(opcode, seq, payload, len);
+        return;
+    }
+    if (queue_count == PROTO_QUEUE_DEPTH) {
+        respond_status(opcode, seq, PROTO_ERR_BUSY);
+        return;
+    }
+
+    proto_request_t *req = &queue[(queue_head + queue_count) % PROTO_QUEUE_DEPTH];
+    req->opcode = opcode;
+    req->seq = seq;
+    req->len = (uint16_t)len;
+    memcpy(req->payload, payload, len);
+    queue_count++;
+}
+
+/**
+ * Sets the output sink and clears any partially received frame and any queued requests.
+ *
+ * @param write Function that sends encoded bytes to the host.
+ */
+void proto_init(proto_write_fn write) {
+    proto_write = write;
+    rx_len = 0;
+    rx_overflow = false;
+    queue_head = 0;
+    queue_count = 0;
+}
+
+/**
+ * Feeds one byte of the encoded input stream. A 0x00 ends the current frame; empty frames,
+ * such as the leading delimiter of every frame, are ignored.
+ *
+ * @param byte The next byte received from the host.
+ */
+void proto_receive(uint8_t byte) {
+    if (byte != 0) {
+        if (rx_len < sizeof(rx_buf)) {
+            rx_buf[rx_len++] = byte;
+        } else {
+            rx_overflow = true;
+        }
+        return;
+    }
+
+    if (rx_len > 0 || rx_overflow) {
+        handle_frame();
+    }
+    rx_len = 0;
+    rx_overflow = false;
+}
+
+/**
+ * Executes the oldest queued request and sends its response. Called from the main loop, so at
+ * most one flash operation runs per call and input keeps being buffered in between.
+ *
+ * @return true if a request was executed, false if the queue was empty.
+ */
+bool proto_poll(void) {
+    if (queue_count == 0) {
+        return false;
+    }
+
+    // The slot stays reserved while it runs, so the credit returns only with the response.
+    const proto_request_t *req = &queue[queue_head];
+    dispatch(req->opcode, req->seq, req->payload, req->len);
+    queue_head = (queue_head + 1) % PROTO_QUEUE_DEPTH;
+    queue_count--;
+    return true;
+}
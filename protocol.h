@@ -0,0 +1,102 @@
+/**
+ * @file protocol.h
+ *
+ * Binary framed protocol for provisioning and maintenance over USB CDC. Every frame is
+ *
+ *     opcode (1) | sequence (1) | payload length (2, little endian) | payload | CRC32C (4)
+ *
+ * with the CRC covering everything before it. The frame is COBS encoded and sent between two
+ * 0x00 delimiters, one before and one after it, so frames can share the link with the text
+ * console: the console never sends a zero byte. The leading 0x00 is required of the host too.
+ * The console reader only leaves its line editor on a zero and returns to it after the closing
+ * one, so a frame sent without its own leading 0x00 is taken for typed text and echoed. The
+ * device starts every frame it sends with a 0x00 as well.
+ *
+ * A response carries the request's opcode with PROTO_RESPONSE set, the same sequence number, and
+ * a payload starting with a one-byte status (a flash_status_t or one of the PROTO_ERR_* values).
+ *
+ * Request payloads (all integers little endian):
+ *   PROTO_OP_PING   anything                 -> status, the same bytes
+ *   PROTO_OP_WRITE  offset (4), data         -> status
+ *   PROTO_OP_READ   offset (4)               -> status, data
+ *   PROTO_OP_ERASE  offset (4)               -> status
+ *   PROTO_OP_STAT   offset (4)               -> status, valid (1), blank (1), write count (4),
+ *                                               data length (4), data CRC (4)
+ *   PROTO_OP_DUMP   offset (4), length (4)   -> one frame per chunk: status, chunk offset (4), bytes;
+ *                                               then an end frame: status, end offset (4), CRC32C of
+ *                                               every dumped byte (4)
+ *   PROTO_OP_CREDITS nothing                 -> status, free queue slots (1), queue depth (1)
+ *   PROTO_OP_LOAD   offset (4), image        -> status, CRC32C of the whole sector as now in flash (4)
+ * Offsets are relative to the start of the user region. Dumps are byte granular and read the
+ * raw flash contents, headers included; a length of PROTO_DUMP_TO_END dumps everything up to the
+ * end of the user region, so a full backup needs no knowledge of the flash size.
+ *
+ * LOAD is the matching restore: it takes a sector offset and up to one sector of raw image, and
+ * leaves the sector holding exactly that image (see flash_load_sector). A backup is restored by
+ * sending the dumped region back one sector per LOAD, pipelined to keep the link busy while the
+ * previous sector is programmed.
+ *
+ * Requests are pipelined. WRITE, ERASE, LOAD and DUMP are queued and executed in order by proto_poll
+ * as the main loop gets to them; PING, CREDITS, and READ or STAT of a sector with no queued
+ * write or erase are answered as soon as they arrive. Responses can therefore come back out of
+ * order, and the host matches them to requests by sequence number.
+ *
+ * Flow control uses credits: the host starts with PROTO_QUEUE_DEPTH credits (or asks with
+ * PROTO_OP_CREDITS), spends one per request and gets it back with that request's final response.
+ * A host that keeps to its credits can never overrun the queue; a request that arrives when the
+ * queue is full is answered with PROTO_ERR_BUSY and dropped.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PROTO_HEADER_SIZE 4
+#define PROTO_CRC_SIZE 4
+#define PROTO_MAX_PAYLOAD (4096 + 16) // A full sector plus room for request fields.
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD + PROTO_CRC_SIZE)
+#define PROTO_DUMP_CHUNK 4096         // Bytes of flash carried by each dump frame.
+#define PROTO_DUMP_TO_END 0xFFFFFFFFu // Dump length meaning "up to the end of the user region".
+
+#ifndef PROTO_QUEUE_DEPTH
+#define PROTO_QUEUE_DEPTH 4           // Requests that can wait for execution; each holds a full frame.
+#endif
+
+#define PROTO_RESPONSE 0x80           // Set in the opcode of every frame sent by the device.
+
+typedef enum {
+    PROTO_OP_PING  = 0x01,
+    PROTO_OP_WRITE = 0x02,
+    PROTO_OP_READ  = 0x03,
+    PROTO_OP_ERASE = 0x04,
+    PROTO_OP_STAT  = 0x05,
+    PROTO_OP_DUMP  = 0x06,
+    PROTO_OP_CREDITS = 0x07,
+    PROTO_OP_LOAD  = 0x08
+} proto_opcode_t;
+
+// Protocol-level errors, chosen well above the flash_status_t range.
+#define PROTO_ERR_BAD_FRAME  0xF0 // The frame failed COBS decoding, its length or its CRC.
+#define PROTO_ERR_UNKNOWN_OP 0xF1 // The opcode is not supported.
+#define PROTO_ERR_BAD_LENGTH 0xF2 // The payload is too short for the opcode's fields.
+#define PROTO_ERR_BUSY       0xF3 // The request queue was full; the host ran out of credits.
+
+// Sink for encoded output; it must write every byte without newline translation.
+typedef void (*proto_write_fn)(const uint8_t *data, size_t len);
+
+// Sets the output sink and clears the receive state.
+void proto_init(proto_write_fn write);
+
+// Feeds one byte of the encoded input stream; complete frames are answered or queued.
+void proto_receive(uint8_t byte);
+
+// Executes the oldest queued request, if any; returns false when the queue was empty.
+bool proto_poll(void);
+
+// Encodes and sends one frame.
+void proto_send(uint8_t opcode, uint8_t seq, const uint8_t *payload, size_t len);
+
+#endif // PROTOCOL_H
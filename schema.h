@@ -0,0 +1,162 @@
+/**
+ * @file schema.h
+ *
+ * Codecs for record structs generated from a single field list. A record is described once as an
+ * X-macro that applies FIELD(name, type) to each scalar member and BYTES(name, size) to each byte
+ * array, in stored order:
+ *
+ *     #define DEVICE_CONFIG_SCHEMA(FIELD, BYTES) \
+ *         FIELD(id, u32)                          \
+ *         FIELD(sensor_value, f32)                \
+ *         BYTES(name, 10)
+ *
+ *     SCHEMA_CODEC(device_config, DeviceConfig, DEVICE_CONFIG_SCHEMA, DEVICE_CONFIG_SIZE, 18)
+ *
+ * SCHEMA_CODEC defines, for the prefix given:
+ *
+ * - the encoded size as a compile-time constant, under the name given (DEVICE_CONFIG_SIZE);
+ * - prefix_encode(const T *, uint8_t *), storing the fields back to back, little-endian;
+ * - prefix_decode(const uint8_t *, T *), the reverse;
+ * - prefix_encode_any and prefix_decode_any, the same taking void pointers, for tables of codecs
+ *   such as the version lists of flash_record.h.
+ *
+ * Both functions are static inline and expand to one store or load per field, with no loops and
+ * no table lookups. The build fails if the field list does not add up to the expected size, if a
+ * scalar member is narrower than its stored type, or if a byte array's size differs from the
+ * struct's. A member wider than its stored type (a size_t stored as u32) is allowed; it is
+ * truncated on encode.
+ *
+ * Stored types are u8, u16, u32, u64, i32, f32 and bool. A bool is stored as one byte and decodes
+ * as true only for 1, so erased flash (0xFF) reads as false.
+ */
+
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define SCHEMA_SIZE_u8 1
+#define SCHEMA_SIZE_u16 2
+#define SCHEMA_SIZE_u32 4
+#define SCHEMA_SIZE_u64 8
+#define SCHEMA_SIZE_i32 4
+#define SCHEMA_SIZE_f32 4
+#define SCHEMA_SIZE_bool 1
+
+static inline void schema_put_u8(uint8_t *p, uint8_t v) {
+    p[0] = v;
+}
+
+static inline void schema_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void schema_put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void schema_put_u64(uint8_t *p, uint64_t v) {
+    schema_put_u32(p, (uint32_t)v);
+    schema_put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline void schema_put_i32(uint8_t *p, int32_t v) {
+    schema_put_u32(p, (uint32_t)v);
+}
+
+static inline void schema_put_f32(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    schema_put_u32(p, bits);
+}
+
+static inline void schema_put_bool(uint8_t *p, bool v) {
+    p[0] = v ? 1 : 0;
+}
+
+static inline uint8_t schema_get_u8(const uint8_t *p) {
+    return p[0];
+}
+
+static inline uint16_t schema_get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t schema_get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t schema_get_u64(const uint8_t *p) {
+    return (uint64_t)schema_get_u32(p) | ((uint64_t)schema_get_u32(p + 4) << 32);
+}
+
+static inline int32_t schema_get_i32(const uint8_t *p) {
+    return (int32_t)schema_get_u32(p);
+}
+
+static inline float schema_get_f32(const uint8_t *p) {
+    uint32_t bits = schema_get_u32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static inline bool schema_get_bool(const uint8_t *p) {
+    return p[0] == 1;
+}
+
+#ifdef __cplusplus
+#define SCHEMA_STATIC_ASSERT static_assert
+#else
+#define SCHEMA_STATIC_ASSERT _Static_assert
+#endif
+
+// Expansions of a field list; `record` and `p` are the names used inside the generated functions.
+#define SCHEMA_SIZE_FIELD(name, type) + SCHEMA_SIZE_##type
+#define SCHEMA_SIZE_BYTES(name, size) + (size)
+
+#define SCHEMA_CHECK_FIELD(name, type) \
+    SCHEMA_STATIC_ASSERT(sizeof(record->name) >= SCHEMA_SIZE_##type, "member " #name " is narrower than " #type);
+#define SCHEMA_CHECK_BYTES(name, size) \
+    SCHEMA_STATIC_ASSERT(sizeof(record->name) == (size), "member " #name " is not " #size " bytes");
+
+#define SCHEMA_ENCODE_FIELD(name, type) schema_put_##type(p, record->name); p += SCHEMA_SIZE_##type;
+#define SCHEMA_ENCODE_BYTES(name, size) memcpy(p, record->name, size); p += (size);
+
+#define SCHEMA_DECODE_FIELD(name, type) record->name = schema_get_##type(p); p += SCHEMA_SIZE_##type;
+#define SCHEMA_DECODE_BYTES(name, size) memcpy(record->name, p, size); p += (size);
+
+/**
+ * Defines the constant `size_name`, prefix_encode and prefix_decode for `type` from the field
+ * list `fields`, and fails the build unless the encoded size is `expected_size` bytes.
+ */
+#define SCHEMA_CODEC(prefix, type, fields, size_name, expected_size)                             \
+    enum { size_name = 0 fields(SCHEMA_SIZE_FIELD, SCHEMA_SIZE_BYTES) };                         \
+    SCHEMA_STATIC_ASSERT(size_name == (expected_size), #type " encodes to an unexpected size");        \
+                                                                                                 \
+    static inline void prefix##_encode(const type *record, uint8_t *p) {                         \
+        fields(SCHEMA_CHECK_FIELD, SCHEMA_CHECK_BYTES)                                           \
+        fields(SCHEMA_ENCODE_FIELD, SCHEMA_ENCODE_BYTES)                                         \
+        (void)p;                                                                                 \
+    }                                                                                            \
+                                                                                                 \
+    static inline void prefix##_decode(const uint8_t *p, type *record) {                         \
+        fields(SCHEMA_DECODE_FIELD, SCHEMA_DECODE_BYTES)                                         \
+        (void)p;                                                                                 \
+    }                                                                                            \
+                                                                                                 \
+    static inline void prefix##_encode_any(const void *record, uint8_t *p) {                     \
+        prefix##_encode((const type *)record, p);                                                \
+    }                                                                                            \
+                                                                                                 \
+    static inline void prefix##_decode_any(const uint8_t *p, void *record) {                     \
+        prefix##_decode(p, (type *)record);                                                      \
+    }
+
+#endif // SCHEMA_H
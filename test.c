@@ -15,6 +15,22 @@
 #include "flash_ops_helper.h"
 #include "test.h"
 #include "flash_ops.h"
+#include "flash_cache.h"
+#include "flash_wear.h"
+#include "flash_bbt.h"
+#include "crc32c.h"
+#include "cobs.h"
+#include "protocol.h"
+#include "line_reader.h"
+#include "flash_queue.h"
+#include "flash_log.h"
+#include "flash_ts.h"
+#include "flash_rollup.h"
+#include "flash_columnar.h"
+#include "flash_record.h"
+#include "flash_table.h"
+#include "flash_partition.h"
+#include "flash_erase_count.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -24,9 +40,6 @@
  
  
 
-#define FLASH_TARGET_OFFSET (256 * 1024) // Offset where user data starts (256KB into flash)
-#define FLASH_SIZE PICO_FLASH_SIZE_BYTES // Total flash size available
-#define METADATA_SIZE sizeof(flash_data) 
 
 
 
@@ -71,6 +84,98 @@ void run_all_tests() {
     // Test the accuracy of data length retrieval from flash memory.
     test_data_length_retrieval();  // New test declaration
     printf("%s\n", slashes);
+
+    // Test the combined header query and its in-RAM table.
+    test_flash_stat_and_cache();
+    printf("%s\n", slashes);
+
+    // Test the incremental wear statistics and lifetime projection.
+    test_wear_statistics();
+    printf("%s\n", slashes);
+
+    // Test read-after-write verification and allocation around retired sectors.
+    test_verify_and_allocate();
+    printf("%s\n", slashes);
+
+    // Test the CRC32C kernel and checksum protection of headers and payloads.
+    test_crc_protection();
+    printf("%s\n", slashes);
+
+    // Test the binary framed protocol through a loopback output sink.
+    test_binary_protocol();
+    printf("%s\n", slashes);
+
+    // Test queued requests, out-of-order responses and flow-control credits.
+    test_pipelined_protocol();
+    printf("%s\n", slashes);
+
+    // Test frames and typed text sharing the console input.
+    test_framed_console();
+    printf("%s\n", slashes);
+
+    // Test backing up and restoring sectors with bulk dump and load frames.
+    test_bulk_dump_load();
+    printf("%s\n", slashes);
+
+    // Test the persistent FIFO queue across reopening and wrap-around.
+    test_flash_queue();
+    printf("%s\n", slashes);
+
+    // Test the circular sample log across sectors, reopening and wrap-around.
+    test_flash_log();
+    printf("%s\n", slashes);
+
+    // Test delta-of-delta and XOR compression of samples, in RAM and from flash.
+    test_flash_ts();
+    printf("%s\n", slashes);
+
+    // Test range aggregates answered from block zone maps.
+    test_flash_ts_query();
+    printf("%s\n", slashes);
+
+    // Test rollup tiers maintained as samples arrive.
+    test_flash_rollup();
+    printf("%s\n", slashes);
+
+    // Test the columnar DeviceConfig history: row round trips and single-column scans.
+    test_columnar_configs();
+    printf("%s\n", slashes);
+
+    // Test the codecs generated from schema field lists.
+    test_schema_codecs();
+    printf("%s\n", slashes);
+
+    // Test reading records of an older schema version and migrating them lazily.
+    test_record_migration();
+    printf("%s\n", slashes);
+
+    // Test records read in place from XIP through fixed offsets and the optional field table.
+    test_flash_table();
+    printf("%s\n", slashes);
+
+    // Test the typed C++ record layer (test_typed.cpp).
+    test_flash_typed();
+    printf("%s\n", slashes);
+
+    // Test named partitions keeping allocation, garbage collection and wear to themselves.
+    test_flash_partitions();
+    printf("%s\n", slashes);
+
+    // Test mounting without a boot-time scan and indexing in the background.
+    test_lazy_mount();
+    printf("%s\n", slashes);
+
+    // Test mounting from a checkpoint and replaying the journal written behind it.
+    test_kv_checkpoint();
+    printf("%s\n", slashes);
+
+    // Test the sector state byte and marking data obsolete without an erase.
+    test_sector_states();
+    printf("%s\n", slashes);
+
+    // Test erase counts kept in the append-only counter area rather than in sector headers.
+    test_erase_counts();
+    printf("%s\n", slashes);
 }
 
 
@@ -90,7 +195,8 @@ void test_data_length_retrieval() {
     flash_write_safe(offset, data, sizeof(data));
 
     // Retrieve the length of data stored at the specified offset after the write operation.
-    uint32_t retrieved_length = get_flash_data_length(offset); 
+    uint32_t retrieved_length = 0;
+    get_flash_data_length(offset, &retrieved_length);
     printf("Retrieved data length: %u\n", retrieved_length);
 
     // Compare the retrieved data length to the expected size to verify correct handling.
@@ -105,7 +211,7 @@ void test_data_length_retrieval() {
     flash_erase_safe(offset);
 
     // Retrieve the data length again after erasing the sector to ensure it has been reset.
-    retrieved_length = get_flash_data_length(offset);
+    get_flash_data_length(offset, &retrieved_length);
     printf("Retrieved data length after erase: %u\n", retrieved_length);
     if (retrieved_length == 0) {
         printf("PASS: Data length correctly reset to 0 after erase.\n");
@@ -133,7 +239,8 @@ void test_flash_write_count_persistence() {
     // Perform the initial write operation and retrieve the write count.
     printf("Initial write...\n");
     flash_write_safe(offset, data, sizeof(data));
-    uint32_t initial_count = get_flash_write_count(offset); // Record the write count after the first write.
+    uint32_t initial_count = 0;
+    get_flash_write_count(offset, &initial_count); // Record the write count after the first write.
 
     // Erase the sector to simulate a typical usage scenario of write-erase cycles.
     printf("Erasing the sector...\n");
@@ -142,11 +249,13 @@ void test_flash_write_count_persistence() {
     // Perform another write operation after erasing the sector.
     printf("Writing after erase...\n");
     flash_write_safe(offset, data, sizeof(data));
-    uint32_t second_count = get_flash_write_count(offset); // Record the write count after the second write.
+    uint32_t second_count = 0;
+    get_flash_write_count(offset, &second_count); // Record the write count after the second write.
 
     // Verify if the write count has incremented correctly, indicating reliable tracking.
     printf("Verifying write count persistence...\n");
-    if (second_count == initial_count + 1) {
+    // The erase itself counts as one cycle, so the rewrite lands two above the first write.
+    if (second_count == initial_count + 2) {
         printf("PASS: Write count persisted and incremented correctly after erase (initial: %u, after: %u).\n", initial_count, second_count);
     } else {
         printf("FAIL: Write count did not increment correctly (initial: %u, after: %u).\n", initial_count, second_count);
@@ -173,30 +282,35 @@ void test_flash_beyond_flash_limits() {
     memset(data, 0xEE, sizeof(data));  // Fill the data array with a recognizable pattern to trace in memory if needed.
 
     // Attempt to write data to the flash at an offset that should exceed the memory limits.
-    // This should trigger an error message from the flash_write_safe function due to boundary checking.
-    flash_write_safe(offset, data, sizeof(data));
+    // This should be rejected by the boundary check in flash_write_safe.
+    flash_status_t write_status = flash_write_safe(offset, data, sizeof(data));
 
     // Initialize a buffer to attempt to read back any data from the same offset.
     uint8_t buffer[sizeof(data)] = {0};
     memset(buffer, 0, sizeof(buffer));  // Ensure buffer is clean before attempting read.
 
     // Attempt to read data from the same offset that exceeds the flash memory limits.
-    // This should also trigger an error message from the flash_read_safe function.
-    flash_read_safe(offset, buffer, sizeof(buffer));
+    flash_status_t read_status = flash_read_safe(offset, buffer, sizeof(buffer), NULL);
 
     // Attempt to erase data at the offset beyond the limits.
-    // This operation should also fail and generate an error message due to boundary checks.
-    flash_erase_safe(offset);
-
-    // Attempt to retrieve the write count for the sector at the specified offset.
-    // Since the operation should not be successful, it should return zero or trigger an error.
-    uint32_t write_count = get_flash_write_count(offset);
-
-    // Attempt to retrieve the data length at the same invalid offset.
-    // This function should also return zero or an appropriate error message if boundaries are respected.
-    uint32_t retrieved_length = get_flash_data_length(offset);
-
-    
+    flash_status_t erase_status = flash_erase_safe(offset);
+
+    // The metadata getters must report the error instead of returning a count of zero,
+    // which would be indistinguishable from a sector that has never been written.
+    uint32_t write_count = 0;
+    flash_status_t count_status = get_flash_write_count(offset, &write_count);
+    uint32_t retrieved_length = 0;
+    flash_status_t length_status = get_flash_data_length(offset, &retrieved_length);
+
+    if (write_status == FLASH_ERR_OUT_OF_BOUNDS && read_status == FLASH_ERR_OUT_OF_BOUNDS &&
+        erase_status == FLASH_ERR_OUT_OF_BOUNDS && count_status == FLASH_ERR_OUT_OF_BOUNDS &&
+        length_status == FLASH_ERR_OUT_OF_BOUNDS) {
+        printf("PASS: All operations reported FLASH_ERR_OUT_OF_BOUNDS.\n");
+    } else {
+        printf("FAIL: Unexpected status (write: %s, read: %s, erase: %s, count: %s, length: %s).\n",
+               flash_status_str(write_status), flash_status_str(read_status), flash_status_str(erase_status),
+               flash_status_str(count_status), flash_status_str(length_status));
+    }
 }
 
 
@@ -221,11 +335,26 @@ void test_exceed_sector_size() {
 
     // Attempt to write data to the flash at the specified offset. This should fail
     // due to the data size exceeding the permissible limit for a single sector.
-    flash_write_safe(offset, data, sizeof(data));
+    flash_status_t status = flash_write_safe(offset, data, sizeof(data));
 
-    // The function flash_write_safe should automatically print an error message
-    // indicating that the data size has exceeded the sector size minus metadata.
-    // This output confirms that the function's boundary checks are working as expected.
+    // The size check must reject the write before anything is erased or programmed.
+    if (status == FLASH_ERR_TOO_LARGE) {
+        printf("PASS: Oversized write rejected with FLASH_ERR_TOO_LARGE.\n");
+    } else {
+        printf("FAIL: Oversized write returned '%s'.\n", flash_status_str(status));
+    }
+
+    // One byte less fills the sector behind its serialized header exactly and reads back whole.
+    static uint8_t read_back[sizeof(data) - 1];
+    size_t bytes_read = 0;
+    status = flash_write_safe(offset, data, sizeof(data) - 1);
+    if (status == FLASH_OK && flash_read_safe(offset, read_back, sizeof(read_back), &bytes_read) == FLASH_OK &&
+        bytes_read == sizeof(read_back) && memcmp(read_back, data, sizeof(read_back)) == 0) {
+        printf("PASS: Largest payload (%u bytes) stored and read back.\n", (unsigned)bytes_read);
+    } else {
+        printf("FAIL: Largest payload returned '%s'.\n", flash_status_str(status));
+    }
+    flash_erase_safe(offset);
 }
 
 
@@ -254,26 +383,29 @@ void test_unaligned_offset() {
     memset(buffer, 0, sizeof(buffer));  // Initialize buffer to zeros to ensure clean start
 
     // Attempt to write data to the flash memory at the unaligned offset.
-    // This operation should fail or handle the alignment issue as designed in the function.
-    flash_write_safe(offset, data, sizeof(data));
+    flash_status_t write_status = flash_write_safe(offset, data, sizeof(data));
 
     // Attempt to read data from the same unaligned offset.
-    // This should also manage the alignment issue and either fail gracefully or correct it.
-    flash_read_safe(offset, buffer, sizeof(buffer));
+    flash_status_t read_status = flash_read_safe(offset, buffer, sizeof(buffer), NULL);
 
     // Attempt to erase the sector at the unaligned offset.
-    // The erase operation should handle the unaligned address properly, either by adjusting the offset or failing safely.
-    flash_erase_safe(offset);
-
-    // Retrieve the write count from the flash memory at the specified offset.
-    // This value helps in understanding how the system handles unaligned writes.
-    uint32_t write_count = get_flash_write_count(offset);
-
-    // Retrieve the length of data stored at the offset to check if any unaligned write was partially successful.
-    uint32_t retrieved_length = get_flash_data_length(offset);
-
-    // The function calls should demonstrate appropriate error handling or correction of the unaligned offset.
-    // Observing outputs and checking return values are essential for verifying the effectiveness of alignment handling.
+    flash_status_t erase_status = flash_erase_safe(offset);
+
+    // Retrieve the write count and data length; both must report the alignment error.
+    uint32_t write_count = 0;
+    flash_status_t count_status = get_flash_write_count(offset, &write_count);
+    uint32_t retrieved_length = 0;
+    flash_status_t length_status = get_flash_data_length(offset, &retrieved_length);
+
+    if (write_status == FLASH_ERR_ALIGNMENT && read_status == FLASH_ERR_ALIGNMENT &&
+        erase_status == FLASH_ERR_ALIGNMENT && count_status == FLASH_ERR_ALIGNMENT &&
+        length_status == FLASH_ERR_ALIGNMENT) {
+        printf("PASS: All operations reported FLASH_ERR_ALIGNMENT.\n");
+    } else {
+        printf("FAIL: Unexpected status (write: %s, read: %s, erase: %s, count: %s, length: %s).\n",
+               flash_status_str(write_status), flash_status_str(read_status), flash_status_str(erase_status),
+               flash_status_str(count_status), flash_status_str(length_status));
+    }
 }
 
 
@@ -296,10 +428,12 @@ void test_full_cycle_operation() {
     // Prepare a buffer to read the data back into, ensuring it is initially cleared.
     uint8_t read_data[sizeof(write_data)];
     memset(read_data, 0, sizeof(read_data));
-    flash_read_safe(offset, read_data, sizeof(read_data));
+    size_t bytes_read = 0;
+    flash_status_t status = flash_read_safe(offset, read_data, sizeof(read_data), &bytes_read);
 
     // Compare the written data with the read data to verify accuracy of the operations.
-    if (memcmp(write_data, read_data, sizeof(write_data)) == 0) {
+    if (status == FLASH_OK && bytes_read == sizeof(write_data) &&
+        memcmp(write_data, read_data, sizeof(write_data)) == 0) {
         printf("PASS: Data written and read back correctly.\n");
     } else {
         printf("FAIL: Data mismatch between written and read data.\n");
@@ -308,6 +442,14 @@ void test_full_cycle_operation() {
     // Erase the data at the specified offset, cleaning up after the test.
     flash_erase_safe(offset);
     printf("Data erased\n");
+
+    // Reading an erased sector must be reported as invalid data rather than succeed silently.
+    status = flash_read_safe(offset, read_data, sizeof(read_data), &bytes_read);
+    if (status == FLASH_ERR_INVALID_DATA && bytes_read == 0) {
+        printf("PASS: Read after erase reported FLASH_ERR_INVALID_DATA.\n");
+    } else {
+        printf("FAIL: Read after erase returned '%s'.\n", flash_status_str(status));
+    }
   
     
 }
@@ -327,12 +469,19 @@ void test_null_or_zero_data() {
 
     // Test case 1: Attempt to write with a NULL data pointer.
     printf("Test with NULL data:\n");
-    flash_write_safe(offset, NULL, 100);  // This should trigger an error message due to NULL data.
+    flash_status_t null_status = flash_write_safe(offset, NULL, 100);  // Rejected due to NULL data.
 
     // Test case 2: Attempt to write with zero data length.
     printf("Test with zero data length:\n");
     uint8_t data[10];   // Define a small data array to test zero length condition.
-    flash_write_safe(offset, data, 0);  // This should trigger an error message due to zero data length.
+    flash_status_t zero_status = flash_write_safe(offset, data, 0);  // Rejected due to zero data length.
+
+    if (null_status == FLASH_ERR_NULL_DATA && zero_status == FLASH_ERR_ZERO_LENGTH) {
+        printf("PASS: NULL data and zero length rejected with distinct status codes.\n");
+    } else {
+        printf("FAIL: Unexpected status (NULL: %s, zero length: %s).\n",
+               flash_status_str(null_status), flash_status_str(zero_status));
+    }
 
     // Both cases are designed to verify that the flash_write_safe function does not proceed
     // with operations that are likely to fail or cause undefined behavior due to invalid parameters.
@@ -373,7 +522,7 @@ void test_save_and_recover_struct() {
     // Allocate a buffer to read back the serialized data from flash.
     uint8_t device_config_buffer_read[sizeof(DeviceConfig)];
     // Read the data from flash memory into the buffer.
-    flash_read_safe(offset, device_config_buffer_read, sizeof(DeviceConfig));
+    flash_read_safe(offset, device_config_buffer_read, sizeof(DeviceConfig), NULL);
 
     printf("Deserializing data read from flash...\n");
     // Deserialize the read buffer back into a DeviceConfig structure.
@@ -396,4 +545,1639 @@ void test_save_and_recover_struct() {
     }
 }
 
- 
\ No newline at end of file
+ 
+
+
+
+/**
+ * Compares two header snapshots field by field; memcmp would also compare struct padding.
+ */
+static bool same_stat(const flash_stat_t *a, const flash_stat_t *b) {
+    return a->valid == b->valid && a->blank == b->blank &&
+           a->write_count == b->write_count && a->data_len == b->data_len &&
+           a->data_crc == b->data_crc;
+}
+
+/**
+ * Tests that flash_stat returns every header field in one call and that the cached header table
+ * stays coherent with writes and erases. Each step compares the cached answer with a fresh read
+ * from flash, obtained by invalidating the table.
+ */
+void test_flash_stat_and_cache() {
+    printf("Testing flash_stat and the cached header table...\n");
+    uint32_t offset = 8192; // Correctly aligned offset for the test.
+    uint8_t data[64];
+    memset(data, 0x5A, sizeof(data));
+
+    // Warm the whole table, then write so the entry must be updated in place.
+    flash_cache_preload();
+    flash_write_safe(offset, data, sizeof(data));
+
+    flash_stat_t cached, fresh;
+    flash_stat(offset, &cached);
+    flash_cache_invalidate();
+    flash_stat(offset, &fresh);
+
+    if (cached.valid && !cached.blank && cached.data_len == sizeof(data) &&
+        same_stat(&cached, &fresh)) {
+        printf("PASS: Cached header matches flash after write (write count: %u).\n", cached.write_count);
+    } else {
+        printf("FAIL: Cached header differs from flash after write.\n");
+    }
+
+    // Erase and compare again; the erase must have refreshed the cached entry too.
+    flash_erase_safe(offset);
+    flash_stat(offset, &cached);
+    flash_cache_invalidate();
+    flash_stat(offset, &fresh);
+
+    if (!cached.valid && cached.data_len == 0 && cached.write_count == fresh.write_count &&
+        same_stat(&cached, &fresh)) {
+        printf("PASS: Cached header matches flash after erase.\n");
+    } else {
+        printf("FAIL: Cached header differs from flash after erase.\n");
+    }
+
+    // A sector without a record header, as a log or queue leaves, does not stop the preload, and
+    // erasing it the way those modules do keeps counting its wear.
+    uint32_t foreign = offset + FLASH_SECTOR_SIZE;
+    uint8_t zeros[16] = {0};
+    flash_erase_safe(foreign);
+    flash_program_partial(FLASH_TARGET_OFFSET + foreign, zeros, sizeof(zeros));
+    flash_cache_invalidate();
+    flash_status_t preload_status = flash_cache_preload();
+    flash_status_t before = flash_stat(foreign, &fresh);
+    uint32_t count_before = fresh.write_count;
+    flash_erase_unmanaged(foreign);
+    flash_program_partial(FLASH_TARGET_OFFSET + foreign, zeros, sizeof(zeros));
+    flash_status_t after = flash_stat(foreign, &cached);
+    if (preload_status == FLASH_OK && before == FLASH_ERR_CRC && after == FLASH_ERR_CRC &&
+        !cached.valid && cached.write_count == count_before + 1) {
+        printf("PASS: Preload went past a sector without a header, and its erases were counted (%u).\n", cached.write_count);
+    } else {
+        printf("FAIL: Sector without a header (preload %s, stat %s then %s).\n",
+               flash_status_str(preload_status), flash_status_str(before), flash_status_str(after));
+    }
+    flash_erase_safe(foreign);
+
+    // Invalid offsets are rejected before the table is consulted.
+    if (flash_stat(offset + 1, &cached) == FLASH_ERR_ALIGNMENT) {
+        printf("PASS: flash_stat rejected an unaligned offset.\n");
+    } else {
+        printf("FAIL: flash_stat accepted an unaligned offset.\n");
+    }
+}
+
+
+
+
+/**
+ * Tests the incremental wear scan. A pass is completed in small steps, a sector is then cycled a
+ * few times, and the second pass must see the higher maximum and a non-zero erase rate.
+ */
+void test_wear_statistics() {
+    printf("Testing wear statistics and endurance projection...\n");
+    uint32_t offset = 12288; // Correctly aligned offset for the test.
+    uint8_t data[32];
+    memset(data, 0x3C, sizeof(data));
+
+    flash_wear_monitor_t monitor;
+    flash_wear_init(&monitor);
+
+    // Complete the first pass in small steps, as a periodic task would.
+    uint32_t steps = 1;
+    while (!flash_wear_step(&monitor, 16)) {
+        steps++;
+    }
+    flash_wear_stats_t first = *flash_wear_stats(&monitor);
+    printf("First pass: %u sectors in %u steps, min %u, max %u, mean %.2f, stddev %.2f\n",
+           first.sectors, steps, first.min, first.max, first.mean, first.stddev);
+
+    // Cycle one sector so its write count rises above everything seen before.
+    uint32_t cycles = first.max + 3;
+    for (uint32_t i = 0; i < cycles; i++) {
+        flash_write_safe(offset, data, sizeof(data));
+    }
+
+    flash_wear_step(&monitor, 0);
+    const flash_wear_stats_t *second = flash_wear_stats(&monitor);
+    printf("Second pass: max %u, total %llu, rate %.1f erases/hour, %.3f%% used, remaining %.0f hours\n",
+           second->max, (unsigned long long)second->total, second->erase_rate_per_hour,
+           second->worst_percent_used, second->remaining_hours);
+
+    uint32_t binned = 0;
+    for (int i = 0; i < FLASH_WEAR_HISTOGRAM_BINS; i++) {
+        binned += second->histogram[i];
+    }
+
+    if (first.sectors > 0 && second->max >= cycles && second->total >= first.total + cycles &&
+        second->min <= second->max && binned == second->sectors && second->erase_rate_per_hour > 0.0f) {
+        printf("PASS: Wear statistics tracked the extra cycles.\n");
+    } else {
+        printf("FAIL: Wear statistics did not reflect the extra cycles.\n");
+    }
+
+    flash_erase_safe(offset);
+}
+
+
+
+
+/**
+ * Tests the word-wide comparison used for read-after-write verification, a verified write to a
+ * fixed offset, and an allocated write. Retiring a sector is permanent, so the retirement path
+ * itself is only exercised by real verify failures; here the allocator is checked to never hand
+ * out a sector that is already listed in the bad-sector table, or one whose header is corrupt.
+ */
+void test_verify_and_allocate() {
+    printf("Testing read-after-write verification and sector allocation...\n");
+    uint32_t words[64];
+    uint32_t copy[64];
+    for (int i = 0; i < 64; i++) {
+        words[i] = 0x01010101u * (uint32_t)i;
+    }
+    memcpy(copy, words, sizeof(words));
+
+    // Identical buffers match; a single flipped bit in the middle or the unaligned tail does not.
+    bool same = flash_words_equal(words, copy, sizeof(words));
+    copy[31] ^= 0x100;
+    bool middle = flash_words_equal(words, copy, sizeof(words));
+    copy[31] ^= 0x100;
+    ((uint8_t *)copy)[sizeof(copy) - 1] ^= 0x01;
+    bool tail = flash_words_equal((const uint8_t *)words + 1, (const uint8_t *)copy + 1, sizeof(words) - 1);
+
+    if (same && !middle && !tail) {
+        printf("PASS: Word-wide comparison detects single-bit differences.\n");
+    } else {
+        printf("FAIL: Word-wide comparison gave a wrong result.\n");
+    }
+
+    // A verified write to a fixed offset must succeed on a healthy sector.
+    uint32_t offset = 16384; // Correctly aligned offset for the test.
+    uint8_t data[200];
+    memset(data, 0x69, sizeof(data));
+    flash_set_verify(true);
+    flash_status_t status = flash_write_safe(offset, data, sizeof(data));
+    flash_set_verify(false);
+    if (status == FLASH_OK) {
+        printf("PASS: Verified write succeeded.\n");
+    } else {
+        printf("FAIL: Verified write returned '%s'.\n", flash_status_str(status));
+    }
+    flash_erase_safe(offset);
+
+    // An allocated write lands in a usable sector and reads back intact.
+    uint32_t allocated = 0;
+    status = flash_write_alloc(data, sizeof(data), &allocated);
+    uint8_t read_back[sizeof(data)];
+    memset(read_back, 0, sizeof(read_back));
+    flash_read_safe(allocated, read_back, sizeof(read_back), NULL);
+
+    if (status == FLASH_OK && !flash_bbt_is_retired(allocated) && memcmp(data, read_back, sizeof(data)) == 0) {
+        printf("PASS: Allocated write stored at offset %u (%u retired sectors).\n", allocated, flash_bbt_count());
+    } else {
+        printf("FAIL: Allocated write returned '%s'.\n", flash_status_str(status));
+    }
+    flash_erase_safe(allocated);
+
+    // A sector whose header fails its checksum, such as a log page, is not free until it is erased.
+    uint32_t foreign = 20480; // Correctly aligned offset for the test.
+    uint8_t zeros[16] = {0};
+    flash_erase_safe(foreign);
+    flash_program_partial(FLASH_TARGET_OFFSET + foreign, zeros, sizeof(zeros));
+    flash_cache_invalidate();
+    uint32_t picked = 0;
+    flash_status_t foreign_status = flash_alloc_sector_in(foreign, 1, &picked);
+    flash_erase_safe(foreign);
+    status = flash_alloc_sector_in(foreign, 1, &picked);
+    if (foreign_status == FLASH_ERR_NO_SPACE && status == FLASH_OK && picked == foreign) {
+        printf("PASS: Allocator skipped a sector without an intact header until it was erased.\n");
+    } else {
+        printf("FAIL: Allocation around a corrupt header returned '%s' then '%s'.\n",
+               flash_status_str(foreign_status), flash_status_str(status));
+    }
+}
+
+
+
+
+/**
+ * Reference CRC32C computed one bit at a time, used to check the table-driven kernel and to
+ * show how much faster it is.
+ */
+static uint32_t crc32c_bitwise(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * Tests the slicing-by-8 CRC32C kernel against the standard check value and a bitwise reference,
+ * including incremental updates over unaligned splits. It then corrupts one payload bit of a
+ * stored record and checks that both flash_verify_sector and flash_read_safe report it.
+ */
+void test_crc_protection() {
+    printf("Testing CRC32C checksums over headers and payloads...\n");
+
+    // The standard check value for CRC32C is 0xE3069283.
+    uint32_t check = crc32c("123456789", 9);
+
+    // Build a sector-sized buffer and compare the kernel with the reference, whole and in pieces.
+    static uint8_t block[FLASH_SECTOR_SIZE];
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = (uint8_t)(i * 31 + 7);
+    }
+    uint64_t start = time_us_64();
+    uint32_t fast = crc32c(block, sizeof(block));
+    uint64_t fast_us = time_us_64() - start;
+    start = time_us_64();
+    uint32_t slow = crc32c_bitwise(block, sizeof(block));
+    uint64_t slow_us = time_us_64() - start;
+    uint32_t pieces = crc32c_update(crc32c_update(crc32c(block, 13), block + 13, 1000), block + 1013, sizeof(block) - 1013);
+
+    printf("Sector checksum: %llu us (bitwise reference: %llu us)\n",
+           (unsigned long long)fast_us, (unsigned long long)slow_us);
+    if (check == 0xE3069283u && fast == slow && pieces == fast) {
+        printf("PASS: CRC32C kernel matches the reference and supports incremental updates.\n");
+    } else {
+        printf("FAIL: CRC32C kernel mismatch (check %08x, fast %08x, reference %08x, pieces %08x).\n",
+               check, fast, slow, pieces);
+    }
+
+    // Store a record, then clear one payload bit in place; flash can always turn a 1 into a 0.
+    uint32_t offset = 20480; // Correctly aligned offset for the test.
+    uint8_t data[128];
+    memset(data, 0xF0, sizeof(data));
+    flash_write_safe(offset, data, sizeof(data));
+    flash_status_t before = flash_verify_sector(offset);
+
+    uint8_t flipped = 0x70;
+    flash_program_partial(FLASH_TARGET_OFFSET + offset + FLASH_HEADER_SIZE + 10, &flipped, 1);
+
+    flash_status_t after = flash_verify_sector(offset);
+    uint8_t read_back[sizeof(data)];
+    flash_status_t read_status = flash_read_safe(offset, read_back, sizeof(read_back), NULL);
+
+    if (before == FLASH_OK && after == FLASH_ERR_CRC && read_status == FLASH_ERR_CRC) {
+        printf("PASS: Corrupted payload detected by its checksum.\n");
+    } else {
+        printf("FAIL: Corruption not detected (before: %s, after: %s, read: %s).\n",
+               flash_status_str(before), flash_status_str(after), flash_status_str(read_status));
+    }
+    flash_erase_safe(offset);
+}
+
+
+
+
+// Loopback sink for the protocol test: collects everything the device would send to the host.
+static uint8_t loopback[3 * PROTO_MAX_FRAME]; // Room for a two-sector dump.
+static size_t loopback_len;
+
+static void loopback_write(const uint8_t *data, size_t len) {
+    if (loopback_len + len <= sizeof(loopback)) {
+        memcpy(loopback + loopback_len, data, len);
+        loopback_len += len;
+    }
+}
+
+/**
+ * Builds a request frame the way a host would and feeds it to the protocol byte by byte.
+ * When corrupt is set, one CRC bit is flipped before encoding.
+ */
+static size_t encode_request(uint8_t opcode, uint8_t seq, const uint8_t *payload, size_t len, bool corrupt,
+                             uint8_t *encoded) {
+    static uint8_t frame[PROTO_MAX_FRAME];
+    frame[0] = opcode;
+    frame[1] = seq;
+    frame[2] = (uint8_t)len;
+    frame[3] = (uint8_t)(len >> 8);
+    memcpy(frame + PROTO_HEADER_SIZE, payload, len);
+    uint32_t crc = crc32c(frame, PROTO_HEADER_SIZE + len) ^ (corrupt ? 1u : 0u);
+    memcpy(frame + PROTO_HEADER_SIZE + len, &crc, sizeof(crc));
+
+    return cobs_encode(frame, PROTO_HEADER_SIZE + len + PROTO_CRC_SIZE, encoded);
+}
+
+static void send_request(uint8_t opcode, uint8_t seq, const uint8_t *payload, size_t len, bool corrupt) {
+    static uint8_t encoded[COBS_MAX_ENCODED(PROTO_MAX_FRAME)];
+    size_t n = encode_request(opcode, seq, payload, len, corrupt, encoded);
+    proto_receive(0);
+    for (size_t i = 0; i < n; i++) {
+        proto_receive(encoded[i]);
+    }
+    proto_receive(0);
+}
+
+/**
+ * Decodes the first frame in the loopback buffer the way a host would. Returns the payload
+ * length, or -1 if no intact frame was captured.
+ */
+static int take_response(uint8_t *opcode, uint8_t *seq, uint8_t *payload) {
+    static uint8_t frame[PROTO_MAX_FRAME + 8];
+    size_t start = 0;
+    while (start < loopback_len && loopback[start] == 0) {
+        start++;
+    }
+    size_t end = start;
+    while (end < loopback_len && loopback[end] != 0) {
+        end++;
+    }
+    if (end == start || end - start > sizeof(frame)) {
+        return -1;
+    }
+
+    size_t n = cobs_decode(loopback + start, end - start, frame);
+    memmove(loopback, loopback + end, loopback_len - end);
+    loopback_len -= end;
+    if (n < PROTO_HEADER_SIZE + PROTO_CRC_SIZE) {
+        return -1;
+    }
+
+    size_t len = frame[2] | (frame[3] << 8);
+    uint32_t crc;
+    memcpy(&crc, frame + PROTO_HEADER_SIZE + len, sizeof(crc));
+    if (len + PROTO_HEADER_SIZE + PROTO_CRC_SIZE != n || crc32c(frame, PROTO_HEADER_SIZE + len) != crc) {
+        return -1;
+    }
+    *opcode = frame[0];
+    *seq = frame[1];
+    memcpy(payload, frame + PROTO_HEADER_SIZE, len);
+    return (int)len;
+}
+
+/**
+ * Executes every queued protocol request, as the main loop would over several polls.
+ */
+static void run_queued(void) {
+    while (proto_poll()) {
+    }
+}
+
+/**
+ * Tests the binary protocol end to end: COBS round trips on data full of zero bytes, a write and
+ * read of a payload containing every byte value, a stat, a dump, and rejection of a frame with a
+ * bad CRC. Responses are captured by a loopback sink instead of being sent over USB.
+ */
+void test_binary_protocol() {
+    printf("Testing the binary framed protocol...\n");
+    static uint8_t payload[PROTO_MAX_PAYLOAD];
+    static uint8_t response[PROTO_MAX_PAYLOAD];
+    uint8_t opcode = 0, seq = 0;
+    proto_init(loopback_write);
+    loopback_len = 0;
+
+    // COBS must remove every zero and restore the data exactly, across full 254-byte blocks.
+    static uint8_t raw[600], encoded[COBS_MAX_ENCODED(600)], decoded[600];
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        raw[i] = (i % 3 == 0) ? 0 : (uint8_t)i;
+    }
+    memset(raw + 300, 0x55, 260);
+    size_t encoded_len = cobs_encode(raw, sizeof(raw), encoded);
+    bool zero_free = memchr(encoded, 0, encoded_len) == NULL;
+    size_t decoded_len = cobs_decode(encoded, encoded_len, decoded);
+    if (zero_free && decoded_len == sizeof(raw) && memcmp(raw, decoded, sizeof(raw)) == 0) {
+        printf("PASS: COBS round trip (%u bytes encoded as %u).\n", (unsigned)sizeof(raw), (unsigned)encoded_len);
+    } else {
+        printf("FAIL: COBS round trip mismatch.\n");
+    }
+
+    // Write a payload containing every byte value, including zeros, then read it back.
+    uint32_t offset = 24576; // Correctly aligned offset for the test.
+    memcpy(payload, &offset, 4);
+    for (int i = 0; i < 256; i++) {
+        payload[4 + i] = (uint8_t)i;
+    }
+    send_request(PROTO_OP_WRITE, 7, payload, 4 + 256, false);
+    run_queued();
+    int len = take_response(&opcode, &seq, response);
+    bool write_ok = len == 1 && opcode == (PROTO_OP_WRITE | PROTO_RESPONSE) && seq == 7 && response[0] == FLASH_OK;
+
+    send_request(PROTO_OP_READ, 8, payload, 4, false);
+    len = take_response(&opcode, &seq, response);
+    bool read_ok = len == 1 + 256 && seq == 8 && response[0] == FLASH_OK && memcmp(response + 1, payload + 4, 256) == 0;
+
+    send_request(PROTO_OP_STAT, 9, payload, 4, false);
+    len = take_response(&opcode, &seq, response);
+    uint32_t data_len = 0;
+    if (len == 15) {
+        memcpy(&data_len, response + 7, sizeof(data_len));
+    }
+    bool stat_ok = len == 15 && response[0] == FLASH_OK && response[1] == 1 && data_len == 256;
+
+    if (write_ok && read_ok && stat_ok) {
+        printf("PASS: Write, read and stat frames round trip binary data.\n");
+    } else {
+        printf("FAIL: Protocol round trip (write: %d, read: %d, stat: %d).\n", write_ok, read_ok, stat_ok);
+    }
+
+    // Dump the record's first page: one data chunk, then the end frame with the running CRC.
+    uint32_t dump_length = 256;
+    memcpy(payload + 4, &dump_length, 4);
+    send_request(PROTO_OP_DUMP, 10, payload, 8, false);
+    run_queued();
+    int chunk = take_response(&opcode, &seq, response);
+    bool chunk_ok = chunk == 5 + 256 && response[0] == FLASH_OK &&
+                    memcmp(response + 5, (const void *)(XIP_BASE + FLASH_TARGET_OFFSET + offset), 256) == 0;
+    uint32_t dump_crc = 0;
+    int end = take_response(&opcode, &seq, response);
+    if (end == 9) {
+        memcpy(&dump_crc, response + 5, sizeof(dump_crc));
+    }
+    if (chunk_ok && end == 9 && seq == 10 &&
+        dump_crc == crc32c((const void *)(XIP_BASE + FLASH_TARGET_OFFSET + offset), 256)) {
+        printf("PASS: Dump streamed the requested range.\n");
+    } else {
+        printf("FAIL: Dump returned unexpected frames (%d, %d).\n", chunk, end);
+    }
+
+    // A frame with a corrupt CRC must be rejected without touching flash.
+    send_request(PROTO_OP_ERASE, 11, payload, 4, true);
+    len = take_response(&opcode, &seq, response);
+    flash_stat_t stat;
+    flash_stat(offset, &stat);
+    if (len == 1 && response[0] == PROTO_ERR_BAD_FRAME && stat.valid) {
+        printf("PASS: Frame with a bad CRC was rejected.\n");
+    } else {
+        printf("FAIL: Frame with a bad CRC was not rejected.\n");
+    }
+
+    flash_erase_safe(offset);
+}
+
+
+
+/**
+ * Tests pipelined protocol requests: writes are queued and answered only once executed, a read of
+ * an unrelated sector overtakes them, a read of a sector with a pending write waits its turn, and
+ * credits track the free queue slots, with a request beyond the last credit refused as busy.
+ */
+void test_pipelined_protocol() {
+    printf("Testing pipelined protocol requests and flow-control credits...\n");
+    static uint8_t payload[PROTO_MAX_PAYLOAD];
+    static uint8_t response[PROTO_MAX_PAYLOAD];
+    uint8_t opcode = 0, seq = 0;
+    proto_init(loopback_write);
+    loopback_len = 0;
+
+    // Queue a write, then read a different sector that already holds a record.
+    uint32_t written = 28672, other = 24576; // Correctly aligned offsets for the test.
+    memcpy(payload, &written, 4);
+    memset(payload + 4, 0x3C, 64);
+    send_request(PROTO_OP_WRITE, 20, payload, 4 + 64, false);
+    bool write_deferred = take_response(&opcode, &seq, response) < 0;
+
+    memcpy(payload, &other, 4);
+    send_request(PROTO_OP_READ, 21, payload, 4, false);
+    int len = take_response(&opcode, &seq, response);
+    bool overtook = len > 0 && seq == 21 && opcode == (PROTO_OP_READ | PROTO_RESPONSE);
+
+    // A read of the sector being written must not see it before the write.
+    memcpy(payload, &written, 4);
+    send_request(PROTO_OP_READ, 22, payload, 4, false);
+    bool read_deferred = take_response(&opcode, &seq, response) < 0;
+
+    run_queued();
+    len = take_response(&opcode, &seq, response);
+    bool write_done = len == 1 && seq == 20 && response[0] == FLASH_OK;
+    len = take_response(&opcode, &seq, response);
+    bool read_after = len == 1 + 64 && seq == 22 && response[0] == FLASH_OK && response[1] == 0x3C;
+
+    if (write_deferred && overtook && read_deferred && write_done && read_after) {
+        printf("PASS: Responses arrived out of order and hazards were respected.\n");
+    } else {
+        printf("FAIL: Pipelining (deferred: %d, overtook: %d, held: %d, write: %d, read: %d).\n",
+               write_deferred, overtook, read_deferred, write_done, read_after);
+    }
+
+    // Fill every slot with erases, check the credits, and overrun by one.
+    for (int i = 0; i < PROTO_QUEUE_DEPTH; i++) {
+        send_request(PROTO_OP_ERASE, (uint8_t)(30 + i), payload, 4, false);
+    }
+    send_request(PROTO_OP_CREDITS, 40, payload, 0, false);
+    len = take_response(&opcode, &seq, response);
+    bool no_credits = len == 3 && seq == 40 && response[1] == 0 && response[2] == PROTO_QUEUE_DEPTH;
+
+    send_request(PROTO_OP_ERASE, 41, payload, 4, false);
+    len = take_response(&opcode, &seq, response);
+    bool busy = len == 1 && seq == 41 && response[0] == PROTO_ERR_BUSY;
+
+    run_queued();
+    int completed = 0;
+    while (take_response(&opcode, &seq, response) == 1 && seq == 30 + completed) {
+        completed++;
+    }
+    send_request(PROTO_OP_CREDITS, 42, payload, 0, false);
+    len = take_response(&opcode, &seq, response);
+    bool refilled = len == 3 && response[1] == PROTO_QUEUE_DEPTH;
+
+    if (no_credits && busy && completed == PROTO_QUEUE_DEPTH && refilled) {
+        printf("PASS: Credits tracked the queue and an overrun was refused.\n");
+    } else {
+        printf("FAIL: Credits (exhausted: %d, busy: %d, completed: %d, refilled: %d).\n",
+               no_credits, busy, completed, refilled);
+    }
+}
+
+
+
+static uint8_t console_echo[64];
+static size_t console_echo_len;
+
+static void console_echo_write(const uint8_t *data, size_t len) {
+    if (console_echo_len + len <= sizeof(console_echo)) {
+        memcpy(console_echo + console_echo_len, data, len);
+        console_echo_len += len;
+    }
+}
+
+/**
+ * Tests the framing path from console input to the protocol: a PING frame sent with its leading
+ * and closing 0x00 in the middle of a typed command must be answered, must not be echoed, and
+ * must leave the command around it intact.
+ */
+void test_framed_console() {
+    printf("Testing protocol frames through the console line reader...\n");
+    static uint8_t input[COBS_MAX_ENCODED(PROTO_MAX_FRAME) + 16];
+    static uint8_t response[PROTO_MAX_PAYLOAD];
+    uint8_t opcode = 0, seq = 0;
+    const uint8_t ping[] = { 'h', 'i' };
+    proto_init(loopback_write);
+    line_reader_init(console_echo_write, proto_receive);
+    loopback_len = 0;
+    console_echo_len = 0;
+
+    size_t n = 0;
+    memcpy(input + n, "ab", 2);
+    n += 2;
+    input[n++] = 0;
+    n += encode_request(PROTO_OP_PING, 50, ping, sizeof(ping), false, input + n);
+    input[n++] = 0;
+    memcpy(input + n, "c\r", 2);
+    n += 2;
+
+    char *line = NULL;
+    bool queued = line_reader_feed(input, n) == n;
+    for (int polls = 0; line == NULL && polls < 4; polls++) {
+        line = line_reader_poll();
+    }
+
+    int len = take_response(&opcode, &seq, response);
+    bool answered = len == 1 + (int)sizeof(ping) && seq == 50 && opcode == (PROTO_OP_PING | PROTO_RESPONSE) &&
+                    response[0] == FLASH_OK && memcmp(response + 1, ping, sizeof(ping)) == 0;
+    bool line_intact = line != NULL && strcmp(line, "abc") == 0;
+    bool echo_clean = console_echo_len == 5 && memcmp(console_echo, "abc\r\n", 5) == 0;
+    if (queued && answered && line_intact && echo_clean) {
+        printf("PASS: The frame was answered and the typed command around it survived.\n");
+    } else {
+        printf("FAIL: Framed console (queued: %d, answered: %d, line: %d, echo: %u bytes).\n",
+               queued, answered, line_intact, (unsigned)console_echo_len);
+    }
+}
+
+
+
+/**
+ * Tests bulk backup and restore over the protocol: two sectors are dumped into RAM, overwritten,
+ * and loaded back sector by sector. The record must read back intact, the dump's running CRC and
+ * each load's sector CRC must match the image, and a dump to the end of the region must end at
+ * the region boundary.
+ */
+void test_bulk_dump_load() {
+    printf("Testing bulk dump and load of flash regions...\n");
+    static uint8_t image[2 * FLASH_SECTOR_SIZE];
+    static uint8_t payload[PROTO_MAX_PAYLOAD];
+    static uint8_t response[PROTO_MAX_PAYLOAD];
+    uint8_t opcode = 0, seq = 0;
+    proto_init(loopback_write);
+    loopback_len = 0;
+
+    // Put a record in the first sector and a blank second sector in the image.
+    uint32_t offset = 32768; // Correctly aligned offset for the test.
+    uint8_t data[300];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7);
+    }
+    flash_write_safe(offset, data, sizeof(data));
+    flash_erase_safe(offset + FLASH_SECTOR_SIZE);
+
+    // Capture both sectors the way a host would.
+    uint32_t length = sizeof(image);
+    memcpy(payload, &offset, 4);
+    memcpy(payload + 4, &length, 4);
+    send_request(PROTO_OP_DUMP, 50, payload, 8, false);
+    run_queued();
+    size_t captured = 0;
+    uint32_t dump_crc = 0;
+    int len;
+    while ((len = take_response(&opcode, &seq, response)) > 9) {
+        uint32_t chunk_offset;
+        memcpy(&chunk_offset, response + 1, 4);
+        if (chunk_offset == offset + captured && captured + len - 5 <= sizeof(image)) {
+            memcpy(image + captured, response + 5, len - 5);
+            captured += len - 5;
+        }
+    }
+    if (len == 9) {
+        memcpy(&dump_crc, response + 5, 4);
+    }
+    bool dump_ok = captured == sizeof(image) && dump_crc == crc32c(image, sizeof(image));
+
+    // Overwrite the record, then restore both sectors from the image.
+    memset(data, 0x11, sizeof(data));
+    flash_write_safe(offset, data, sizeof(data));
+    bool loads_ok = true;
+    for (uint32_t s = 0; s < 2; s++) {
+        uint32_t sector = offset + s * FLASH_SECTOR_SIZE;
+        memcpy(payload, &sector, 4);
+        memcpy(payload + 4, image + s * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+        send_request(PROTO_OP_LOAD, (uint8_t)(51 + s), payload, 4 + FLASH_SECTOR_SIZE, false);
+    }
+    run_queued();
+    for (uint32_t s = 0; s < 2; s++) {
+        uint32_t sector_crc = 0;
+        len = take_response(&opcode, &seq, response);
+        if (len == 5) {
+            memcpy(&sector_crc, response + 1, 4);
+        }
+        loads_ok = loads_ok && len == 5 && response[0] == FLASH_OK && seq == 51 + s &&
+                   sector_crc == crc32c(image + s * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    }
+
+    uint8_t buffer[sizeof(data)];
+    size_t bytes_read = 0;
+    flash_status_t status = flash_read_safe(offset, buffer, sizeof(buffer), &bytes_read);
+    bool restored = status == FLASH_OK && bytes_read == sizeof(buffer) && buffer[1] == 7 && buffer[299] == (uint8_t)(299 * 7);
+
+    if (dump_ok && loads_ok && restored) {
+        printf("PASS: Two sectors were dumped, overwritten and restored intact.\n");
+    } else {
+        printf("FAIL: Bulk round trip (dump: %d, loads: %d, restored: %s).\n", dump_ok, loads_ok, flash_status_str(status));
+    }
+
+    // Dumping from the last user sector to the end yields exactly one sector.
+    uint32_t last = FLASH_LAST_USER_SECTOR;
+    uint32_t to_end = PROTO_DUMP_TO_END;
+    memcpy(payload, &last, 4);
+    memcpy(payload + 4, &to_end, 4);
+    send_request(PROTO_OP_DUMP, 60, payload, 8, false);
+    run_queued();
+    int first = take_response(&opcode, &seq, response);
+    int final = take_response(&opcode, &seq, response);
+    uint32_t end_offset = 0;
+    if (final == 9) {
+        memcpy(&end_offset, response + 1, 4);
+    }
+    if (first == 5 + FLASH_SECTOR_SIZE && final == 9 && end_offset == last + FLASH_SECTOR_SIZE) {
+        printf("PASS: A dump to the end stopped at the end of the user region.\n");
+    } else {
+        printf("FAIL: Dump to the end returned unexpected frames (%d, %d).\n", first, final);
+    }
+}
+
+
+
+/**
+ * Tests the persistent FIFO queue on two sectors: messages come back in order across a simulated
+ * reboot, the write position wraps around and erases the sector it reuses, and a queue holding
+ * live messages in every sector refuses further pushes instead of overwriting them.
+ */
+void test_flash_queue() {
+    printf("Testing the persistent FIFO queue...\n");
+    uint32_t first = 40960; // Two correctly aligned sectors reserved for the test.
+    flash_queue_t queue;
+    flash_queue_open(&queue, first, 2);
+    flash_queue_clear(&queue);
+
+    // Push 20 messages and pop the first 5.
+    char message[32];
+    for (int i = 0; i < 20; i++) {
+        int len = snprintf(message, sizeof(message), "sample %d", i);
+        flash_queue_push(&queue, (const uint8_t *)message, (size_t)len);
+    }
+    for (int i = 0; i < 5; i++) {
+        flash_queue_pop(&queue);
+    }
+
+    // Reopening must recover the same position, as it would after a power cycle.
+    flash_queue_t reopened;
+    flash_queue_open(&reopened, first, 2);
+    uint8_t buffer[FLASH_QUEUE_MAX_MESSAGE];
+    size_t len = 0;
+    flash_status_t status = flash_queue_peek(&reopened, buffer, sizeof(buffer), &len);
+    bool recovered = status == FLASH_OK && reopened.count == 15 && reopened.head == queue.head &&
+                     len == 8 && memcmp(buffer, "sample 5", 8) == 0;
+    if (recovered) {
+        printf("PASS: Queue recovered 15 messages in order after reopening.\n");
+    } else {
+        printf("FAIL: Queue recovery (status: %s, count: %u).\n", flash_status_str(status), (unsigned)reopened.count);
+    }
+
+    // Drain it, then push past the end of the second sector so the first one is reused.
+    bool in_order = true;
+    for (int i = 5; i < 20; i++) {
+        snprintf(message, sizeof(message), "sample %d", i);
+        status = flash_queue_peek(&reopened, buffer, sizeof(buffer), &len);
+        in_order = in_order && status == FLASH_OK && len == strlen(message) && memcmp(buffer, message, len) == 0;
+        flash_queue_pop(&reopened);
+    }
+    for (int i = 0; i < 20; i++) {
+        int n = snprintf(message, sizeof(message), "wrap %d", i);
+        status = flash_queue_push(&reopened, (const uint8_t *)message, (size_t)n);
+        in_order = in_order && status == FLASH_OK;
+    }
+    status = flash_queue_peek(&reopened, buffer, sizeof(buffer), &len);
+    bool wrapped = status == FLASH_OK && reopened.head < 20 && len == 6 && memcmp(buffer, "wrap 0", 6) == 0;
+    if (in_order && wrapped) {
+        printf("PASS: Queue drained in order and wrapped around its sectors.\n");
+    } else {
+        printf("FAIL: Queue wrap (in order: %d, wrapped: %d).\n", in_order, wrapped);
+    }
+
+    // Messages now live in both sectors, so filling the queue must stop before reusing one.
+    int pushed = 0;
+    while (flash_queue_push(&reopened, (const uint8_t *)"x", 1) == FLASH_OK && pushed < 64) {
+        pushed++;
+    }
+    status = flash_queue_push(&reopened, (const uint8_t *)"x", 1);
+    if (status == FLASH_ERR_NO_SPACE && reopened.count == 20 + (uint32_t)pushed) {
+        printf("PASS: Full queue refused a push after %d more messages.\n", pushed);
+    } else {
+        printf("FAIL: Full queue returned '%s' after %d pushes.\n", flash_status_str(status), pushed);
+    }
+}
+
+
+
+/**
+ * Tests the circular record log on two sectors: samples are read back by index across a sector
+ * boundary, a flushed log reopens at the same end, and once the log wraps the overwritten samples
+ * are refused while the newest ones remain readable.
+ */
+void test_flash_log() {
+    printf("Testing the circular sample log...\n");
+    static flash_log_t log;
+    uint32_t first = 49152; // Two correctly aligned sectors reserved for the test.
+    flash_log_open(&log, first, 2, sizeof(flash_sample_t));
+    flash_log_clear(&log);
+
+    // Fill the first sector and spill into the second.
+    uint32_t count = log.records_per_sector + 40;
+    for (uint32_t i = 0; i < count; i++) {
+        flash_sample_t sample = { .timestamp_ms = i * 10, .value = (float)i * 0.5f };
+        flash_log_append(&log, &sample);
+    }
+    flash_sample_t sample;
+    bool across = flash_log_read(&log, log.records_per_sector - 1, &sample) == FLASH_OK &&
+                  sample.timestamp_ms == (log.records_per_sector - 1) * 10 &&
+                  flash_log_read(&log, count - 1, &sample) == FLASH_OK && sample.value == (float)(count - 1) * 0.5f;
+
+    // Flushing makes the open page durable, so reopening finds the same end.
+    flash_log_flush(&log);
+    static flash_log_t reopened;
+    flash_log_open(&reopened, first, 2, sizeof(flash_sample_t));
+    bool resumed = flash_log_end(&reopened) == count &&
+                   flash_log_read(&reopened, count - 1, &sample) == FLASH_OK && sample.timestamp_ms == (count - 1) * 10;
+    if (across && resumed) {
+        printf("PASS: Samples read back by index and the log resumed after reopening.\n");
+    } else {
+        printf("FAIL: Sample log (across sectors: %d, resumed: %d).\n", across, resumed);
+    }
+
+    // Two more sectors' worth wraps the ring twice over the first sector's samples.
+    for (uint32_t i = count; i < count + 2 * reopened.records_per_sector; i++) {
+        flash_sample_t next = { .timestamp_ms = i * 10, .value = (float)i * 0.5f };
+        flash_log_append(&reopened, &next);
+    }
+    uint64_t end = flash_log_end(&reopened);
+    flash_status_t old_status = flash_log_read(&reopened, 0, &sample);
+    bool oldest_ok = flash_log_read(&reopened, flash_log_first(&reopened), &sample) == FLASH_OK &&
+                     sample.timestamp_ms == (uint32_t)flash_log_first(&reopened) * 10;
+    if (old_status == FLASH_ERR_OUT_OF_BOUNDS && oldest_ok && end - flash_log_first(&reopened) <= 2 * reopened.records_per_sector) {
+        printf("PASS: Wrapped log dropped the oldest sector and kept %u samples.\n", (unsigned)(end - flash_log_first(&reopened)));
+    } else {
+        printf("FAIL: Wrapped log (old read: %s, oldest readable: %d).\n", flash_status_str(old_status), oldest_ok);
+    }
+}
+
+
+
+/**
+ * Tests the compressed time series: a block holding awkward samples (jitter, long gaps, time going
+ * backwards, signed zeros, infinities and NaN payloads) decodes bit for bit, and a stored series
+ * that spans many sealed blocks decodes in order, straight from flash.
+ */
+void test_flash_ts() {
+    printf("Testing the compressed time series...\n");
+    static const uint32_t times[] = {1000, 1001, 1002, 1004, 1003, 1100, 5000, 5000, 900000, 4000000000u, 5};
+    static const uint32_t values[] = {0x41A00000, 0x41A00000, 0x41A00001, 0x80000000, 0x00000000,
+                                      0x7F800000, 0xFF800000, 0x7FC00123, 0x3F800000, 0xC2F6E979, 0x41A00000};
+    size_t n = sizeof(times) / sizeof(times[0]);
+
+    static flash_ts_encoder_t enc;
+    flash_ts_encoder_reset(&enc);
+    bool appended = true;
+    for (size_t i = 0; i < n; i++) {
+        float value;
+        memcpy(&value, &values[i], sizeof(value));
+        appended = appended && flash_ts_encoder_append(&enc, times[i], value);
+    }
+    flash_ts_decoder_t dec;
+    flash_ts_decoder_init(&dec, enc.block);
+    size_t decoded = 0;
+    bool exact = true;
+    uint32_t ts;
+    float value;
+    while (flash_ts_decoder_next(&dec, &ts, &value)) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        exact = exact && decoded < n && ts == times[decoded] && bits == values[decoded];
+        decoded++;
+    }
+    if (appended && exact && decoded == n) {
+        printf("PASS: Edge-case samples decoded bit for bit.\n");
+    } else {
+        printf("FAIL: Edge-case samples (appended: %d, exact: %d, decoded: %u of %u).\n",
+               appended, exact, (unsigned)decoded, (unsigned)n);
+    }
+
+    // A slowly drifting 12-bit reading sampled every millisecond, as from the ADC.
+    static flash_ts_store_t store;
+    flash_ts_open(&store, 57344, 4); // Four correctly aligned sectors reserved for the test.
+    flash_log_clear(&store.log);
+    uint32_t samples = 3000;
+    for (uint32_t i = 0; i < samples; i++) {
+        uint32_t raw = 2048 + (i / 37) % 9;
+        flash_ts_append(&store, 10000 + i, (float)raw * (3.3f / 4096.0f));
+    }
+    flash_ts_seal(&store);
+
+    uint32_t checked = 0;
+    bool in_order = true;
+    for (uint64_t b = flash_log_first(&store.log); b < flash_log_end(&store.log); b++) {
+        const uint8_t *block;
+        if (flash_ts_block(&store, b, &block) != FLASH_OK) {
+            in_order = false;
+            break;
+        }
+        flash_ts_decoder_init(&dec, block);
+        while (flash_ts_decoder_next(&dec, &ts, &value)) {
+            uint32_t raw = 2048 + (checked / 37) % 9;
+            in_order = in_order && ts == 10000 + checked && value == (float)raw * (3.3f / 4096.0f);
+            checked++;
+        }
+    }
+    uint32_t blocks = (uint32_t)(flash_log_end(&store.log) - flash_log_first(&store.log));
+    uint32_t stored = blocks * FLASH_TS_BLOCK_SIZE;
+    if (in_order && checked == samples) {
+        printf("PASS: %u samples decoded from %u blocks (%u bytes, %u.%u x smaller than raw).\n",
+               (unsigned)checked, (unsigned)blocks, (unsigned)stored,
+               (unsigned)(samples * 8 / stored), (unsigned)(samples * 80 / stored % 10));
+    } else {
+        printf("FAIL: Stored series (in order: %d, decoded %u of %u).\n", in_order, (unsigned)checked, (unsigned)samples);
+    }
+}
+
+
+
+/**
+ * Tests zone-map queries over a compressed series: aggregates over a time range must match a
+ * brute-force decode of every sample, while only the blocks at the two ends of the range are
+ * decoded and a range outside the series touches nothing.
+ */
+void test_flash_ts_query() {
+    printf("Testing time range queries over block zone maps...\n");
+    static flash_ts_store_t store;
+    flash_ts_open(&store, 57344, 4); // Four correctly aligned sectors reserved for the test.
+    flash_log_clear(&store.log);
+
+    uint32_t noise = 777;
+    for (uint32_t i = 0; i < 3000; i++) {
+        noise = noise * 1103515245u + 12345u;
+        // Tenths are not exact in binary, so a sum kept in float would drift from the decoded one.
+        flash_ts_append(&store, 50000 + i, 10.0f + (float)((noise >> 16) & 63) * 0.1f);
+    }
+
+    // Brute force: decode every block, sealed and open, and aggregate the range by hand.
+    uint32_t from = 50321, to = 52876;
+    flash_ts_summary_t expected = {0};
+    expected.min = 1e30f;
+    expected.max = -1e30f;
+    for (uint64_t b = flash_log_first(&store.log); b <= flash_log_end(&store.log); b++) {
+        const uint8_t *block = store.encoder.block;
+        if (b < flash_log_end(&store.log) && flash_ts_block(&store, b, &block) != FLASH_OK) {
+            continue;
+        }
+        flash_ts_decoder_t dec;
+        uint32_t ts;
+        float value;
+        flash_ts_decoder_init(&dec, block);
+        while (flash_ts_decoder_next(&dec, &ts, &value)) {
+            if (ts >= from && ts <= to) {
+                expected.count++;
+                expected.sum += value;
+                expected.min = value < expected.min ? value : expected.min;
+                expected.max = value > expected.max ? value : expected.max;
+            }
+        }
+    }
+
+    flash_ts_summary_t result;
+    flash_ts_query(&store, from, to, &result);
+    double sum_error = result.count ? (result.sum - expected.sum) / expected.sum : 1.0;
+    if (sum_error < 0) {
+        sum_error = -sum_error;
+    }
+    bool matches = result.count == expected.count && result.count == to - from + 1 &&
+                   result.min == expected.min && result.max == expected.max && sum_error < 1e-12 &&
+                   result.first_ts == from && result.last_ts == to;
+    if (matches && result.blocks_decoded <= 2 && result.blocks_summarized > 0) {
+        printf("PASS: Range aggregate matched, %u blocks from headers and %u decoded.\n",
+               (unsigned)result.blocks_summarized, (unsigned)result.blocks_decoded);
+    } else {
+        printf("FAIL: Range aggregate (count %u vs %u, min %f vs %f, max %f vs %f, decoded %u).\n",
+               (unsigned)result.count, (unsigned)expected.count, result.min, expected.min,
+               result.max, expected.max, (unsigned)result.blocks_decoded);
+    }
+
+    flash_ts_query(&store, 90000, 99999, &result);
+    if (result.count == 0 && result.blocks_decoded == 0 && result.blocks_summarized == 0) {
+        printf("PASS: A range after the series touched no blocks.\n");
+    } else {
+        printf("FAIL: A range after the series returned %u samples.\n", (unsigned)result.count);
+    }
+}
+
+
+
+/**
+ * Tests incremental rollups with a one-second and a one-minute tier fed 130 seconds of samples
+ * every 10 ms. Closed periods must be stored with exact counts and means, a range query must
+ * return one point per period in it, and the minute still being accumulated must be reported
+ * from RAM.
+ */
+void test_flash_rollup() {
+    printf("Testing incremental rollup tiers...\n");
+    const flash_rollup_tier_config_t configs[] = {
+        { .period_ms = 1000, .first_offset = 73728, .sectors = 2 },  // Correctly aligned sectors
+        { .period_ms = 60000, .first_offset = 81920, .sectors = 2 }, // reserved for the test.
+    };
+    static flash_rollup_t rollup;
+    flash_rollup_open(&rollup, configs, 2);
+    for (uint32_t i = 0; i < 2; i++) {
+        flash_log_clear(&rollup.tiers[i].log);
+    }
+
+    // The value cycles through 0..99 each second, so every second averages 49.5.
+    for (uint32_t t = 0; t < 130000; t += 10) {
+        flash_rollup_add(&rollup, t, (float)((t / 10) % 100));
+    }
+
+    flash_rollup_point_t points[16];
+    uint32_t n = 0;
+    flash_rollup_query(&rollup, 0, 20000, 29999, points, 16, &n);
+    bool seconds_ok = n == 10;
+    for (uint32_t i = 0; i < n && seconds_ok; i++) {
+        seconds_ok = points[i].start_ms == 20000 + i * 1000 && points[i].count == 100 &&
+                     points[i].min == 0.0f && points[i].max == 99.0f && points[i].mean == 49.5f;
+    }
+    if (seconds_ok) {
+        printf("PASS: Ten one-second points returned for a ten-second range.\n");
+    } else {
+        printf("FAIL: One-second tier returned %u points.\n", (unsigned)n);
+    }
+
+    flash_rollup_query(&rollup, 1, 0, UINT32_MAX, points, 16, &n);
+    bool minutes_ok = n == 3 && points[0].count == 6000 && points[1].start_ms == 60000 &&
+                      points[1].count == 6000 && points[2].start_ms == 120000 && points[2].count == 1000;
+    if (minutes_ok && flash_rollup_retention_ms(&rollup, 1) == (uint64_t)rollup.tiers[1].log.records_per_sector * 60000) {
+        printf("PASS: Minute tier holds two closed minutes and the open one (retention %u h).\n",
+               (unsigned)(flash_rollup_retention_ms(&rollup, 1) / 3600000u));
+    } else {
+        printf("FAIL: Minute tier returned %u points.\n", (unsigned)n);
+    }
+}
+
+
+
+/**
+ * Stores DeviceConfig snapshots from four devices in the columnar layout, then checks that every
+ * snapshot is reassembled exactly, that scanning sensor_value for one name finds only that
+ * device's snapshots, and that the layout takes fewer bytes than serialized structs.
+ */
+void test_columnar_configs() {
+    printf("Testing the columnar DeviceConfig history...\n");
+    static flash_columnar_store_t store;
+    static const char *names[] = { "pump", "fan", "valve", "heater" };
+    const uint32_t snapshots = 200;
+
+    flash_columnar_open(&store, 90112, 2); // Correctly aligned sectors reserved for the test.
+    flash_log_clear(&store.log);
+    for (uint32_t i = 0; i < snapshots; i++) {
+        DeviceConfig config = { .id = 1000 + i, .sensor_value = (float)i * 0.5f };
+        strncpy(config.name, names[i % 4], sizeof(config.name) - 1);
+        flash_columnar_append(&store, &config);
+    }
+    flash_columnar_seal(&store);
+
+    uint32_t checked = 0;
+    bool rows_ok = true;
+    for (uint64_t b = flash_log_first(&store.log); b < flash_log_end(&store.log); b++) {
+        const uint8_t *block;
+        if (flash_columnar_block(&store, b, &block) != FLASH_OK) {
+            rows_ok = false;
+            break;
+        }
+        for (uint16_t row = 0; row < flash_columnar_count(block); row++, checked++) {
+            DeviceConfig config;
+            rows_ok = rows_ok && flash_columnar_row(block, row, &config) && config.id == 1000 + checked &&
+                      config.sensor_value == (float)checked * 0.5f && strcmp(config.name, names[checked % 4]) == 0;
+        }
+    }
+    if (rows_ok && checked == snapshots) {
+        printf("PASS: All %u snapshots reassembled from their columns.\n", (unsigned)checked);
+    } else {
+        printf("FAIL: Reassembled %u of %u snapshots, mismatch: %d.\n", (unsigned)checked, (unsigned)snapshots, !rows_ok);
+    }
+
+    // "fan" is every fourth snapshot from i = 1, so its values are 0.5 + 2k for k < 50.
+    uint32_t count = 0;
+    double sum = 0;
+    flash_columnar_scan_values(&store, "fan", &count, &sum);
+    bool fan_ok = count == 50 && sum == 50 * 0.5 + 2.0 * (49 * 50 / 2);
+    flash_columnar_scan_values(&store, "pump2", &count, &sum);
+    if (fan_ok && count == 0) {
+        printf("PASS: Value scan filtered by name through the dictionary.\n");
+    } else {
+        printf("FAIL: Filtered value scan returned the wrong snapshots.\n");
+    }
+
+    uint32_t bytes = (uint32_t)(flash_log_end(&store.log) - flash_log_first(&store.log)) * FLASH_COLUMNAR_BLOCK_SIZE;
+    uint32_t row_bytes = snapshots * DEVICE_CONFIG_SIZE;
+    if (bytes < row_bytes) {
+        printf("PASS: Columnar blocks take %u bytes against %u for serialized structs.\n",
+               (unsigned)bytes, (unsigned)row_bytes);
+    } else {
+        printf("FAIL: Columnar blocks take %u bytes against %u for serialized structs.\n",
+               (unsigned)bytes, (unsigned)row_bytes);
+    }
+}
+
+
+
+/**
+ * Checks the byte layout produced by the schema-generated codecs: DeviceConfig fields land
+ * little-endian at fixed offsets and decode back unchanged, and a flash header written by
+ * serialize_flash_data decodes to the same fields with a checksum covering the bytes before it.
+ */
+void test_schema_codecs() {
+    printf("Testing schema-generated codecs...\n");
+    DeviceConfig config = { .id = 0x12345678, .sensor_value = 1.5f, .name = "Device1" };
+    uint8_t encoded[DEVICE_CONFIG_SIZE];
+    serialize_device_config(&config, encoded);
+
+    // 1.5f is 0x3FC00000.
+    static const uint8_t expected[8] = { 0x78, 0x56, 0x34, 0x12, 0x00, 0x00, 0xC0, 0x3F };
+    DeviceConfig decoded;
+    memset(&decoded, 0xA5, sizeof(decoded));
+    deserialize_device_config(encoded, &decoded);
+    if (memcmp(encoded, expected, sizeof(expected)) == 0 && memcmp(encoded + 8, "Device1", 8) == 0 &&
+        decoded.id == config.id && decoded.sensor_value == config.sensor_value &&
+        memcmp(decoded.name, config.name, sizeof(config.name)) == 0) {
+        printf("PASS: DeviceConfig encodes to %u little-endian bytes and decodes back.\n", (unsigned)DEVICE_CONFIG_SIZE);
+    } else {
+        printf("FAIL: DeviceConfig codec produced an unexpected layout.\n");
+    }
+
+    uint8_t payload[3] = { 1, 2, 3 };
+    flash_data data = { .valid = true, .write_count = 7, .data_len = sizeof(payload), .data_ptr = payload };
+    uint8_t buffer[FLASH_HEADER_SIZE + sizeof(payload)];
+    serialize_flash_data(&data, buffer, sizeof(buffer));
+    flash_data header;
+    flash_header_decode(buffer, &header);
+    if (buffer[0] == 1 && header.write_count == 7 && header.data_len == sizeof(payload) &&
+        header.data_crc == crc32c(payload, sizeof(payload)) &&
+        header.header_crc == crc32c(buffer + FLASH_HEADER_STATE_SIZE, FLASH_HEADER_SIZE - FLASH_HEADER_STATE_SIZE - sizeof(uint32_t)) &&
+        memcmp(buffer + FLASH_HEADER_SIZE, payload, sizeof(payload)) == 0) {
+        printf("PASS: Flash header fields and checksums found at their schema offsets.\n");
+    } else {
+        printf("FAIL: Flash header layout does not match its schema.\n");
+    }
+}
+
+
+
+// DeviceConfig as it was before it had a name, for test_record_migration.
+typedef struct {
+    uint32_t id;
+    float sensor_value;
+} DeviceConfigV1;
+
+#define DEVICE_CONFIG_V1_SCHEMA(FIELD, BYTES) \
+    FIELD(id, u32)                             \
+    FIELD(sensor_value, f32)
+
+SCHEMA_CODEC(device_config_v1, DeviceConfigV1, DEVICE_CONFIG_V1_SCHEMA, DEVICE_CONFIG_V1_SIZE, 8)
+
+static void upgrade_device_config_v1(const void *old_record, void *new_record) {
+    const DeviceConfigV1 *v1 = old_record;
+    DeviceConfig *v2 = new_record;
+    v2->id = v1->id;
+    v2->sensor_value = v1->sensor_value;
+    strncpy(v2->name, "unnamed", sizeof(v2->name));
+}
+
+/**
+ * Stores a record in the layout DeviceConfig had before its name field existed, then checks that
+ * it reads back upgraded and flagged stale, that the sector is left untouched until it is
+ * migrated, and that migration copies it once to a free sector in the current layout and leaves
+ * the old sector obsolete but not erased.
+ */
+void test_record_migration() {
+    printf("Testing versioned records with lazy migration...\n");
+    static const flash_record_version_t versions[] = {
+        { .version = 1, .encoded_size = DEVICE_CONFIG_V1_SIZE, .struct_size = sizeof(DeviceConfigV1),
+          .decode = device_config_v1_decode_any, .upgrade = upgrade_device_config_v1 },
+        { .version = 2, .encoded_size = DEVICE_CONFIG_SIZE, .struct_size = sizeof(DeviceConfig),
+          .decode = device_config_decode_any, .upgrade = NULL },
+    };
+    static const flash_record_schema_t schema = { .versions = versions, .version_count = 2,
+                                                  .encode = device_config_encode_any };
+    uint32_t offset = 98304, spare = 102400; // Correctly aligned offsets reserved for the test.
+    flash_erase_safe(spare);
+
+    // Write the record the way firmware with only version 1 did.
+    DeviceConfigV1 old = { .id = 42, .sensor_value = 3.25f };
+    uint8_t stored[FLASH_RECORD_HEADER + DEVICE_CONFIG_V1_SIZE] = { 1 };
+    device_config_v1_encode(&old, stored + FLASH_RECORD_HEADER);
+    flash_write_safe(offset, stored, sizeof(stored));
+    uint32_t writes_before = 0;
+    get_flash_write_count(offset, &writes_before);
+
+    DeviceConfig config;
+    bool stale = false;
+    flash_status_t status = flash_record_read(&schema, offset, &config, &stale);
+    flash_stat_t stat;
+    flash_stat(offset, &stat);
+    if (status == FLASH_OK && stale && config.id == 42 && config.sensor_value == 3.25f &&
+        strcmp(config.name, "unnamed") == 0 && stat.data_len == sizeof(stored)) {
+        printf("PASS: Version 1 record upgraded in RAM; flash left as it was.\n");
+    } else {
+        printf("FAIL: Version 1 record read returned %s.\n", flash_status_str(status));
+    }
+
+    // The run holds the record's sector and one free one, which the copy must go to.
+    uint32_t moved = offset, again = offset;
+    flash_record_migrate(&schema, offset, offset, 2, &moved);
+    flash_record_migrate(&schema, moved, offset, 2, &again);
+    status = flash_record_read(&schema, moved, &config, &stale);
+    uint32_t writes_after = 0;
+    get_flash_write_count(offset, &writes_after);
+    flash_stat(offset, &stat);
+    if (moved == spare && again == spare && status == FLASH_OK && !stale && config.id == 42 &&
+        !stat.valid && writes_after == writes_before) {
+        printf("PASS: Migration copied the record once and left the old sector obsolete.\n");
+    } else {
+        printf("FAIL: Migration moved to %u, then to %u, stale=%d.\n", (unsigned)moved, (unsigned)again, stale);
+    }
+
+    stored[0] = 9;
+    flash_write_safe(offset, stored, sizeof(stored));
+    if (flash_record_read(&schema, offset, &config, &stale) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Unknown record version rejected.\n");
+    } else {
+        printf("FAIL: Unknown record version accepted.\n");
+    }
+}
+
+
+
+/**
+ * Stores a DeviceConfig as the fixed part of an in-place table with one of its two optional
+ * fields set, then reads everything back through pointers into XIP flash: the fixed fields, the
+ * present optional field, and the fallback for the absent one.
+ */
+void test_flash_table() {
+    printf("Testing in-place tables read from XIP...\n");
+    enum { FIELD_LOCATION, FIELD_CALIBRATION, FIELD_COUNT };
+    uint32_t offset = 102400; // Correctly aligned offset reserved for the test.
+    DeviceConfig config = { .id = 77, .sensor_value = 12.5f, .name = "Boiler" };
+    const char location[] = "Plant room 2";
+
+    uint8_t buffer[128];
+    flash_table_builder_t builder;
+    size_t payload_len = 0;
+    flash_table_builder_init(&builder, buffer, sizeof(buffer), &config, sizeof(config), FIELD_COUNT);
+    flash_table_builder_add(&builder, FIELD_LOCATION, location, sizeof(location));
+    flash_table_builder_finish(&builder, &payload_len);
+    flash_write_safe(offset, buffer, payload_len);
+
+    const flash_table_t *table = NULL;
+    flash_status_t status = flash_table_open(offset, &table);
+    if (status != FLASH_OK) {
+        printf("FAIL: Table could not be opened: %s.\n", flash_status_str(status));
+        return;
+    }
+
+    const DeviceConfig *stored = FLASH_TABLE_FIXED(table, DeviceConfig);
+    bool in_place = (uintptr_t)stored >= XIP_BASE + FLASH_TARGET_OFFSET + offset &&
+                    (uintptr_t)stored < XIP_BASE + FLASH_TARGET_OFFSET + offset + FLASH_SECTOR_SIZE &&
+                    (uintptr_t)stored % 4 == 0;
+    if (in_place && stored->id == 77 && stored->sensor_value == 12.5f && strcmp(stored->name, "Boiler") == 0) {
+        printf("PASS: Fixed fields read through an aligned pointer into flash.\n");
+    } else {
+        printf("FAIL: Fixed fields not readable in place.\n");
+    }
+
+    size_t len = 0;
+    const char *stored_location = flash_table_optional(table, FIELD_LOCATION, &len);
+    if (stored_location != NULL && len == sizeof(location) && strcmp(stored_location, location) == 0 &&
+        flash_table_u32(table, FIELD_CALIBRATION, 1000) == 1000 && flash_table_optional(table, 9, NULL) == NULL) {
+        printf("PASS: Optional field found through the offset table; absent ones fall back.\n");
+    } else {
+        printf("FAIL: Optional field lookup returned the wrong data.\n");
+    }
+
+    flash_write_safe(offset, buffer, FLASH_TABLE_PAD + 8); // Header claims more than is stored.
+    if (flash_table_open(offset, &table) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Truncated table rejected at open.\n");
+    } else {
+        printf("FAIL: Truncated table accepted.\n");
+    }
+}
+
+
+
+/**
+ * Splits seven reserved sectors into a KV, a log and a raw partition and checks that each keeps
+ * to its own sectors: KV puts copy on write within the KV partition and survive a remount that
+ * also resolves an interrupted put, a wrapping log erases only log sectors, and raw allocation
+ * and wear statistics are confined to their partition.
+ */
+void test_flash_partitions() {
+    printf("Testing partitions with per-partition policies...\n");
+    static const flash_partition_t partitions[] = {
+        { "config", 118784, 3, FLASH_PARTITION_KV },   // Correctly aligned sectors
+        { "telemetry", 131072, 2, FLASH_PARTITION_LOG }, // reserved for the test.
+        { "scratch", 139264, 2, FLASH_PARTITION_RAW },
+    };
+    static const flash_partition_t overlapping[] = {
+        { "a", 118784, 3, FLASH_PARTITION_KV },
+        { "b", 126976, 2, FLASH_PARTITION_RAW },
+    };
+    bool rejected = flash_partition_table_set(overlapping, 2) == FLASH_ERR_INVALID_DATA;
+    flash_status_t status = flash_partition_table_set(partitions, 3);
+    const flash_partition_t *config = flash_partition_find("config");
+    const flash_partition_t *telemetry = flash_partition_find("telemetry");
+    const flash_partition_t *scratch = flash_partition_find("scratch");
+    if (rejected && status == FLASH_OK && config == &partitions[0] && telemetry == &partitions[1] &&
+        flash_partition_find("missing") == NULL) {
+        printf("PASS: Partition table checked and partitions found by name.\n");
+    } else {
+        printf("FAIL: Partition table (overlap rejected: %d, set: %s).\n", rejected, flash_status_str(status));
+        return;
+    }
+    for (uint32_t i = 0; i < config->sectors; i++) {
+        flash_erase_safe(config->first_offset + i * FLASH_SECTOR_SIZE);
+    }
+
+    // Overwriting a key moves it to another sector of the partition and frees the old one.
+    static flash_kv_t kv;
+    flash_kv_mount(&kv, config);
+    DeviceConfig first = { .id = 1, .sensor_value = 1.0f, .name = "Pump" };
+    DeviceConfig second = { .id = 1, .sensor_value = 2.0f, .name = "Pump" };
+    const char label[] = "north wing";
+    flash_kv_put(&kv, 1, &first, sizeof(first));
+    uint32_t old_offset = kv.offsets[0];
+    flash_kv_put(&kv, 2, label, sizeof(label));
+    flash_kv_put(&kv, 1, &second, sizeof(second));
+    DeviceConfig read_back = { 0 };
+    size_t len = 0;
+    flash_stat_t old_stat;
+    flash_stat(old_offset, &old_stat);
+    bool in_partition = true;
+    for (uint16_t i = 0; i < kv.count; i++) {
+        in_partition = in_partition && kv.offsets[i] >= config->first_offset &&
+                       kv.offsets[i] < config->first_offset + config->sectors * FLASH_SECTOR_SIZE;
+    }
+    if (flash_kv_get(&kv, 1, &read_back, sizeof(read_back), &len) == FLASH_OK && len == sizeof(second) &&
+        read_back.sensor_value == 2.0f && !old_stat.valid && in_partition) {
+        printf("PASS: KV put copied on write within the partition and reclaimed the old sector.\n");
+    } else {
+        printf("FAIL: KV put (len %u, old sector valid: %d, in partition: %d).\n", (unsigned)len, old_stat.valid, in_partition);
+    }
+
+    // A put cut short after writing the new copy leaves two copies; mounting keeps the newer one.
+    uint32_t free_offset = 0;
+    flash_alloc_sector_in(config->first_offset, config->sectors, &free_offset);
+    uint8_t record[FLASH_KV_RECORD_HEADER + sizeof(first)];
+    schema_put_u16(record, 1);
+    schema_put_u32(record + 2, kv.next_seq);
+    memcpy(record + FLASH_KV_RECORD_HEADER, &first, sizeof(first));
+    flash_write_safe(free_offset, record, sizeof(record));
+    uint32_t superseded = kv.offsets[kv.keys[0] == 1 ? 0 : 1];
+    static flash_kv_t remounted;
+    flash_kv_mount(&remounted, config);
+    char label_back[sizeof(label)] = "";
+    flash_stat(superseded, &old_stat);
+    bool recovered = remounted.count == 2 &&
+                     flash_kv_get(&remounted, 1, &read_back, sizeof(read_back), NULL) == FLASH_OK && read_back.sensor_value == 1.0f &&
+                     flash_kv_get(&remounted, 2, label_back, sizeof(label_back), NULL) == FLASH_OK && strcmp(label_back, label) == 0;
+    if (recovered && !old_stat.valid && flash_kv_delete(&remounted, 2) == FLASH_OK &&
+        flash_kv_get(&remounted, 2, label_back, sizeof(label_back), NULL) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Remount kept the newer copy of an interrupted put and erased the older.\n");
+    } else {
+        printf("FAIL: Remount (recovered: %d, superseded copy valid: %d).\n", recovered, old_stat.valid);
+    }
+
+    // A wrapping log erases its own sectors over and over without touching the KV partition.
+    uint32_t config_wear[3];
+    for (uint32_t i = 0; i < config->sectors; i++) {
+        get_flash_write_count(config->first_offset + i * FLASH_SECTOR_SIZE, &config_wear[i]);
+    }
+    static flash_log_t log;
+    flash_partition_log_open(telemetry, &log, sizeof(flash_sample_t));
+    for (uint32_t i = 0; i < 5 * log.records_per_sector; i++) {
+        flash_sample_t sample = { .timestamp_ms = i, .value = (float)i };
+        flash_log_append(&log, &sample);
+    }
+    bool untouched = log.first_offset == telemetry->first_offset && log.sector_erases >= 4;
+    for (uint32_t i = 0; i < config->sectors; i++) {
+        uint32_t wear = 0;
+        get_flash_write_count(config->first_offset + i * FLASH_SECTOR_SIZE, &wear);
+        untouched = untouched && wear == config_wear[i];
+    }
+    if (untouched && flash_partition_log_open(config, &log, sizeof(flash_sample_t)) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Log erased %u of its own sectors and no configuration sector.\n", (unsigned)log.sector_erases);
+    } else {
+        printf("FAIL: Log partition wore sectors outside itself.\n");
+    }
+
+    // The log's sectors have no record header, yet the wear statistics count them, erases and all.
+    flash_wear_monitor_t log_monitor;
+    flash_wear_init_range(&log_monitor, telemetry->first_offset, telemetry->sectors);
+    flash_wear_step(&log_monitor, 0);
+    const flash_wear_stats_t *log_wear = flash_wear_stats(&log_monitor);
+    if (log_wear->sectors == telemetry->sectors && log_wear->total >= log.sector_erases) {
+        printf("PASS: Wear statistics include the log sectors (%u erases in total).\n", (unsigned)log_wear->total);
+    } else {
+        printf("FAIL: Wear statistics saw %u log sectors and %u erases.\n", (unsigned)log_wear->sectors, (unsigned)log_wear->total);
+    }
+
+    // Raw allocation and wear statistics see only their own partition.
+    flash_erase_safe(scratch->first_offset);
+    flash_erase_safe(scratch->first_offset + FLASH_SECTOR_SIZE);
+    uint32_t allocated = 0;
+    status = flash_partition_alloc(scratch, &allocated);
+    flash_wear_monitor_t monitor;
+    flash_wear_init_range(&monitor, scratch->first_offset, scratch->sectors);
+    flash_wear_step(&monitor, 0);
+    if (status == FLASH_OK && allocated >= scratch->first_offset && allocated < scratch->first_offset + 2 * FLASH_SECTOR_SIZE &&
+        flash_partition_alloc(config, &allocated) == FLASH_ERR_INVALID_DATA && flash_wear_stats(&monitor)->sectors == 2) {
+        printf("PASS: Raw allocation and wear statistics stayed within their partitions.\n");
+    } else {
+        printf("FAIL: Raw allocation returned '%s' at offset %u.\n", flash_status_str(status), (unsigned)allocated);
+    }
+    flash_partition_table_set(NULL, 0);
+}
+
+
+
+/**
+ * Mounts a KV partition lazily: the mount itself reads nothing, background steps index a bounded
+ * number of sectors, and the first read completes the index of its own partition only. The
+ * header table is warmed the same way, a few sectors per step.
+ */
+void test_lazy_mount() {
+    printf("Testing lazy mounting and background indexing...\n");
+    static const flash_partition_t partitions[] = {
+        { "config", 118784, 3, FLASH_PARTITION_KV },    // Correctly aligned sectors
+        { "settings", 131072, 4, FLASH_PARTITION_KV },  // reserved for the test.
+    };
+    flash_partition_table_set(partitions, 2);
+    static flash_kv_t config, settings;
+    flash_kv_mount(&config, &partitions[0]);
+    uint32_t baud = 115200;
+    flash_kv_put(&config, 7, &baud, sizeof(baud));
+
+    flash_cache_invalidate();
+    flash_kv_mount_lazy(&config, &partitions[0]);
+    flash_kv_mount_lazy(&settings, &partitions[1]);
+    bool deferred = config.scanned == 0 && !flash_kv_mounted(&config) && !flash_kv_mounted(&settings);
+    flash_kv_mount_step(&config, 1);
+    bool stepped = config.scanned == 1;
+
+    uint32_t read_back = 0;
+    flash_status_t status = flash_kv_get(&config, 7, &read_back, sizeof(read_back), NULL);
+    if (deferred && stepped && status == FLASH_OK && read_back == baud && flash_kv_mounted(&config) &&
+        settings.scanned == 0) {
+        printf("PASS: First read indexed its own partition only, after a mount that read nothing.\n");
+    } else {
+        printf("FAIL: Lazy mount (deferred: %d, stepped: %d, read: %s).\n", deferred, stepped, flash_status_str(status));
+    }
+
+    uint32_t steps = 0;
+    while (!flash_kv_mounted(&settings)) {
+        flash_kv_mount_step(&settings, 1);
+        steps++;
+    }
+    uint32_t warm_steps = 1;
+    while (!flash_cache_preload_step(64)) {
+        warm_steps++;
+    }
+    if (steps == partitions[1].sectors && warm_steps <= (FLASH_USER_SECTORS + 63) / 64) {
+        printf("PASS: Background steps completed the index in %u and the header table in %u calls.\n",
+               (unsigned)steps, (unsigned)warm_steps);
+    } else {
+        printf("FAIL: Background indexing took %u and %u steps.\n", (unsigned)steps, (unsigned)warm_steps);
+    }
+    flash_partition_table_set(NULL, 0);
+}
+
+
+
+/**
+ * Mounts a KV partition from checkpoints: the first mount writes one, later puts are journalled
+ * behind it, and remounting replays the journal, dropping a journalled put that never reached
+ * flash. A corrupted newest checkpoint falls back on the previous one and its journal.
+ */
+void test_kv_checkpoint() {
+    printf("Testing KV checkpoints and journal replay...\n");
+    static const flash_partition_t config = { "config", 118784, 3, FLASH_PARTITION_KV };      // Correctly aligned sectors
+    static const flash_partition_t area = { "checkpoint", 139264, 2, FLASH_PARTITION_RAW };  // reserved for the test.
+    for (uint32_t i = 0; i < config.sectors; i++) {
+        flash_erase_safe(config.first_offset + i * FLASH_SECTOR_SIZE);
+    }
+    flash_erase_safe(area.first_offset);
+    flash_erase_safe(area.first_offset + FLASH_SECTOR_SIZE);
+
+    static flash_kv_t kv;
+    flash_status_t status = flash_kv_mount_checkpoint(&kv, &config, &area);
+    bool first = status == FLASH_OK && kv.generation == 1 && kv.count == 0;
+    uint32_t low = 10, high = 90, limit = 0;
+    flash_kv_put(&kv, 1, &low, sizeof(low));
+    flash_kv_put(&kv, 2, &high, sizeof(high));
+    flash_kv_put(&kv, 1, &high, sizeof(high));
+
+    // A put whose entry was journalled but whose value was never programmed.
+    uint32_t free_offset = 0;
+    flash_alloc_sector_in(config.first_offset, config.sectors, &free_offset);
+    uint8_t entry[FLASH_KV_JOURNAL_ENTRY] = { 0 };
+    schema_put_u32(entry, kv.next_seq);
+    schema_put_u32(entry + 4, free_offset);
+    schema_put_u16(entry + 8, 3);
+    entry[10] = 1; // Put.
+    schema_put_u32(entry + 12, crc32c(entry, 12));
+    flash_program_partial(FLASH_TARGET_OFFSET + area.first_offset + FLASH_KV_JOURNAL_START +
+                          kv.journal_next * FLASH_KV_JOURNAL_ENTRY, entry, sizeof(entry));
+
+    flash_cache_invalidate();
+    static flash_kv_t replayed;
+    status = flash_kv_mount_checkpoint(&replayed, &config, &area);
+    bool values = flash_kv_get(&replayed, 1, &limit, sizeof(limit), NULL) == FLASH_OK && limit == high &&
+                  flash_kv_get(&replayed, 2, &limit, sizeof(limit), NULL) == FLASH_OK && limit == high &&
+                  flash_kv_get(&replayed, 3, &limit, sizeof(limit), NULL) == FLASH_ERR_INVALID_DATA;
+    if (first && status == FLASH_OK && values && replayed.generation == 1 && replayed.journal_next == 4) {
+        printf("PASS: Remount replayed %u journal entries behind the checkpoint.\n", (unsigned)replayed.journal_next);
+    } else {
+        printf("FAIL: Checkpoint replay (first mount: %d, values: %d, journal: %u).\n", first, values, (unsigned)replayed.journal_next);
+    }
+
+    // A new checkpoint goes to the other sector; damaging it falls back on the previous one.
+    flash_kv_checkpoint(&replayed);
+    static flash_kv_t newest;
+    flash_kv_mount_checkpoint(&newest, &config, &area);
+    bool advanced = replayed.checkpoint_slot == 1 && newest.generation == 2 && newest.journal_next == 0 && newest.count == 2;
+    uint8_t zero = 0;
+    flash_program_partial(FLASH_TARGET_OFFSET + area.first_offset + FLASH_SECTOR_SIZE + FLASH_HEADER_SIZE + 30, &zero, 1);
+    flash_cache_invalidate();
+    static flash_kv_t fallback;
+    flash_kv_mount_checkpoint(&fallback, &config, &area);
+    if (advanced && fallback.generation == 1 && fallback.count == 2 &&
+        flash_kv_get(&fallback, 1, &limit, sizeof(limit), NULL) == FLASH_OK && limit == high) {
+        printf("PASS: Damaged checkpoint %u ignored in favour of checkpoint %u and its journal.\n",
+               (unsigned)newest.generation, (unsigned)fallback.generation);
+    } else {
+        printf("FAIL: Checkpoint fallback (advanced: %d, generation: %u).\n", advanced, (unsigned)fallback.generation);
+    }
+}
+
+
+
+/**
+ * Walks a sector through its header states. A committed write is VALID; marking it obsolete is a
+ * one-byte program that keeps the write count and header checksum intact; a write cut short
+ * before its commit stays WRITING and reads as holding no data.
+ */
+void test_sector_states() {
+    printf("Testing sector states and obsolete marking...\n");
+    uint32_t offset = 147456; // Correctly aligned offset reserved for the test.
+    uint8_t data[100];
+    memset(data, 0x3C, sizeof(data));
+    flash_write_safe(offset, data, sizeof(data));
+    flash_sector_state_t written, marked;
+    flash_sector_state(offset, &written);
+    uint32_t count_before = 0, count_after = 0;
+    get_flash_write_count(offset, &count_before);
+
+    uint64_t start = time_us_64();
+    flash_status_t status = flash_mark_obsolete(offset);
+    uint64_t mark_us = time_us_64() - start;
+    flash_sector_state(offset, &marked);
+    flash_cache_invalidate();
+    get_flash_write_count(offset, &count_after);
+    uint8_t buffer[sizeof(data)];
+    if (written == FLASH_STATE_VALID && status == FLASH_OK && marked == FLASH_STATE_OBSOLETE &&
+        count_after == count_before && flash_read_safe(offset, buffer, sizeof(buffer), NULL) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Marked obsolete in %u us without an erase (write count still %u).\n", (unsigned)mark_us, count_after);
+    } else {
+        printf("FAIL: Obsolete marking (state %02x -> %02x, write count %u -> %u).\n", written, marked, count_before, count_after);
+    }
+
+    // A header programmed as WRITING whose commit never happened, over a fully erased sector.
+    start = time_us_64();
+    flash_erase_safe(offset);
+    uint64_t erase_us = time_us_64() - start;
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(FLASH_TARGET_OFFSET + offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    flash_data torn = { .valid = true, .write_count = count_after + 2, .data_len = sizeof(data), .data_ptr = data };
+    serialize_flash_data(&torn, page, sizeof(page));
+    page[0] = FLASH_STATE_WRITING;
+    flash_program_partial(FLASH_TARGET_OFFSET + offset, page, sizeof(page));
+    flash_cache_invalidate();
+    flash_stat_t stat;
+    status = flash_stat(offset, &stat);
+    flash_sector_state_t state;
+    flash_sector_state(offset, &state);
+    if (status == FLASH_OK && state == FLASH_STATE_WRITING && !stat.valid && stat.write_count == count_after + 2 &&
+        flash_read_safe(offset, buffer, sizeof(buffer), NULL) == FLASH_ERR_INVALID_DATA) {
+        printf("PASS: Uncommitted write reads as empty and keeps its write count (erase took %u us).\n", (unsigned)erase_us);
+    } else {
+        printf("FAIL: Uncommitted write (status %s, state %02x, valid %d).\n", flash_status_str(status), state, stat.valid);
+    }
+    flash_erase_safe(offset);
+}
+
+void test_erase_counts() {
+    printf("Testing erase counts kept outside the erased sectors...\n");
+    uint32_t offset = 151552; // Correctly aligned offset reserved for the test.
+    uint8_t data[64];
+    memset(data, 0x5A, sizeof(data));
+    flash_write_safe(offset, data, sizeof(data));
+    uint32_t written = 0, erased = 0;
+    get_flash_write_count(offset, &written);
+
+    // The erase leaves nothing behind in the sector; the count survives in the counter area only.
+    flash_erase_safe(offset);
+    const uint8_t *sector = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + offset);
+    bool blank = true;
+    for (size_t i = 0; i < FLASH_SECTOR_SIZE && blank; i++) {
+        blank = sector[i] == 0xFF;
+    }
+    flash_erase_count_reload();
+    flash_cache_invalidate();
+    get_flash_write_count(offset, &erased);
+    if (blank && erased == written + 1) {
+        printf("PASS: Erase left the sector blank and its count (%u) in the counter area.\n", erased);
+    } else {
+        printf("FAIL: Pure erase (blank %d, write count %u -> %u).\n", blank, written, erased);
+    }
+
+    // Compaction carries the count of the blank sector into the new log slot and leaves the sector alone.
+    uint32_t entries_before = flash_erase_count_entries();
+    flash_status_t status = flash_erase_count_compact();
+    flash_erase_count_reload();
+    flash_cache_invalidate();
+    uint32_t compacted = 0;
+    get_flash_write_count(offset, &compacted);
+    blank = true;
+    for (size_t i = 0; i < FLASH_SECTOR_SIZE && blank; i++) {
+        blank = sector[i] == 0xFF;
+    }
+    if (status == FLASH_OK && compacted == erased && blank && flash_erase_count_get(offset) == erased &&
+        flash_erase_count_entries() < entries_before) {
+        printf("PASS: Compaction kept the count (%u) and shrank the log from %u to %u entries.\n",
+               compacted, entries_before, flash_erase_count_entries());
+    } else {
+        printf("FAIL: Compaction (status %s, write count %u, blank %d, %u entries).\n",
+               flash_status_str(status), compacted, blank, flash_erase_count_entries());
+    }
+
+    uint32_t rewritten = 0;
+    flash_write_safe(offset, data, sizeof(data));
+    get_flash_write_count(offset, &rewritten);
+    if (rewritten == erased + 1) {
+        printf("PASS: Next write continued the count at %u.\n", rewritten);
+    } else {
+        printf("FAIL: Write after compaction counted %u, expected %u.\n", rewritten, erased + 1);
+    }
+    flash_erase_safe(offset);
+}
@@ -45,4 +45,73 @@ void test_null_or_zero_data();
 //reading, and recovering a structured configuration from flash memory.
 void test_save_and_recover_struct();
 
+// Test function for verifying that flash_stat and the cached header table agree with flash.
+void test_flash_stat_and_cache();
+
+// Test function for verifying the incremental wear statistics scan.
+void test_wear_statistics();
+
+// Test function for verifying read-after-write checks and the sector allocator.
+void test_verify_and_allocate();
+
+// Test function for verifying the CRC32C kernel and checksum protection of stored records.
+void test_crc_protection();
+
+// Test function for verifying the binary framed protocol end to end through a loopback sink.
+void test_binary_protocol();
+
+// Test function for verifying pipelined protocol requests answered out of order with hazards respected.
+void test_pipelined_protocol();
+
+// Test function for verifying protocol frames and typed text sharing the console line reader.
+void test_framed_console();
+
+// Test function for verifying that a record dumped and loaded back sector by sector survives intact.
+void test_bulk_dump_load();
+
+// Test function for verifying the persistent message queue, including wrap-around and recovery after reopening.
+void test_flash_queue();
+
+// Test function for verifying the circular record log, its reopening and its wrap-around.
+void test_flash_log();
+
+// Test function for verifying that compressed time-series blocks decode bit for bit.
+void test_flash_ts();
+
+// Test function for verifying zone-map range queries over a compressed time series.
+void test_flash_ts_query();
+
+// Test function for verifying the downsampled rollup tiers and their retention.
+void test_flash_rollup();
+
+// Test function for verifying the columnar history of configuration snapshots.
+void test_columnar_configs();
+
+// Test function for verifying the byte layout produced by the schema-generated codecs.
+void test_schema_codecs();
+
+// Test function for verifying that older record versions are read and migrated to the current layout.
+void test_record_migration();
+
+// Test function for verifying tables read in place, with optional fields found through their offsets.
+void test_flash_table();
+
+// Test function for verifying the header-only C++ typed layer.
+void test_flash_typed();
+
+// Test function for verifying named partitions keep allocation, garbage collection and wear to themselves.
+void test_flash_partitions();
+
+// Test function for verifying lazy, incremental mounting of KV partitions.
+void test_lazy_mount();
+
+// Test function for verifying KV mounts from a checkpoint and replay of its journal.
+void test_kv_checkpoint();
+
+// Test function for verifying the sector state byte and marking data obsolete without an erase.
+void test_sector_states();
+
+// Test function for verifying erase counts kept in the append-only erase-count log.
+void test_erase_counts();
+
 #endif // TEST_H